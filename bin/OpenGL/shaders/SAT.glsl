@@ -14,34 +14,39 @@ void main()
 
 -- FragmentH
 
+// One pass of Hensley's recursive doubling: adds the texel 2^iteration to the left.
+// texelFetch keeps the sums exact whatever the filter and wrap state of image is.
+
 out vec4 FragColor;
-in vec2 TexCoords;
 
 uniform sampler2D image;
 uniform int iteration;
 
 void main()
 {
-	vec2 imageSize = vec2(textureSize(image,0));
-	vec2 step = vec2(1.0/imageSize.x, 1.0/imageSize.y);
-	vec4 currentPixel = texture(image, TexCoords);
-	vec4 leftPixel = texture(image, vec2(TexCoords.s - exp2(float(iteration)) * step.s, TexCoords.t));
-    FragColor = currentPixel + leftPixel;
-} 
+	ivec2 P = ivec2(gl_FragCoord.xy);
+	ivec2 left = P - ivec2(1 << iteration, 0);
+	vec4 sum = texelFetch(image, P, 0);
+	if (left.x >= 0)
+		sum += texelFetch(image, left, 0);
+	FragColor = sum;
+}
 
 -- FragmentV
 
+// Same as FragmentH for the texel 2^iteration above (lower t).
+
 out vec4 FragColor;
-in vec2 TexCoords;
 
 uniform sampler2D image;
 uniform int iteration;
 
 void main()
 {
-	vec2 imageSize = vec2(textureSize(image,0));
-	vec2 step = vec2(1.0/imageSize.x, 1.0/imageSize.y);
-	vec4 currentPixel = texture(image, TexCoords);
-	vec4 topPixel = texture(image, vec2(TexCoords.s, TexCoords.t - exp2(float(iteration)) * step.t));
-    FragColor = currentPixel + topPixel;
-} 
\ No newline at end of file
+	ivec2 P = ivec2(gl_FragCoord.xy);
+	ivec2 top = P - ivec2(0, 1 << iteration);
+	vec4 sum = texelFetch(image, P, 0);
+	if (top.y >= 0)
+		sum += texelFetch(image, top, 0);
+	FragColor = sum;
+}
@@ -18,18 +18,24 @@ out highp vec4 FragColor;
 
 in vec2 TexCoords;
 
-uniform sampler2D gPosition;
 uniform sampler2D gNormal;
+// positive view depth, rebuilt every frame by depthPyramid.glsl
+uniform sampler2D depthPyramid;
 
 uniform mat4 view;
+uniform mat4 inverseProjection;
 uniform float sampleRadius = 1.0;
 uniform int aoSamples = 20;
 uniform int sampleTurns = 16;
 uniform float depthThreshold = 0.0005;
 uniform float shadowScalar = 1.3;
 uniform float shadowContrast = 0.5;
+// the AO target has 1 / aoScale of the G-buffer resolution, its texel t is the AO of pixel t * aoScale
+uniform int aoScale = 1;
 
 const float PI = 3.14159265359;
+// samples closer than 2^LOG_MAX_OFFSET pixels read level 0 of the pyramid
+const int LOG_MAX_OFFSET = 3;
 
 float randAngle()
 {
@@ -38,21 +44,39 @@ float randAngle()
 	return (30u * x ^ y + 10u * x * y);
 }
 
+// view space position of a depth pyramid texel of mip level m
+vec3 ViewPosition(ivec2 texel, int m)
+{
+	float z = texelFetch(depthPyramid, texel, m).r;
+	vec2 uv = (vec2(texel) + 0.5) / vec2(textureSize(depthPyramid, m));
+	// the ray through the texel on the far plane, scaled to the depth
+	vec4 ray = inverseProjection * vec4(uv * 2.0 - 1.0, 1.0, 1.0);
+	ray.xyz /= ray.w;
+	return ray.xyz * (z / -ray.z);
+}
+
+vec3 DecodeNormal(vec2 encoded)
+{
+	vec2 e = encoded * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
 
 void main()
 {
-	// transform position and normal to view space
-	vec3 worldPos = texture(gPosition, TexCoords).xyz;
-	vec3 worldNorm = texture(gNormal, TexCoords).xyz;
-	vec3 P = vec3(view * vec4(worldPos, 1.0));
+	// reconstruct the view space position from depth, transform the normal to view space
+	ivec2 px = ivec2(gl_FragCoord.xy) * aoScale;
+	vec3 P = ViewPosition(px, 0);
+	vec3 worldNorm = DecodeNormal(texelFetch(gNormal, px, 0).rg);
 	vec3 N = normalize(vec3(view * vec4(worldNorm, 0.0)));
 	
 	float aoValue = 0.0;
 	float perspectiveRadius = (sampleRadius * 100.0 / P.z);
 	
-	int max_mip = textureQueryLevels(gPosition) - 1;
+	int max_mip = textureQueryLevels(depthPyramid) - 1;
 	const float TAU = 2.0 * PI;
-	ivec2 px = ivec2(gl_FragCoord.xy);
 	
 	// Perform random sampling and estimate ambient occlusion for the current fragment
 	for (int i = 0; i < aoSamples; ++i)
@@ -62,12 +86,11 @@ void main()
 		float h = perspectiveRadius * alpha;
 		float theta = TAU * alpha * sampleTurns + randAngle();
 		vec2 u = vec2(cos(theta), sin(theta));
-		// McGuire paper MIP calculation
-		int m = clamp(findMSB(int(h)) - 4, 0, max_mip);
-		ivec2 mip_pos = clamp((ivec2(h * u) + px) >> m, ivec2(0), textureSize(gPosition, m) - ivec2(1));
+		// McGuire paper MIP calculation, far samples read the smaller levels of the pyramid
+		int m = clamp(findMSB(int(abs(h))) - LOG_MAX_OFFSET, 0, max_mip);
+		ivec2 mip_pos = clamp((ivec2(h * u) + px) >> m, ivec2(0), textureSize(depthPyramid, m) - ivec2(1));
 		
-		vec3 worldPi = texelFetch(gPosition, mip_pos, m).xyz;
-		vec3 Pi = vec3(view * vec4(worldPi, 1.0));
+		vec3 Pi = ViewPosition(mip_pos, m);
 		vec3 V = Pi - P;
 		float sqrLen    = dot(V, V);
 		float Heaveside = step(sqrt(sqrLen), sampleRadius);
@@ -84,4 +107,76 @@ void main()
 	aoValue = max(0.0, 1.0 - pow(aoValue, shadowContrast));
 	
     FragColor = vec4(aoValue, aoValue, aoValue, 1.0);
-}
\ No newline at end of file
+}
+
+-- Upsample
+
+// Joint bilateral upsampling of the low resolution AO to the G-buffer resolution: the four
+// nearest AO texels are weighted bilinearly and by how well the depth and normal they were
+// computed for match the ones of the pixel, so occlusion doesn't bleed across edges.
+
+out highp vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D aoTexture;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseProjection;
+uniform int aoScale = 2;
+// relative view depth difference at which a texel's weight drops to 1/e
+uniform float depthTolerance = 0.05;
+
+float ViewDepth(ivec2 texel)
+{
+	float depth = texelFetch(gDepth, texel, 0).r;
+	vec2 uv = (vec2(texel) + 0.5) / vec2(textureSize(gDepth, 0));
+	vec4 P = inverseProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+	return -P.z / P.w;
+}
+
+vec3 DecodeNormal(vec2 encoded)
+{
+	vec2 e = encoded * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+void main()
+{
+	ivec2 px = ivec2(gl_FragCoord.xy);
+	if (texelFetch(gDepth, px, 0).r == 1.0)
+	{
+		FragColor = vec4(1.0);
+		return;
+	}
+	float z = ViewDepth(px);
+	vec3 N = DecodeNormal(texelFetch(gNormal, px, 0).rg);
+
+	vec2 aoPos = vec2(px) / float(aoScale);
+	ivec2 base = ivec2(floor(aoPos));
+	vec2 f = aoPos - vec2(base);
+	ivec2 aoMax = textureSize(aoTexture, 0) - ivec2(1);
+	ivec2 gMax = textureSize(gDepth, 0) - ivec2(1);
+
+	float sum = 0.0;
+	float weightSum = 0.0;
+	for (int i = 0; i < 4; i++)
+	{
+		ivec2 offset = ivec2(i & 1, i >> 1);
+		ivec2 t = clamp(base + offset, ivec2(0), aoMax);
+		ivec2 g = min(t * aoScale, gMax);
+		vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+		float depthWeight = exp(-abs(ViewDepth(g) - z) / (depthTolerance * z));
+		float normalWeight = pow(max(dot(N, DecodeNormal(texelFetch(gNormal, g, 0).rg)), 0.0), 8.0);
+		// a small bilinear part keeps the sum above zero when no texel matches
+		float w = bilinear.x * bilinear.y * (depthWeight * normalWeight + 1e-4);
+		sum += texelFetch(aoTexture, t, 0).r * w;
+		weightSum += w;
+	}
+	float ao = sum / weightSum;
+	FragColor = vec4(ao, ao, ao, 1.0);
+}
@@ -3,8 +3,8 @@
 precision highp float;
 precision highp int;
 
-layout(rgba32f, binding = 0, location = 0) uniform readonly  image2D uSrc;
-layout(rgba32f, binding = 1, location = 1) uniform writeonly image2D uDst;
+layout(r16f, binding = 0, location = 0) uniform readonly  image2D uSrc;
+layout(r16f, binding = 1, location = 1) uniform writeonly image2D uDst;
 
 
 -- Compute
@@ -21,12 +21,15 @@ uniform BlurData
 	float Weights[65];  // Weight[2w + 1] = { ... }
 } Blur;
 
-uniform sampler2D gPosition;
+uniform sampler2D gDepth;
 uniform sampler2D gNormal;
 uniform mat4 view;
 uniform mat4 projection;
+uniform mat4 inverseProjection;
 uniform ivec2 direction;
 uniform vec2 screenSize;
+// the AO images have 1 / aoScale of the G-buffer resolution (screenSize)
+uniform int aoScale = 1;
 
 const float PI = 3.14159265359;
 
@@ -36,23 +39,35 @@ shared float d[128 + 64]; // View Depth
 shared vec3  n[128 + 64];
 shared float D[128 + 64]; // Persp Depth
 
+vec3 DecodeNormal(vec2 encoded)
+{
+	vec2 e = encoded * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
 float calculateD(ivec2 texel)
 {
-	vec3 worldPos = texelFetch(gPosition, texel, 0).xyz;
-	vec3 viewPos = vec3(view * vec4(worldPos, 1.0));
-	return viewPos.z;
+	// view space depth, reconstructed from the depth buffer
+	texel *= aoScale;
+	float depth = texelFetch(gDepth, texel, 0).r;
+	vec2 uv = (vec2(texel) + 0.5) / screenSize;
+	vec4 viewPos = inverseProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+	return viewPos.z / viewPos.w;
 }
 
 vec3 calculateN(ivec2 texel)
 {
-	vec3 worldNorm = texelFetch(gNormal, texel, 0).xyz;
+	vec3 worldNorm = DecodeNormal(texelFetch(gNormal, texel * aoScale, 0).rg);
 	vec3 N = normalize(vec3(view * vec4(worldNorm, 0.0)));
 	return N;
 }
 
 float calculateDD(ivec2 texel)
 {
-	float depth = texelFetch(gPosition, texel, 0).w;
+	float depth = texelFetch(gDepth, texel * aoScale, 0).r;
 	return depth;
 }
 
@@ -79,7 +94,6 @@ void main()
 	//
 	//   GlobalInvocation = GroupId * GroupSize + LocalInvocation
 	ivec2 currTexel = ivec2(gl_GlobalInvocationID.x * direction + gl_GlobalInvocationID.y * (1 - direction));
-	vec2 baseUv = vec2(float(currTexel.x), float(currTexel.y)) / screenSize;
 	uint texelIndex = gl_LocalInvocationID.x;
 	int workWidth = int(gl_WorkGroupSize.x);
 	
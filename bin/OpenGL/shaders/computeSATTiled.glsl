@@ -0,0 +1,111 @@
+-- _global
+
+precision highp float;
+precision highp int;
+
+// Tiled SAT: every SAT_TILE_SIZE x SAT_TILE_SIZE tile of the shadow map gets its own local
+// SAT, so the stored sums stay small and keep their float precision. The offsets needed to
+// turn a local value into a global one are kept in double precision:
+//   columnStrips[tileRow * size + x]    sum of the tiles above, restricted to columns <= x of x's tile
+//   rowStrips[tileColumn * size + y]    sum of the tiles to the left, restricted to rows <= y of y's tile
+//   tileGrid[tileRow * tiles + tileColumn]  sum of all tiles above and to the left
+// SAT(x, y) = tileGrid + columnStrips + rowStrips + tile_sat(x, y), see FetchTiledSAT() in deferredSASVSM.glsl
+layout(rg32f, binding = 1, location = 1) uniform image2D tile_sat;
+
+layout(std430, binding = 0) buffer SATColumnStrips { dvec2 columnStrips[]; };
+layout(std430, binding = 1) buffer SATRowStrips { dvec2 rowStrips[]; };
+layout(std430, binding = 2) buffer SATTileGrid { dvec2 tileGrid[]; };
+
+
+-- ScanTiles
+
+// One workgroup per tile, dispatched over the rectangle of tiles starting at firstTile. The tile
+// is loaded into shared memory, then every invocation scans one row and after that one column.
+
+layout(rg32f, binding = 0, location = 0) uniform image2D moments_image;
+
+uniform ivec2 firstTile;
+
+layout (local_size_x = SAT_TILE_SIZE) in;
+
+shared vec2 tile_data[SAT_TILE_SIZE * SAT_TILE_SIZE];
+
+void main()
+{
+	int id = int(gl_LocalInvocationID.x);
+	ivec2 origin = (firstTile + ivec2(gl_WorkGroupID.xy)) * SAT_TILE_SIZE;
+
+	for (int y = 0; y < SAT_TILE_SIZE; y++)
+		tile_data[y * SAT_TILE_SIZE + id] = imageLoad(moments_image, origin + ivec2(id, y)).xy;
+
+	memoryBarrierShared();
+	barrier();
+
+	vec2 sum = vec2(0.0);
+	for (int x = 0; x < SAT_TILE_SIZE; x++)
+	{
+		sum += tile_data[id * SAT_TILE_SIZE + x];
+		tile_data[id * SAT_TILE_SIZE + x] = sum;
+	}
+
+	memoryBarrierShared();
+	barrier();
+
+	sum = vec2(0.0);
+	for (int y = 0; y < SAT_TILE_SIZE; y++)
+	{
+		sum += tile_data[y * SAT_TILE_SIZE + id];
+		imageStore(tile_sat, origin + ivec2(id, y), vec4(sum, 0.0, 0.0));
+	}
+}
+
+-- TileStrips
+
+// One invocation per texel column x (and texel row y == x): running sums of the last row
+// (column) of the local SATs, one exclusive prefix per tile row (tile column).
+
+layout (local_size_x = 64) in;
+
+void main()
+{
+	int i = int(gl_GlobalInvocationID.x);
+	int size = imageSize(tile_sat).x;
+	if (i >= size)
+		return;
+
+	int tileCount = size / SAT_TILE_SIZE;
+	dvec2 column = dvec2(0.0);
+	dvec2 row = dvec2(0.0);
+	for (int tile = 0; tile < tileCount; tile++)
+	{
+		columnStrips[tile * size + i] = column;
+		rowStrips[tile * size + i] = row;
+
+		int edge = tile * SAT_TILE_SIZE + SAT_TILE_SIZE - 1;
+		column += dvec2(imageLoad(tile_sat, ivec2(i, edge)).xy);
+		row += dvec2(imageLoad(tile_sat, ivec2(edge, i)).xy);
+	}
+}
+
+-- TileGrid
+
+// One invocation per tile column. The row strip at the last texel row of a tile is the sum of
+// all tiles to its left, so summing those down the tile rows gives the grid prefix.
+
+layout (local_size_x = 64) in;
+
+void main()
+{
+	int tileColumn = int(gl_GlobalInvocationID.x);
+	int size = imageSize(tile_sat).x;
+	int tileCount = size / SAT_TILE_SIZE;
+	if (tileColumn >= tileCount)
+		return;
+
+	dvec2 sum = dvec2(0.0);
+	for (int tileRow = 0; tileRow < tileCount; tileRow++)
+	{
+		tileGrid[tileRow * tileCount + tileColumn] = sum;
+		sum += rowStrips[tileColumn * size + tileRow * SAT_TILE_SIZE + SAT_TILE_SIZE - 1];
+	}
+}
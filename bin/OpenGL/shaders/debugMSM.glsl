@@ -33,8 +33,8 @@ float LinearizeDepth(float depth)
 
 void main()
 {             
-    vec3 moments = texture(depthMap, TexCoords).rgb;
+    vec2 moments = texture(depthMap, TexCoords).rg;
 	
     // FragColor = vec4(vec3(LinearizeDepth(depthValue) / zFar), 1.0); // perspective
-    FragColor = vec4(moments, 1.0); // orthographic
+    FragColor = vec4(moments, 0.0, 1.0); // orthographic
 }
\ No newline at end of file
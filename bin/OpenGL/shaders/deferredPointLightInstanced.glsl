@@ -8,6 +8,7 @@ layout (location = 3) in mat4 aInstanceMatrix;
 out vec3 lightColor;
 out vec3 lightPosition;
 out float lightRadius;
+flat out int lightIndex;
 
 uniform mat4 projection;
 uniform mat4 view;
@@ -18,6 +19,7 @@ void main()
 	lightRadius = aInstanceParam.w;
 	// extract light position from the instance model matrix
 	lightPosition = vec3(aInstanceMatrix[3]);
+	lightIndex = gl_InstanceID;
     gl_Position = projection * view * aInstanceMatrix * vec4(lightRadius * aPos, 1.0);
 }
 
@@ -28,23 +30,83 @@ layout (location = 0) out vec4 FragColor;
 in vec3 lightColor;
 in float lightRadius;
 in vec3 lightPosition;
+flat in int lightIndex;
 
-uniform sampler2D gPosition;
 uniform sampler2D gNormal;
-uniform sampler2D gDiffuse;
-uniform sampler2D gSpecular;
+uniform sampler2D gAlbedo;
+uniform sampler2D gMaterial;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
 uniform vec3 viewPos;
 uniform float lightIntensity;
 uniform vec2 screenSize;
 uniform float glossiness;
 
+// dual-paraboloid SATs of the point lights, layers 2 * lightIndex (+y) and 2 * lightIndex + 1 (-y),
+// see varianceShadowMap.GeometryParaboloid
+uniform bool pointShadows = false;
+// only the first lights of the grid have shadow maps
+uniform int shadowedPointLights = 0;
+uniform sampler2DArray pointShadowSAT;
+uniform float penumbraSize = 1.0;
+uniform float shadowSaturation = 0.5;
+
+float Linstep(float min, float max, float v)
+{
+	return clamp((v - min) / (max - min), 0.0, 1.0);
+}
+
+float ChebyshevUpperBound(vec2 moments, float distanceToLight)
+{
+	if (distanceToLight <= moments.x)
+		return 1.0;
+
+	float variance = max(moments.y - (moments.x * moments.x), 0.0001);
+	float d = distanceToLight - moments.x;
+	return variance / (variance + d * d);
+}
+
+float PointShadow(vec3 fragPos)
+{
+	vec3 v = fragPos - lightPosition;
+	float distanceToLight = length(v);
+	float layer = float(2 * lightIndex + (v.y >= 0.0 ? 0 : 1));
+	vec2 coord = v.xz / (distanceToLight + abs(v.y)) * 0.5 + 0.5;
+	
+	vec2 step = penumbraSize / vec2(textureSize(pointShadowSAT, 0).xy);
+	vec2 A = texture(pointShadowSAT, vec3(coord - step, layer)).xy;
+	vec2 B = texture(pointShadowSAT, vec3(coord.x + step.x, coord.y - step.y, layer)).xy;
+	vec2 C = texture(pointShadowSAT, vec3(coord.x - step.x, coord.y + step.y, layer)).xy;
+	vec2 D = texture(pointShadowSAT, vec3(coord + step, layer)).xy;
+	
+	vec2 moments = (D + A - B - C) / (4.0 * penumbraSize * penumbraSize) + 0.5;
+	float shadow = ChebyshevUpperBound(moments, distanceToLight / POINT_SHADOW_RANGE);
+	// same light bleeding reduction as deferredSASVSM
+	return mix(Linstep(0.25, 1.0, shadow), 1.0, shadowSaturation);
+}
+
+vec3 WorldPosition(vec2 uv, float depth)
+{
+	vec4 P = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+	return P.xyz / P.w;
+}
+
+vec3 DecodeNormal(vec2 encoded)
+{
+	vec2 e = encoded * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
 void main()
 {
 	vec2 uvCoords = gl_FragCoord.xy / screenSize;
-	vec3 FragPos = texture(gPosition, uvCoords).rgb;
-	vec3 Normal = texture(gNormal, uvCoords).rgb;
-	vec3 Diffuse = texture(gDiffuse, uvCoords).rgb;
-	vec4 Specular = texture(gSpecular, uvCoords);
+	vec3 FragPos = WorldPosition(uvCoords, texture(gDepth, uvCoords).r);
+	vec3 Normal = DecodeNormal(texture(gNormal, uvCoords).rg);
+	vec3 Diffuse = texture(gAlbedo, uvCoords).rgb;
+	float metallic = texture(gMaterial, uvCoords).g;
 	
 	// do Phong lighting calculation
 	vec3 ambient  = Diffuse * 0.2; // ambient contribution
@@ -55,12 +117,13 @@ void main()
 	vec3 diffuse = max(dot(Normal, lightDir), 0.0) * Diffuse * lightColor;
 	// specular
 	vec3 halfwayDir = normalize(lightDir + viewDir);  
-	float spec = pow(max(dot(Normal, halfwayDir), 0.0), glossiness) * Specular.a;
-	vec3 specular = lightColor * spec * Specular.rgb;
+	float spec = pow(max(dot(Normal, halfwayDir), 0.0), glossiness) * metallic;
+	vec3 specular = lightColor * spec * Diffuse;
 	// attenuation
 	float distToL = length(lightPosition - FragPos);
 	float attenuation = 1.0 - pow(smoothstep(0.0, 1.0, clamp(distToL/lightRadius, 0.0, 1.0)), 4.0);
-	vec3 result = ambient + diffuse + specular;
+	float shadow = pointShadows && lightIndex < shadowedPointLights ? PointShadow(FragPos) : 1.0;
+	vec3 result = ambient + (diffuse + specular) * shadow;
 	float noZTestFix = step(0.0, lightRadius - distToL); //0.0 if distToL > radius, 1.0 otherwise
 	vec4 outColor = vec4(result, noZTestFix) * attenuation * lightIntensity;
 	
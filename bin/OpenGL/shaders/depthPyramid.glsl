@@ -0,0 +1,45 @@
+-- Linearize
+
+// Level 0 of the SSAO depth pyramid: the positive view depth of every G-buffer pixel.
+// Background pixels end up at the far plane like in the depth buffer.
+
+layout (local_size_x = DEPTH_PYRAMID_GROUP_SIZE, local_size_y = DEPTH_PYRAMID_GROUP_SIZE) in;
+
+layout(r32f, binding = 0) uniform writeonly image2D pyramid;
+
+uniform sampler2D gDepth;
+uniform mat4 inverseProjection;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = textureSize(gDepth, 0);
+	if (any(greaterThanEqual(texel, size)))
+		return;
+
+	float depth = texelFetch(gDepth, texel, 0).r;
+	vec2 uv = (vec2(texel) + 0.5) / vec2(size);
+	vec4 P = inverseProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+	imageStore(pyramid, texel, vec4(-P.z / P.w));
+}
+
+-- Downsample
+
+// Next level of the depth pyramid: one of the four source texels, picked on a rotated grid
+// so that neighbouring texels don't all come from the same corner. Keeping a real depth
+// instead of the average stops edges from producing surfaces that aren't there.
+
+layout (local_size_x = DEPTH_PYRAMID_GROUP_SIZE, local_size_y = DEPTH_PYRAMID_GROUP_SIZE) in;
+
+layout(r32f, binding = 0) uniform readonly image2D source;
+layout(r32f, binding = 1) uniform writeonly image2D destination;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(texel, imageSize(destination))))
+		return;
+
+	ivec2 sourceTexel = min(texel * 2 + ivec2((texel.y & 1) ^ 1, (texel.x & 1) ^ 1), imageSize(source) - ivec2(1));
+	imageStore(destination, texel, imageLoad(source, sourceTexel));
+}
@@ -18,36 +18,53 @@ out vec4 FragColor;
 
 in vec2 TexCoords;
 
-uniform sampler2D gPosition;
 uniform sampler2D gNormal;
-uniform sampler2D gDiffuse;
-uniform sampler2D gSpecular;
+uniform sampler2D gAlbedo;
+uniform sampler2D gMaterial;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
 uniform int gBufferMode;
 
+vec3 WorldPosition(vec2 uv, float depth)
+{
+	vec4 P = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+	return P.xyz / P.w;
+}
+
+vec3 DecodeNormal(vec2 encoded)
+{
+	vec2 e = encoded * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
 void main()
 {             
     // retrieve data from gbuffer
-    vec3 FragPos = texture(gPosition, TexCoords).rgb;
-    vec3 Normal = texture(gNormal, TexCoords).rgb;
-    vec3 Diffuse = texture(gDiffuse, TexCoords).rgb;
-    vec3 Specular = texture(gSpecular, TexCoords).rgb;
+    float depth = texture(gDepth, TexCoords).r;
 	vec3 outColor = vec3(0.0);
 	
-	if(gBufferMode == 1) // world position
+	if(depth == 1.0) // nothing rendered
+	{
+		outColor = vec3(0.0);
+	}
+	else if(gBufferMode == 1) // world position
 	{
-		outColor = FragPos;
+		outColor = WorldPosition(TexCoords, depth);
 	}
 	else if(gBufferMode == 2) // world normal
 	{
-		outColor = Normal;
+		outColor = DecodeNormal(texture(gNormal, TexCoords).rg);
 	}
-	else if(gBufferMode == 3) // diffuse
+	else if(gBufferMode == 3) // albedo
 	{
-		outColor = Diffuse;
+		outColor = texture(gAlbedo, TexCoords).rgb;
 	}
-	else if(gBufferMode == 4) // specular
+	else if(gBufferMode == 4) // roughness, metallic
 	{
-		outColor = Specular;
+		outColor = vec3(texture(gMaterial, TexCoords).rg, 0.0);
 	}
 	FragColor = vec4(outColor, 1.0);
-}
\ No newline at end of file
+}
@@ -5,7 +5,6 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
-out vec3 FragPos;
 out vec2 TexCoords;
 out vec3 Normal;
 
@@ -13,41 +12,58 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// compact vertices: positions are unorm16 over the mesh bounds, normals octahedral snorm16 pairs
+uniform vec3 positionScale = vec3(1.0);
+uniform vec3 positionBias = vec3(0.0);
+uniform bool octahedralNormals = false;
+
+vec3 DecodeNormal(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
 void main()
 {
-    vec4 worldPos = model * vec4(aPos, 1.0);
-    FragPos = worldPos.xyz; 
+    vec4 worldPos = model * vec4(aPos * positionScale + positionBias, 1.0);
     TexCoords = aTexCoords;
     
     mat3 normalMatrix = transpose(inverse(mat3(model)));
-    Normal = normalMatrix * aNormal;
+    Normal = normalMatrix * (octahedralNormals ? DecodeNormal(aNormal.xy) : aNormal);
 
     gl_Position = projection * view * worldPos;
 }
 
 -- Fragment
 
-layout (location = 0) out vec3 gPosition;
-layout (location = 1) out vec3 gNormal;
-layout (location = 2) out vec3 gDiffuse;
-layout (location = 3) out vec4 gSpecular;
+// compact layout: the position is reconstructed from the depth buffer
+layout (location = 0) out vec2 gNormal;
+layout (location = 1) out vec4 gAlbedo;
+layout (location = 2) out vec2 gMaterial;
 
 in vec2 TexCoords;
-in vec3 FragPos;
 in vec3 Normal;
 
 uniform sampler2D texture_diffuse1;
 //uniform sampler2D texture_specular1; // should be using texture instead of uniform color
-uniform vec4 specularCol;
+uniform vec4 specularCol;	// rgb Ks, a metallic
+
+// octahedral normal encoding, mapped to [0, 1] for the RG16 target
+vec2 EncodeNormal(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return e * 0.5 + 0.5;
+}
 
 void main()
 {    
-    // store the fragment position vector in the first gbuffer texture
-    gPosition = FragPos;
-    // also store the per-fragment normals into the gbuffer
-    gNormal = normalize(Normal);
-    // and the diffuse per-fragment color
-    gDiffuse.rgb = texture(texture_diffuse1, TexCoords).rgb;
-    // specular per-fragment color
-    gSpecular = specularCol;
-}
\ No newline at end of file
+    // world normal, octahedral encoded
+    gNormal = EncodeNormal(normalize(Normal));
+    // the diffuse texture, mixed towards the specular color for metals
+    gAlbedo = vec4(mix(texture(texture_diffuse1, TexCoords).rgb, specularCol.rgb, specularCol.a), 1.0);
+    // no roughness texture, the textured surfaces are fully rough
+    gMaterial = vec2(1.0, specularCol.a);
+}
@@ -0,0 +1,73 @@
+-- Reduce
+
+// Light view bounds of everything the camera sees, used to fit the light projection to the
+// visible receivers (sample distribution shadow maps). Every invocation reconstructs one G-buffer
+// position from depth and moves it into light view space, the workgroup reduces the positions in shared memory and
+// one invocation merges the workgroup's bounds into the buffer. Atomics only work on
+// integers, so the floats are stored with an order-preserving bit encoding.
+
+layout (local_size_x = 16, local_size_y = 16) in;
+
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform mat4 lightView;
+
+layout(std430, binding = 3) buffer LightBounds
+{
+	uint boundsMin[3];
+	uint boundsMax[3];
+};
+
+shared vec3 shared_min[gl_WorkGroupSize.x * gl_WorkGroupSize.y];
+shared vec3 shared_max[gl_WorkGroupSize.x * gl_WorkGroupSize.y];
+
+// unsigned comparison of the result matches float comparison of value
+uint OrderedBits(float value)
+{
+	uint bits = floatBitsToUint(value);
+	return (bits & 0x80000000u) != 0u ? ~bits : bits | 0x80000000u;
+}
+
+void main()
+{
+	ivec2 P = ivec2(gl_GlobalInvocationID.xy);
+	uint id = gl_LocalInvocationIndex;
+
+	vec3 lo = vec3(3.0e38);
+	vec3 hi = vec3(-3.0e38);
+	ivec2 size = textureSize(gDepth, 0);
+	float depth = all(lessThan(P, size)) ? texelFetch(gDepth, P, 0).r : 1.0;
+	// pixels without geometry keep the cleared depth
+	if (depth < 1.0)
+	{
+		vec2 uv = (vec2(P) + 0.5) / vec2(size);
+		vec4 worldPos = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+		lo = (lightView * vec4(worldPos.xyz / worldPos.w, 1.0)).xyz;
+		hi = lo;
+	}
+	shared_min[id] = lo;
+	shared_max[id] = hi;
+
+	memoryBarrierShared();
+	barrier();
+
+	for (uint stride = gl_WorkGroupSize.x * gl_WorkGroupSize.y / 2u; stride > 0u; stride >>= 1)
+	{
+		if (id < stride)
+		{
+			shared_min[id] = min(shared_min[id], shared_min[id + stride]);
+			shared_max[id] = max(shared_max[id], shared_max[id + stride]);
+		}
+		memoryBarrierShared();
+		barrier();
+	}
+
+	if (id == 0u && shared_min[0].x <= shared_max[0].x)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			atomicMin(boundsMin[i], OrderedBits(shared_min[0][i]));
+			atomicMax(boundsMax[i], OrderedBits(shared_max[0][i]));
+		}
+	}
+}
@@ -23,10 +23,8 @@ uniform sampler2D aoTexture;
 
 void main()
 {             
-    // retrieve data from texture
-    //float AO = texture(aoTexture, TexCoords).r;
-	vec3 color = texture(aoTexture, TexCoords).rgb;
+    // retrieve data from texture, the AO targets are single channel
+    float AO = texture(aoTexture, TexCoords).r;
 
-	//FragColor = vec4(AO, AO, AO, 1.0);
-	FragColor = vec4(color, 1.0);
+	FragColor = vec4(AO, AO, AO, 1.0);
 }
\ No newline at end of file
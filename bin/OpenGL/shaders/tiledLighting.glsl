@@ -0,0 +1,195 @@
+-- Compute
+
+// Tiled deferred point lighting: one workgroup per LIGHT_TILE_SIZE x LIGHT_TILE_SIZE screen tile.
+// The workgroup finds the view depth range of its pixels, culls every light's sphere against
+// the tile frustum clipped to that range, and each invocation then shades its pixel with only
+// the lights that survived. The lights are read straight from the instance buffers of the light
+// volumes, so both paths always see the same lights. The result is HDR and gets added by the
+// lighting pass before tonemapping.
+
+layout (local_size_x = LIGHT_TILE_SIZE, local_size_y = LIGHT_TILE_SIZE) in;
+
+layout(rgba16f, binding = 0) uniform writeonly image2D pointLighting;
+
+layout(std430, binding = 5) readonly buffer PointLightMatrices { mat4 lightMatrices[]; };
+layout(std430, binding = 6) readonly buffer PointLightColorSizes { vec4 lightColorSizes[]; };  // rgb color, a radius
+
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedo;
+uniform sampler2D gMaterial;
+uniform sampler2D gDepth;
+uniform mat4 view;
+uniform mat4 inverseProjection;
+uniform mat4 inverseViewProjection;
+uniform vec3 viewPos;
+uniform int lightCount;
+uniform float lightIntensity;
+uniform float glossiness;
+
+// dual-paraboloid SATs of the first shadowedPointLights lights, see deferredPointLightInstanced
+uniform bool pointShadows = false;
+uniform int shadowedPointLights = 0;
+uniform sampler2DArray pointShadowSAT;
+uniform float penumbraSize = 1.0;
+uniform float shadowSaturation = 0.5;
+
+shared uint tileMinDepth;
+shared uint tileMaxDepth;
+shared vec3 tilePlanes[4];
+shared uint tileLightCount;
+shared uint tileLights[MAX_LIGHTS_PER_TILE];
+
+vec3 DecodeNormal(vec2 encoded)
+{
+	vec2 e = encoded * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+// view space direction through a point of the far plane given in normalized device coordinates
+vec3 FarPoint(vec2 ndc)
+{
+	vec4 P = inverseProjection * vec4(ndc, 1.0, 1.0);
+	return P.xyz / P.w;
+}
+
+float Linstep(float min, float max, float v)
+{
+	return clamp((v - min) / (max - min), 0.0, 1.0);
+}
+
+float ChebyshevUpperBound(vec2 moments, float distanceToLight)
+{
+	if (distanceToLight <= moments.x)
+		return 1.0;
+
+	float variance = max(moments.y - (moments.x * moments.x), 0.0001);
+	float d = distanceToLight - moments.x;
+	return variance / (variance + d * d);
+}
+
+float PointShadow(int lightIndex, vec3 lightPosition, vec3 fragPos)
+{
+	vec3 v = fragPos - lightPosition;
+	float distanceToLight = length(v);
+	float layer = float(2 * lightIndex + (v.y >= 0.0 ? 0 : 1));
+	vec2 coord = v.xz / (distanceToLight + abs(v.y)) * 0.5 + 0.5;
+
+	vec2 step = penumbraSize / vec2(textureSize(pointShadowSAT, 0).xy);
+	vec2 A = textureLod(pointShadowSAT, vec3(coord - step, layer), 0.0).xy;
+	vec2 B = textureLod(pointShadowSAT, vec3(coord.x + step.x, coord.y - step.y, layer), 0.0).xy;
+	vec2 C = textureLod(pointShadowSAT, vec3(coord.x - step.x, coord.y + step.y, layer), 0.0).xy;
+	vec2 D = textureLod(pointShadowSAT, vec3(coord + step, layer), 0.0).xy;
+
+	vec2 moments = (D + A - B - C) / (4.0 * penumbraSize * penumbraSize) + 0.5;
+	float shadow = ChebyshevUpperBound(moments, distanceToLight / POINT_SHADOW_RANGE);
+	return mix(Linstep(0.25, 1.0, shadow), 1.0, shadowSaturation);
+}
+
+void main()
+{
+	ivec2 size = textureSize(gDepth, 0);
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	bool inside = all(lessThan(pixel, size));
+	uint id = gl_LocalInvocationIndex;
+
+	if (id == 0u)
+	{
+		tileMinDepth = 0x7F7FFFFFu;
+		tileMaxDepth = 0u;
+		tileLightCount = 0u;
+	}
+	barrier();
+
+	// view depth range of the tile; positive floats keep their order as uints
+	float depth = inside ? texelFetch(gDepth, pixel, 0).r : 1.0;
+	vec2 uv = (vec2(pixel) + 0.5) / vec2(size);
+	vec4 viewPosition = inverseProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+	float viewDepth = -viewPosition.z / viewPosition.w;
+	if (depth < 1.0)
+	{
+		atomicMin(tileMinDepth, floatBitsToUint(viewDepth));
+		atomicMax(tileMaxDepth, floatBitsToUint(viewDepth));
+	}
+
+	// side planes of the tile frustum, through the eye so only the normals are kept
+	if (id == 0u)
+	{
+		vec2 tileMin = vec2(gl_WorkGroupID.xy * gl_WorkGroupSize.xy) / vec2(size) * 2.0 - 1.0;
+		vec2 tileMax = vec2((gl_WorkGroupID.xy + 1u) * gl_WorkGroupSize.xy) / vec2(size) * 2.0 - 1.0;
+		vec3 corners[4] = vec3[4](FarPoint(tileMin), FarPoint(vec2(tileMax.x, tileMin.y)), FarPoint(tileMax), FarPoint(vec2(tileMin.x, tileMax.y)));
+		vec3 center = FarPoint((tileMin + tileMax) * 0.5);
+		for (int i = 0; i < 4; i++)
+		{
+			vec3 n = normalize(cross(corners[i], corners[(i + 1) % 4]));
+			tilePlanes[i] = dot(n, center) < 0.0 ? -n : n;
+		}
+	}
+	memoryBarrierShared();
+	barrier();
+
+	// cull the lights, every invocation tests every 256th of them
+	if (tileMaxDepth > 0u)
+	{
+		float nearDepth = uintBitsToFloat(tileMinDepth);
+		float farDepth = uintBitsToFloat(tileMaxDepth);
+		for (int i = int(id); i < lightCount; i += int(gl_WorkGroupSize.x * gl_WorkGroupSize.y))
+		{
+			float radius = lightColorSizes[i].a;
+			vec3 center = (view * vec4(lightMatrices[i][3].xyz, 1.0)).xyz;
+			bool visible = -center.z + radius >= nearDepth && -center.z - radius <= farDepth;
+			for (int p = 0; p < 4 && visible; p++)
+				visible = dot(tilePlanes[p], center) >= -radius;
+			if (visible)
+			{
+				uint slot = atomicAdd(tileLightCount, 1u);
+				// a full tile drops the rest of its lights
+				if (slot < uint(MAX_LIGHTS_PER_TILE))
+					tileLights[slot] = uint(i);
+			}
+		}
+	}
+	memoryBarrierShared();
+	barrier();
+
+	if (!inside)
+		return;
+
+	vec3 color = vec3(0.0);
+	if (depth < 1.0)
+	{
+		vec4 world = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+		vec3 FragPos = world.xyz / world.w;
+		vec3 Normal = DecodeNormal(texelFetch(gNormal, pixel, 0).rg);
+		vec3 Diffuse = texelFetch(gAlbedo, pixel, 0).rgb;
+		float metallic = texelFetch(gMaterial, pixel, 0).g;
+		vec3 viewDir = normalize(viewPos - FragPos);
+
+		// same Phong model as the light volumes of deferredPointLightInstanced
+		uint count = min(tileLightCount, uint(MAX_LIGHTS_PER_TILE));
+		for (uint t = 0u; t < count; t++)
+		{
+			int i = int(tileLights[t]);
+			vec3 lightPosition = lightMatrices[i][3].xyz;
+			vec3 lightColor = lightColorSizes[i].rgb;
+			float lightRadius = lightColorSizes[i].a;
+			float distToL = length(lightPosition - FragPos);
+			if (distToL >= lightRadius)
+				continue;
+
+			vec3 ambient = Diffuse * 0.2;
+			vec3 lightDir = (lightPosition - FragPos) / distToL;
+			vec3 diffuse = max(dot(Normal, lightDir), 0.0) * Diffuse * lightColor;
+			vec3 halfwayDir = normalize(lightDir + viewDir);
+			float spec = pow(max(dot(Normal, halfwayDir), 0.0), glossiness) * metallic;
+			vec3 specular = lightColor * spec * Diffuse;
+			float attenuation = 1.0 - pow(smoothstep(0.0, 1.0, distToL / lightRadius), 4.0);
+			float shadow = pointShadows && i < shadowedPointLights ? PointShadow(i, lightPosition, FragPos) : 1.0;
+			color += (ambient + (diffuse + specular) * shadow) * attenuation;
+		}
+		color *= lightIntensity;
+	}
+	imageStore(pointLighting, pixel, vec4(color, 1.0));
+}
@@ -3,8 +3,10 @@
 precision highp float;
 precision highp int;
 
-layout(rgba32f, binding = 0, location = 0) uniform image2D input_image;
-layout(rgba32f, binding = 1, location = 1) uniform image2D output_image;
+layout(rg32f, binding = 0, location = 0) uniform image2D input_image;
+layout(rg32f, binding = 1, location = 1) uniform image2D output_image;
+// per-row block totals/offsets used by the multi-block scan
+layout(rg32f, binding = 2, location = 2) uniform image2D block_sums;
 
 
 -- ComputeSAT
@@ -12,7 +14,7 @@ layout(rgba32f, binding = 1, location = 1) uniform image2D output_image;
 
 layout (local_size_x = 1024) in;
 
-shared vec4 shared_data[gl_WorkGroupSize.x * 2];
+shared vec2 shared_data[gl_WorkGroupSize.x * 2];
 
 void main() 
 {
@@ -26,11 +28,11 @@ void main()
 	const uint steps = uint(log2(gl_WorkGroupSize.x)) + 1;
 	uint step = 0;
 
-	vec4 i0 = imageLoad(input_image, P0);
-	vec4 i1 = imageLoad(input_image, P1);
+	vec2 i0 = imageLoad(input_image, P0).xy;
+	vec2 i1 = imageLoad(input_image, P1).xy;
 
-	shared_data[P0.x] = i0.rgba;
-	shared_data[P1.x] = i1.rgba;
+	shared_data[P0.x] = i0;
+	shared_data[P1.x] = i1;
 
 	barrier();
 
@@ -46,6 +48,326 @@ void main()
 		memoryBarrierShared();
 	}
 
-	imageStore(output_image, P0.yx, shared_data[P0.x]);
-	imageStore(output_image, P1.yx, shared_data[P1.x]);
+	imageStore(output_image, P0.yx, vec4(shared_data[P0.x], 0.0, 0.0));
+	imageStore(output_image, P1.yx, vec4(shared_data[P1.x], 0.0, 0.0));
+}
+
+
+-- DepthMomentsScan
+
+// Fused light pass moments and first ComputeSAT pass: reads one row of the depth-only shadow
+// map, turns it into the centered moments varianceShadowMap.Fragment would have written and
+// scans them like ComputeSAT, so the RG32F moments never go through memory. dFdx/dFdy of the
+// moment bias are replaced by differences to the neighbouring texels; the smaller one-sided
+// difference is used so a silhouette doesn't count as a slope.
+
+uniform sampler2D depth_map;
+
+layout (local_size_x = 1024) in;
+
+shared vec2 shared_data[gl_WorkGroupSize.x * 2];
+shared float depth_row[gl_WorkGroupSize.x * 2];
+
+float SmallerDifference(float before, float center, float after)
+{
+	float backward = center - before;
+	float forward = after - center;
+	return abs(backward) < abs(forward) ? backward : forward;
+}
+
+vec2 DepthMoments(int x, int y, ivec2 size)
+{
+	if (x >= size.x)
+		return vec2(0.0);
+
+	float depth = depth_row[x];
+	float left = depth_row[max(x - 1, 0)];
+	float right = depth_row[min(x + 1, size.x - 1)];
+	float above = texelFetch(depth_map, ivec2(x, max(y - 1, 0)), 0).x;
+	float below = texelFetch(depth_map, ivec2(x, min(y + 1, size.y - 1)), 0).x;
+	float dx = SmallerDifference(left, depth, right);
+	float dy = SmallerDifference(above, depth, below);
+
+	vec2 moment = vec2(depth, depth * depth);
+	moment.x -= 0.5;
+	moment.y += 0.25 * (dx * dx + dy * dy);
+	moment.y -= 0.5;
+	return moment;
+}
+
+void main()
+{
+	uint id = gl_LocalInvocationID.x;
+	uint rd_id;
+	uint wr_id;
+	uint mask;
+	ivec2 size = textureSize(depth_map, 0);
+	ivec2 P0 = ivec2(id * 2, gl_WorkGroupID.x);
+	ivec2 P1 = ivec2(id * 2 + 1, gl_WorkGroupID.x);
+
+	const uint steps = uint(log2(gl_WorkGroupSize.x)) + 1;
+	uint step = 0;
+
+	depth_row[P0.x] = P0.x < size.x ? texelFetch(depth_map, P0, 0).x : 1.0;
+	depth_row[P1.x] = P1.x < size.x ? texelFetch(depth_map, P1, 0).x : 1.0;
+
+	memoryBarrierShared();
+	barrier();
+
+	shared_data[P0.x] = DepthMoments(P0.x, P0.y, size);
+	shared_data[P1.x] = DepthMoments(P1.x, P1.y, size);
+
+	barrier();
+
+	for (step = 0; step < steps; step++)
+	{
+		mask = (1 << step) - 1;
+		rd_id = ((id >> step) << (step + 1)) + mask;
+		wr_id = rd_id + 1 + (id & mask);
+
+		shared_data[wr_id] += shared_data[rd_id];
+
+		barrier();
+		memoryBarrierShared();
+	}
+
+	imageStore(output_image, P0.yx, vec4(shared_data[P0.x], 0.0, 0.0));
+	imageStore(output_image, P1.yx, vec4(shared_data[P1.x], 0.0, 0.0));
+}
+
+
+-- ScanBlocks
+
+// First step of the multi-block scan used for rows longer than one workgroup can hold.
+// Each workgroup scans one block of SAT_BLOCK_SIZE texels of a row, stores the
+// block-local prefix sums (transposed, like ComputeSAT) and writes the block's total
+// into block_sums so ScanBlockSums can turn the totals into per-block offsets.
+
+layout (local_size_x = 1024) in;
+
+shared vec2 shared_data[gl_WorkGroupSize.x * 2];
+
+void main() 
+{
+	uint id = gl_LocalInvocationID.x;
+	uint rd_id;
+	uint wr_id;
+	uint mask;
+	int blockStart = int(gl_WorkGroupID.x * gl_WorkGroupSize.x * 2);
+	ivec2 P0 = ivec2(blockStart + id * 2, gl_WorkGroupID.y);
+	ivec2 P1 = ivec2(blockStart + id * 2 + 1, gl_WorkGroupID.y);
+
+	const uint steps = uint(log2(gl_WorkGroupSize.x)) + 1;
+	uint step = 0;
+
+	vec2 i0 = imageLoad(input_image, P0).xy;
+	vec2 i1 = imageLoad(input_image, P1).xy;
+
+	shared_data[id * 2] = i0;
+	shared_data[id * 2 + 1] = i1;
+
+	barrier();
+
+	for (step = 0; step < steps; step++)
+	{
+		mask = (1 << step) - 1;
+		rd_id = ((id >> step) << (step + 1)) + mask;
+		wr_id = rd_id + 1 + (id & mask);
+
+		shared_data[wr_id] += shared_data[rd_id];
+
+		barrier();
+		memoryBarrierShared();
+	}
+
+	imageStore(output_image, P0.yx, vec4(shared_data[id * 2], 0.0, 0.0));
+	imageStore(output_image, P1.yx, vec4(shared_data[id * 2 + 1], 0.0, 0.0));
+	
+	if (id == 0)
+		imageStore(block_sums, ivec2(gl_WorkGroupID.xy), vec4(shared_data[gl_WorkGroupSize.x * 2 - 1], 0.0, 0.0));
+}
+
+-- ScanBlockSums
+
+// Second step: one invocation per row turns the block totals into exclusive prefix
+// sums, i.e. the offset every block has to add to its local prefix sums.
+
+layout (local_size_x = 64) in;
+
+uniform int blockCount;
+uniform int rowCount;
+
+void main() 
+{
+	int row = int(gl_GlobalInvocationID.x);
+	if (row >= rowCount)
+		return;
+	
+	vec2 sum = vec2(0.0);
+	for (int block = 0; block < blockCount; block++)
+	{
+		vec2 total = imageLoad(block_sums, ivec2(block, row)).xy;
+		imageStore(block_sums, ivec2(block, row), vec4(sum, 0.0, 0.0));
+		sum += total;
+	}
+}
+
+-- AddBlockSums
+
+// Last step: add the block offsets to the transposed local prefix sums in place.
+// Block 0 has no offset, so the dispatch starts at block 1.
+
+layout (local_size_x = 1024) in;
+
+void main() 
+{
+	uint id = gl_LocalInvocationID.x;
+	uint block = gl_WorkGroupID.x + 1;
+	int row = int(gl_WorkGroupID.y);
+	ivec2 P0 = ivec2(block * gl_WorkGroupSize.x * 2 + id * 2, row);
+	ivec2 P1 = ivec2(P0.x + 1, row);
+	ivec2 size = imageSize(output_image);
+	
+	vec4 offset = vec4(imageLoad(block_sums, ivec2(block, row)).xy, 0.0, 0.0);
+	
+	if (P0.x < size.y)
+		imageStore(output_image, P0.yx, imageLoad(output_image, P0.yx) + offset);
+	if (P1.x < size.y)
+		imageStore(output_image, P1.yx, imageLoad(output_image, P1.yx) + offset);
+}
+
+-- ScanTransposed
+
+// Bandwidth-friendly replacement for ComputeSAT. ComputeSAT stores its result at P.yx, so
+// the invocations of a workgroup write to different rows and every store lands in its own
+// cache line. Here each workgroup owns a band of SAT_TRANSPOSE_TILE rows and walks along it
+// one SAT_TRANSPOSE_TILE^2 tile at a time: the tile is loaded row by row, scanned and
+// transposed in shared memory and stored row by row, so neighbouring invocations always
+// touch neighbouring texels. The running sum of every row is carried from tile to tile,
+// which makes one dispatch per direction enough for any row length.
+
+layout (local_size_x = SAT_TRANSPOSE_TILE, local_size_y = 8) in;
+
+// texels each invocation scans serially within a tile row
+const int SCAN_RUN = SAT_TRANSPOSE_TILE / 8;
+
+// one column of padding keeps the transposed reads free of bank conflicts
+shared vec2 tile_data[SAT_TRANSPOSE_TILE][SAT_TRANSPOSE_TILE + 1];
+shared vec2 run_sums[SAT_TRANSPOSE_TILE][8];
+shared vec2 row_carry[SAT_TRANSPOSE_TILE];
+
+void main()
+{
+	int x = int(gl_LocalInvocationID.x);
+	int y = int(gl_LocalInvocationID.y);
+	int id = y * SAT_TRANSPOSE_TILE + x;
+	int band = int(gl_WorkGroupID.x) * SAT_TRANSPOSE_TILE;
+	int rowLength = imageSize(input_image).x;
+
+	// during the scan, 8 consecutive invocations share one tile row
+	int scanRow = id / 8;
+	int run = id % 8;
+
+	if (id < SAT_TRANSPOSE_TILE)
+		row_carry[id] = vec2(0.0);
+
+	for (int tileStart = 0; tileStart < rowLength; tileStart += SAT_TRANSPOSE_TILE)
+	{
+		// coalesced load, texels outside the image read as zero
+		for (int r = y; r < SAT_TRANSPOSE_TILE; r += 8)
+			tile_data[r][x] = imageLoad(input_image, ivec2(tileStart + x, band + r)).xy;
+
+		memoryBarrierShared();
+		barrier();
+
+		vec2 sum = vec2(0.0);
+		for (int c = run * SCAN_RUN; c < run * SCAN_RUN + SCAN_RUN; c++)
+		{
+			sum += tile_data[scanRow][c];
+			tile_data[scanRow][c] = sum;
+		}
+		run_sums[scanRow][run] = sum;
+
+		memoryBarrierShared();
+		barrier();
+
+		// turn the run totals into offsets and carry the row total on to the next tile
+		if (run == 0)
+		{
+			vec2 carry = row_carry[scanRow];
+			for (int i = 0; i < 8; i++)
+			{
+				vec2 total = run_sums[scanRow][i];
+				run_sums[scanRow][i] = carry;
+				carry += total;
+			}
+			row_carry[scanRow] = carry;
+		}
+
+		memoryBarrierShared();
+		barrier();
+
+		vec2 offset = run_sums[scanRow][run];
+		for (int c = run * SCAN_RUN; c < run * SCAN_RUN + SCAN_RUN; c++)
+			tile_data[scanRow][c] += offset;
+
+		memoryBarrierShared();
+		barrier();
+
+		// coalesced transposed store: invocation x writes row band + x of the source, which is
+		// column band + x of the output
+		for (int c = y; c < SAT_TRANSPOSE_TILE; c += 8)
+			imageStore(output_image, ivec2(band + x, tileStart + c), vec4(tile_data[x][c], 0.0, 0.0));
+
+		// the next tile overwrites tile_data
+		barrier();
+	}
+}
+
+
+-- ScanArray
+
+// ComputeSAT over all layers of the shadow atlas in one dispatch: workgroup (row, 0, layer) scans
+// one row of one layer and stores it transposed into the same layer of the output. Two dispatches
+// build the SATs of every shadowed light, whatever their number.
+
+layout(rg32f, binding = 3) uniform image2DArray input_layers;
+layout(rg32f, binding = 4) uniform image2DArray output_layers;
+
+layout (local_size_x = SHADOW_ATLAS_SIZE / 2) in;
+
+shared vec2 shared_data[gl_WorkGroupSize.x * 2];
+
+void main()
+{
+	uint id = gl_LocalInvocationID.x;
+	int layer = int(gl_WorkGroupID.z);
+	uint rd_id;
+	uint wr_id;
+	uint mask;
+	ivec2 P0 = ivec2(id * 2, gl_WorkGroupID.x);
+	ivec2 P1 = ivec2(id * 2 + 1, gl_WorkGroupID.x);
+
+	const uint steps = uint(log2(gl_WorkGroupSize.x)) + 1;
+	uint step = 0;
+
+	shared_data[P0.x] = imageLoad(input_layers, ivec3(P0, layer)).xy;
+	shared_data[P1.x] = imageLoad(input_layers, ivec3(P1, layer)).xy;
+
+	barrier();
+
+	for (step = 0; step < steps; step++)
+	{
+		mask = (1 << step) - 1;
+		rd_id = ((id >> step) << (step + 1)) + mask;
+		wr_id = rd_id + 1 + (id & mask);
+
+		shared_data[wr_id] += shared_data[rd_id];
+
+		barrier();
+		memoryBarrierShared();
+	}
+
+	imageStore(output_layers, ivec3(P0.yx, layer), vec4(shared_data[P0.x], 0.0, 0.0));
+	imageStore(output_layers, ivec3(P1.yx, layer), vec4(shared_data[P1.x], 0.0, 0.0));
 }
@@ -0,0 +1,129 @@
+-- _global
+
+precision highp float;
+precision highp int;
+
+// Fixed-point SAT: moments are quantized to unsigned integers and summed with wraparound.
+// Integer addition is exact and associative, so the table has no precision loss at any
+// size and the scan order doesn't matter. Box sums are recovered in VSM() with unsigned
+// differences, which stay exact as long as the box sum itself fits into 32 bits.
+layout(rg32ui, binding = 1, location = 1) uniform uimage2D output_image;
+// per-row block totals/offsets used by the multi-block scan
+layout(rg32ui, binding = 2, location = 2) uniform uimage2D block_sums;
+
+
+-- Quantize
+
+// Converts the centered float moments written by varianceShadowMap.glsl back to [0, 1]
+// and stores them as fixed point with fixedPointScale steps per unit.
+
+layout(rg32f, binding = 0, location = 0) uniform image2D moments_image;
+
+uniform float fixedPointScale;
+
+layout (local_size_x = 16, local_size_y = 16) in;
+
+void main()
+{
+	ivec2 P = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(P, imageSize(output_image))))
+		return;
+
+	vec2 moments = clamp(imageLoad(moments_image, P).xy + 0.5, 0.0, 1.0);
+	imageStore(output_image, P, uvec4(uvec2(round(moments * fixedPointScale)), 0u, 0u));
+}
+
+-- ScanBlocks
+
+// Same as computeSAT.ScanBlocks on integer moments: each workgroup scans one block of
+// SAT_BLOCK_SIZE texels, stores it transposed and writes the block total into block_sums.
+
+layout(rg32ui, binding = 0, location = 0) uniform uimage2D input_image;
+
+layout (local_size_x = 1024) in;
+
+shared uvec2 shared_data[gl_WorkGroupSize.x * 2];
+
+void main()
+{
+	uint id = gl_LocalInvocationID.x;
+	uint rd_id;
+	uint wr_id;
+	uint mask;
+	int blockStart = int(gl_WorkGroupID.x * gl_WorkGroupSize.x * 2);
+	ivec2 P0 = ivec2(blockStart + id * 2, gl_WorkGroupID.y);
+	ivec2 P1 = ivec2(blockStart + id * 2 + 1, gl_WorkGroupID.y);
+
+	const uint steps = uint(log2(gl_WorkGroupSize.x)) + 1;
+	uint step = 0;
+
+	shared_data[id * 2] = imageLoad(input_image, P0).xy;
+	shared_data[id * 2 + 1] = imageLoad(input_image, P1).xy;
+
+	barrier();
+
+	for (step = 0; step < steps; step++)
+	{
+		mask = (1 << step) - 1;
+		rd_id = ((id >> step) << (step + 1)) + mask;
+		wr_id = rd_id + 1 + (id & mask);
+
+		shared_data[wr_id] += shared_data[rd_id];
+
+		barrier();
+		memoryBarrierShared();
+	}
+
+	imageStore(output_image, P0.yx, uvec4(shared_data[id * 2], 0u, 0u));
+	imageStore(output_image, P1.yx, uvec4(shared_data[id * 2 + 1], 0u, 0u));
+
+	if (id == 0)
+		imageStore(block_sums, ivec2(gl_WorkGroupID.xy), uvec4(shared_data[gl_WorkGroupSize.x * 2 - 1], 0u, 0u));
+}
+
+-- ScanBlockSums
+
+// One invocation per row turns the block totals into exclusive prefix sums.
+
+layout (local_size_x = 64) in;
+
+uniform int blockCount;
+uniform int rowCount;
+
+void main()
+{
+	int row = int(gl_GlobalInvocationID.x);
+	if (row >= rowCount)
+		return;
+
+	uvec2 sum = uvec2(0u);
+	for (int block = 0; block < blockCount; block++)
+	{
+		uvec2 total = imageLoad(block_sums, ivec2(block, row)).xy;
+		imageStore(block_sums, ivec2(block, row), uvec4(sum, 0u, 0u));
+		sum += total;
+	}
+}
+
+-- AddBlockSums
+
+// Adds the block offsets to the transposed local prefix sums in place, starting at block 1.
+
+layout (local_size_x = 1024) in;
+
+void main()
+{
+	uint id = gl_LocalInvocationID.x;
+	uint block = gl_WorkGroupID.x + 1;
+	int row = int(gl_WorkGroupID.y);
+	ivec2 P0 = ivec2(block * gl_WorkGroupSize.x * 2 + id * 2, row);
+	ivec2 P1 = ivec2(P0.x + 1, row);
+	ivec2 size = imageSize(output_image);
+
+	uvec2 offset = imageLoad(block_sums, ivec2(block, row)).xy;
+
+	if (P0.x < size.y)
+		imageStore(output_image, P0.yx, uvec4(imageLoad(output_image, P0.yx).xy + offset, 0u, 0u));
+	if (P1.x < size.y)
+		imageStore(output_image, P1.yx, uvec4(imageLoad(output_image, P1.yx).xy + offset, 0u, 0u));
+}
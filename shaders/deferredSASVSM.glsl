@@ -18,14 +18,36 @@ out vec4 FragColor;
 
 in vec2 TexCoords;
 
-uniform sampler2D gPosition;
+// compact G-buffer: octahedral normal, albedo, roughness/metallic and the depth buffer,
+// world positions are reconstructed from depth with inverseViewProjection
 uniform sampler2D gNormal;
-uniform sampler2D gDiffuse;
-uniform sampler2D gSpecular;
+uniform sampler2D gAlbedo;
+uniform sampler2D gMaterial;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
 uniform sampler2D shadowSAT;
+uniform usampler2D shadowSATFixed;
+uniform sampler2D shadowSATTiled;
 uniform sampler2D ambientOcclusion;
+// HDR result of the tiled point lighting pass (tiledLighting.Compute)
+uniform bool tiledPointLights = false;
+uniform sampler2D pointLighting;
 uniform sampler2D shadowMap;
+// shadowMap holds raw depth (fused moments path) instead of centered moments
+uniform bool shadowMapIsDepth = false;
 uniform mat4 lightSpaceMatrix;
+// Cascaded shadows: cascade 0 is shadowSAT/shadowMap, the others have their own SAT and moments.
+// cascadeSplits is the view depth where each cascade ends, cascadeFilterScale converts filter
+// widths given in texels of the single +-10 light box into texels of the cascade.
+uniform int cascadeCount = 1;
+uniform mat4 cascadeMatrices[MAX_SHADOW_CASCADES];
+uniform float cascadeSplits[MAX_SHADOW_CASCADES];
+uniform float cascadeFilterScale[MAX_SHADOW_CASCADES];
+uniform float cascadeBlend = 0.1;
+uniform vec3 viewDirection;
+// cascade i > 0 is layer i - 1, one sampler per array keeps the pass within 16 texture units
+uniform sampler2DArray cascadeSATs;
+uniform sampler2DArray cascadeMaps;
 uniform float shadowSaturation;
 uniform float shadowIntensity = 0.2;
 uniform int lightSourceRadius = 16;
@@ -35,10 +57,38 @@ uniform float zFar;
 uniform float PenumbraSize = 0.001;
 uniform float momentBias = 0.00003;
 uniform bool softSATVSM = false;
+uniform int satFormat = 0;
+uniform float fixedPointScale = 65536.0;
+
+// SAT formats, must match SATFormat in SASVSM.cpp
+const int SAT_FORMAT_FLOAT = 0;
+const int SAT_FORMAT_FIXED_POINT = 1;
+const int SAT_FORMAT_TILED = 2;
+
+// double-precision tile offsets of the tiled SAT, see computeSATTiled.glsl
+layout(std430, binding = 0) readonly buffer SATColumnStrips { dvec2 columnStrips[]; };
+layout(std430, binding = 1) readonly buffer SATRowStrips { dvec2 rowStrips[]; };
+layout(std430, binding = 2) readonly buffer SATTileGrid { dvec2 tileGrid[]; };
+
+// additional shadowed lights, each with its own layer of the shadow atlas SATs
+struct ShadowedLight
+{
+	mat4 lightSpaceMatrix;
+	vec4 position;		// w = 0 directional light, 1 spot light
+	vec4 direction;		// direction the light shines in, w = cosine of the spot cone's half angle
+	vec4 color;			// color * intensity, w = atlas layer
+};
+
+layout(std430, binding = 4) readonly buffer ShadowedLights { ShadowedLight shadowedLights[]; };
+
+uniform int shadowedLightCount = 0;
+uniform sampler2DArray shadowAtlasSAT;
 
 // IBL
-uniform samplerCube environmentMap;
-uniform samplerCube irradianceMap;
+// specular environment prefiltered for roughness 0 - 1 over its mip levels, see prefilterGen
+uniform samplerCube prefilterMap;
+// 9 SH coefficients of irradiance / PI with the basis constants folded in, see sh_irradiance.h
+uniform vec3 irradianceSH[9];
 uniform sampler2D brdfLUT;
 
 struct Light {
@@ -50,7 +100,6 @@ struct Light {
 
 uniform Light gLight;
 uniform vec3 viewPos;
-uniform int iblSamples;
 
 const float PI = 3.14159265359;
 
@@ -104,48 +153,6 @@ vec3 FresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
     return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(1.0 - cosTheta, 5.0);
 }   
 
-// ----------------------------------------------------------------------------
-// http://holger.dammertz.org/stuff/notes_HammersleyOnHemisphere.html
-// efficient VanDerCorpus calculation.
-float RadicalInverse_VdC(uint bits) 
-{
-     bits = (bits << 16u) | (bits >> 16u);
-     bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
-     bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
-     bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
-     bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
-     return float(bits) * 2.3283064365386963e-10; // / 0x100000000
-}
-// ----------------------------------------------------------------------------
-vec2 Hammersley(uint i, uint N)
-{
-	return vec2(float(i)/float(N), RadicalInverse_VdC(i));
-}
-
-// ----------------------------------------------------------------------------
-vec3 ImportanceSampleGGX(vec2 Xi, vec3 N, float roughness)
-{
-	float a = roughness*roughness;
-	
-	float phi = 2.0 * PI * Xi.x;
-	float cosTheta = sqrt((1.0 - Xi.y) / (1.0 + (a*a - 1.0) * Xi.y));
-	float sinTheta = sqrt(1.0 - cosTheta*cosTheta);
-	
-	// from spherical coordinates to cartesian coordinates - halfway vector
-	vec3 H;
-	H.x = cos(phi) * sinTheta;
-	H.y = sin(phi) * sinTheta;
-	H.z = cosTheta;
-	
-	// from tangent-space H vector to world-space sample vector
-	vec3 up          = abs(N.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
-	vec3 tangent   = normalize(cross(up, N));
-	vec3 bitangent = cross(N, tangent);
-	
-	vec3 sampleVec = tangent * H.x + bitangent * H.y + N * H.z;
-	return normalize(sampleVec);
-}
-
 // ----------------------------------------------------------------------------
 float CalculateShadow(vec3 fragPos, vec3 normal)
 {
@@ -234,11 +241,26 @@ vec2 VogelDiskSample(int sampleIndex, int samplesCount, float phi)
 	
 }
 
-float ComputeAverageBlockerDepthBasedOnPCF(vec4 normalizedShadowCoord) 
+// cascade 0 is the single shadow map, the others are read from the cascade arrays
+vec2 SampleCascadeSAT(int cascade, vec2 uv)
+{
+	if(cascade == 0)
+		return texture(shadowSAT, uv).xy;
+	return texture(cascadeSATs, vec3(uv, float(cascade - 1))).xy;
+}
+
+float SampleCascadeMap(int cascade, vec2 uv)
+{
+	if(cascade == 0)
+		return texture(shadowMap, uv).x;
+	return texture(cascadeMaps, vec3(uv, float(cascade - 1))).x;
+}
+
+float ComputeAverageBlockerDepthBasedOnPCF(int cascade, float filterScale, vec4 normalizedShadowCoord) 
 {
 	float averageDepth = 0.0;
 	int numberOfBlockers = 0;
-	float blockerSearchWidth = float(lightSourceRadius)/float(textureSize(shadowSAT,0).x);
+	float blockerSearchWidth = float(lightSourceRadius) * filterScale/float(textureSize(shadowMap,0).x);
 	float stepSize = 2.0 * blockerSearchWidth/float(blockerSearchSize);
 	
 	float gradientNoise = 2.0 * PI * InterleavedGradientNoise(gl_FragCoord.xy);
@@ -246,7 +268,9 @@ float ComputeAverageBlockerDepthBasedOnPCF(vec4 normalizedShadowCoord)
 	for(int i = 0; i < 16; i++)
 	{
 		vec2 sampleUV = VogelDiskSample(i, 16, gradientNoise);
-		float distanceFromLight = texture(shadowMap, vec2(normalizedShadowCoord.xy + sampleUV * stepSize)).x + 0.5;
+		float distanceFromLight = SampleCascadeMap(cascade, vec2(normalizedShadowCoord.xy + sampleUV * stepSize));
+		if (!shadowMapIsDepth)
+			distanceFromLight += 0.5;
 		if(normalizedShadowCoord.z - 0.01 > distanceFromLight) 
 		{
 			averageDepth += distanceFromLight;
@@ -271,11 +295,88 @@ float ComputePenumbraWidth(float averageDepth, float distanceToLight)
 	return penumbraWidth * distanceToLight;	
 }
 
-float VSM(float penumbraWidth, vec4 normalizedShadowCoord)
+// Integer box for the SAT formats that are read with texelFetch: the box is width x width texels
+// around coord, clamped to the map, and covers texels (lo, hi]. Returns the number of texels in it.
+int BoxCorners(float penumbraWidth, vec2 coord, ivec2 size, float maxWidth, out ivec2 lo, out ivec2 hi)
+{
+	int width = int(clamp(round(2.0 * penumbraWidth), 1.0, maxWidth));
+	
+	lo = ivec2(floor(coord * vec2(size) - 0.5 * float(width) + 0.5)) - 1;
+	hi = lo + width;
+	lo = clamp(lo, ivec2(-1), size - 1);
+	hi = clamp(hi, ivec2(-1), size - 1);
+	return (hi.x - lo.x) * (hi.y - lo.y);
+}
+
+// SAT corner for the fixed-point table, everything left of or above the map sums to zero
+uvec2 FetchFixedSAT(ivec2 P)
+{
+	if(P.x < 0 || P.y < 0)
+		return uvec2(0u);
+	return texelFetch(shadowSATFixed, P, 0).xy;
+}
+
+// Box filter over the fixed-point SAT (see computeSATFixed.glsl). The corner differences are
+// taken in uint arithmetic, so they are exact even after the running sums wrapped around.
+float VSMFixed(float penumbraWidth, vec4 normalizedShadowCoord)
+{
+	// widest box whose sum of [0, 1] moments still fits into 32 bits
+	float maxWidth = floor(sqrt(4294967296.0 / fixedPointScale - 1.0));
+	ivec2 lo, hi;
+	int area = BoxCorners(penumbraWidth, normalizedShadowCoord.xy, textureSize(shadowSATFixed, 0), maxWidth, lo, hi);
+	if(area <= 0)
+		return 1.0;
+	
+	uvec2 A = FetchFixedSAT(lo);
+	uvec2 B = FetchFixedSAT(ivec2(hi.x, lo.y));
+	uvec2 C = FetchFixedSAT(ivec2(lo.x, hi.y));
+	uvec2 D = FetchFixedSAT(hi);
+	
+	vec2 moments = vec2(D - B - C + A) / (float(area) * fixedPointScale);
+	return clamp(mix(ChebyshevUpperBound(moments, normalizedShadowCoord.z), 1.0, shadowSaturation), 0.0, 1.0);
+}
+
+// global SAT value at P assembled from the tile-local SAT and the tile offsets
+dvec2 FetchTiledSAT(ivec2 P)
+{
+	if(P.x < 0 || P.y < 0)
+		return dvec2(0.0);
+	
+	int size = textureSize(shadowSATTiled, 0).x;
+	ivec2 tile = P / SAT_TILE_SIZE;
+	return tileGrid[tile.y * (size / SAT_TILE_SIZE) + tile.x] + columnStrips[tile.y * size + P.x] + 
+		rowStrips[tile.x * size + P.y] + dvec2(texelFetch(shadowSATTiled, P, 0).xy);
+}
+
+// Box filter over the tiled SAT (see computeSATTiled.glsl). The corners are combined in double
+// precision, so large boxes don't lose the moments to cancellation like the float SAT does.
+float VSMTiled(float penumbraWidth, vec4 normalizedShadowCoord)
+{
+	ivec2 size = textureSize(shadowSATTiled, 0);
+	ivec2 lo, hi;
+	int area = BoxCorners(penumbraWidth, normalizedShadowCoord.xy, size, float(size.x), lo, hi);
+	if(area <= 0)
+		return 1.0;
+	
+	dvec2 A = FetchTiledSAT(lo);
+	dvec2 B = FetchTiledSAT(ivec2(hi.x, lo.y));
+	dvec2 C = FetchTiledSAT(ivec2(lo.x, hi.y));
+	dvec2 D = FetchTiledSAT(hi);
+	
+	vec2 moments = vec2((D - B - C + A) / double(area)) + 0.5;
+	return clamp(mix(ChebyshevUpperBound(moments, normalizedShadowCoord.z), 1.0, shadowSaturation), 0.0, 1.0);
+}
+
+float VSM(int cascade, float penumbraWidth, vec4 normalizedShadowCoord)
 {
 	if(penumbraWidth <= 0.0)
 		return 1.0;
 	
+	if(satFormat == SAT_FORMAT_FIXED_POINT)
+		return VSMFixed(penumbraWidth, normalizedShadowCoord);
+	if(satFormat == SAT_FORMAT_TILED)
+		return VSMTiled(penumbraWidth, normalizedShadowCoord);
+	
 	vec2 step = 1.0 / vec2(textureSize(shadowSAT,0));
 	
 	float xmax = normalizedShadowCoord.x + penumbraWidth * step.x;
@@ -283,37 +384,36 @@ float VSM(float penumbraWidth, vec4 normalizedShadowCoord)
 	float ymax = normalizedShadowCoord.y + penumbraWidth * step.x;
 	float ymin = normalizedShadowCoord.y - penumbraWidth * step.x;
 
-	vec4 A = texture(shadowSAT, vec2(xmin, ymin));
-	vec4 B = texture(shadowSAT, vec2(xmax, ymin));
-	vec4 C = texture(shadowSAT, vec2(xmin, ymax));
-	vec4 D = texture(shadowSAT, vec2(xmax, ymax));
+	vec2 A = SampleCascadeSAT(cascade, vec2(xmin, ymin));
+	vec2 B = SampleCascadeSAT(cascade, vec2(xmax, ymin));
+	vec2 C = SampleCascadeSAT(cascade, vec2(xmin, ymax));
+	vec2 D = SampleCascadeSAT(cascade, vec2(xmax, ymax));
 	
 	penumbraWidth *= 2.0;
 	
-	vec4 moments = (D + A - B - C)/float(penumbraWidth * penumbraWidth);
+	vec2 moments = (D + A - B - C)/float(penumbraWidth * penumbraWidth);
 	
-	moments.xy += 0.5;
-	return clamp(mix(ChebyshevUpperBound(moments.xy, normalizedShadowCoord.z), 1.0, shadowSaturation), 0.0, 1.0);
+	moments += 0.5;
+	return clamp(mix(ChebyshevUpperBound(moments, normalizedShadowCoord.z), 1.0, shadowSaturation), 0.0, 1.0);
 }
 
-float SummedAreaVarianceShadowMapping(vec4 normalizedShadowCoord)
+float SummedAreaVarianceShadowMapping(int cascade, float filterScale, vec4 normalizedShadowCoord)
 {
 	if(softSATVSM)
 	{
-		float averageDepth = ComputeAverageBlockerDepthBasedOnPCF(normalizedShadowCoord);
-		float penumbraWidth = ComputePenumbraWidth(averageDepth, normalizedShadowCoord.z);
+		float averageDepth = ComputeAverageBlockerDepthBasedOnPCF(cascade, filterScale, normalizedShadowCoord);
+		float penumbraWidth = ComputePenumbraWidth(averageDepth, normalizedShadowCoord.z) * filterScale;
 		penumbraWidth = clamp(penumbraWidth, 2.0, penumbraWidth); // This is a hack to eliminate shadow stippling
-		return VSM(penumbraWidth, normalizedShadowCoord);	
+		return VSM(cascade, penumbraWidth, normalizedShadowCoord);	
 	}
 	else {
-		return VSM(PenumbraSize, normalizedShadowCoord);
+		return VSM(cascade, PenumbraSize * filterScale, normalizedShadowCoord);
 	}	
 }
 
-
-float CalculateSATShadow(vec3 fragPos)
+float CascadeShadow(int cascade, vec3 fragPos)
 {
-	vec4 fragPosLightSpace = lightSpaceMatrix * vec4(fragPos, 1.0);
+	vec4 fragPosLightSpace = cascadeMatrices[cascade] * vec4(fragPos, 1.0);
 	vec4 normalizedShadowCoord = fragPosLightSpace / fragPosLightSpace.w;
 	// transform to [0,1] range
     normalizedShadowCoord = normalizedShadowCoord * 0.5 + 0.5;
@@ -328,77 +428,68 @@ float CalculateSATShadow(vec3 fragPos)
 	if(normalizedShadowCoord.y <= 0.01 || normalizedShadowCoord.y >= 0.99)
 		return 1.0;
 	
-	return SummedAreaVarianceShadowMapping(normalizedShadowCoord);
+	return SummedAreaVarianceShadowMapping(cascade, cascadeFilterScale[cascade], normalizedShadowCoord);
 }
 
-// ----------------------------------------------------------------------------
-vec3 SpecularIBL(vec3 N, vec3 V, float roughness)
+float CalculateSATShadow(vec3 fragPos)
 {
-	vec3 specularLighting = vec3(0.0);
-	float totalWeight = 0.0;
+	if(cascadeCount <= 1)
+		return CascadeShadow(0, fragPos);
+	
+	// pick the cascade by view depth, nothing beyond the last split is shadowed
+	float viewDepth = dot(fragPos - viewPos, viewDirection);
+	if(viewDepth > cascadeSplits[cascadeCount - 1])
+		return 1.0;
+	int cascade = 0;
+	while(viewDepth > cascadeSplits[cascade])
+		cascade++;
 	
-	for(uint i = 0u; i < iblSamples; ++i)
+	float shadow = CascadeShadow(cascade, fragPos);
+	
+	// fade into the next cascade over the last cascadeBlend of this one, which hides the seam
+	if(cascade < cascadeCount - 1)
 	{
-		// generates a sample vector that's biased towards the preferred alignment direction (importance sampling).
-        vec2 Xi = Hammersley(i, iblSamples);
-		vec3 H = ImportanceSampleGGX(Xi, N, roughness);
-		vec3 L  = normalize(2.0 * dot(V, H) * H - V);
-		float NdotL = max(dot(N, L), 0.0);
-		if(NdotL > 0.0)
-        {
-			// sample from the environment's mip level based on roughness/pdf
-            float D   = DistributionGGX(N, H, roughness);
-            float NdotH = max(dot(N, H), 0.0);
-            float HdotV = max(dot(H, V), 0.0);
-            float pdf = D * NdotH / (4.0 * HdotV) + 0.0001; 
-			
-			float resolution = 512.0; // resolution of source cubemap (per face)
-			float saTexel  = 4.0 * PI / (6.0 * resolution * resolution);
-            float saSample = 1.0 / (float(iblSamples) * pdf + 0.0001);
-			
-			// adding a bias of 1.0 as described in GPU Gems 3 Ch20 article
-			float mipLevel = roughness == 0.0 ? 0.0 : (0.5 * log2(saSample / saTexel) + 1.0); 
-			
-			specularLighting += textureLod(environmentMap, L, mipLevel).rgb * NdotL;
-			totalWeight      += NdotL;
-			
-		}
+		float cascadeStart = cascade == 0 ? 0.0 : cascadeSplits[cascade - 1];
+		float blendStart = mix(cascadeSplits[cascade], cascadeStart, cascadeBlend);
+		float t = Linstep(blendStart, cascadeSplits[cascade], viewDepth);
+		if(t > 0.0)
+			shadow = mix(shadow, CascadeShadow(cascade + 1, fragPos), t);
 	}
-	specularLighting = specularLighting / totalWeight;	
-	return specularLighting;
+	return shadow;
 }
 
-void main()
-{             
-    // retrieve data from gbuffer
-    vec3 FragPos = texture(gPosition, TexCoords).rgb;
-    vec3 Normal = texture(gNormal, TexCoords).rgb;
-    vec4 Diffuse = texture(gDiffuse, TexCoords);
-    vec4 Specular = texture(gSpecular, TexCoords);
+// Box filtered SAVSM of one shadowed light, the float path of VSM() on its atlas layer
+float AtlasShadow(ShadowedLight light, vec3 fragPos)
+{
+	vec4 fragPosLightSpace = light.lightSpaceMatrix * vec4(fragPos, 1.0);
+	if(fragPosLightSpace.w <= 0.0)
+		return 1.0;
+	vec4 normalizedShadowCoord = (fragPosLightSpace / fragPosLightSpace.w) * 0.5 + 0.5;
 	
-	// the alpha of diffuse represent roughness of material
-	float roughness = Diffuse.a;
-	float metallic = Specular.a;
-	// the alpha of Specular represents how "metallic" surface is.  For dia-electrics the albedo is mostly diffuse, while metals will use specular 
-	vec3 albedo = mix(Diffuse.rgb, Specular.rgb, metallic);
+	if(normalizedShadowCoord.z > 0.99)
+		return 1.0;
+	if(any(lessThanEqual(normalizedShadowCoord.xy, vec2(0.01))) || any(greaterThanEqual(normalizedShadowCoord.xy, vec2(0.99))))
+		return 1.0;
 	
-	// do PBR lighting
-	vec3 N = normalize(Normal);
-	vec3 V = normalize(viewPos - FragPos);
+	float layer = light.color.w;
+	vec2 step = PenumbraSize / vec2(textureSize(shadowAtlasSAT, 0).xy);
+	vec2 coordMin = normalizedShadowCoord.xy - step;
+	vec2 coordMax = normalizedShadowCoord.xy + step;
 	
-	// calculate reflectance at normal incidence; if dia-electric (like plastic) use F0 
-    // of 0.04 and if it's a metal, use the albedo color as F0 (metallic workflow)    
-    vec3 F0 = vec3(0.04);
-	F0 = mix(F0, albedo, metallic);
+	vec2 A = texture(shadowAtlasSAT, vec3(coordMin, layer)).xy;
+	vec2 B = texture(shadowAtlasSAT, vec3(coordMax.x, coordMin.y, layer)).xy;
+	vec2 C = texture(shadowAtlasSAT, vec3(coordMin.x, coordMax.y, layer)).xy;
+	vec2 D = texture(shadowAtlasSAT, vec3(coordMax, layer)).xy;
 	
-	// reflectance equation
-    vec3 Lo = vec3(0.0);
-	// calculate per-light radiance
-	vec3 L = normalize(gLight.Position - FragPos);
+	vec2 moments = (D + A - B - C) / (4.0 * PenumbraSize * PenumbraSize) + 0.5;
+	return clamp(mix(ChebyshevUpperBound(moments, normalizedShadowCoord.z), 1.0, shadowSaturation), 0.0, 1.0);
+}
+
+// ----------------------------------------------------------------------------
+// outgoing radiance of a light arriving from direction L, diffuse and specular
+vec3 CookTorrance(vec3 N, vec3 V, vec3 L, vec3 radiance, vec3 albedo, float roughness, float metallic, vec3 F0)
+{
 	vec3 H = normalize(V + L);
-	float distance = length(gLight.Position - FragPos);
-	float attenuation = 1.0 / (distance * distance);
-	vec3 radiance = gLight.Intensity * gLight.Color * attenuation;
 	
 	// Cook-Torrance BRDF
 	float NDF = DistributionGGX(N, H, roughness);   
@@ -423,23 +514,113 @@ void main()
 	// scale light by NdotL
 	float NdotL = max(dot(N, L), 0.0);        
 
-	// add to outgoing radiance Lo
 	// note that we already multiplied the BRDF by the Fresnel (kS) so we won't multiply by kS again
-	Lo += (kD * albedo / PI + specular) * radiance * NdotL;
+	return (kD * albedo / PI + specular) * radiance * NdotL;
+}
+
+// ----------------------------------------------------------------------------
+vec3 SpecularIBL(vec3 N, vec3 V, float roughness)
+{
+	// split-sum approximation: the lobe integral is baked per roughness into the mips
+	vec3 R = reflect(-V, N);
+	float lod = roughness * float(textureQueryLevels(prefilterMap) - 1);
+	return textureLod(prefilterMap, R, lod).rgb;
+}
+
+// ----------------------------------------------------------------------------
+vec3 IrradianceSH(vec3 n)
+{
+	vec3 irradiance = irradianceSH[0]
+		+ irradianceSH[1] * n.y + irradianceSH[2] * n.z + irradianceSH[3] * n.x
+		+ irradianceSH[4] * (n.x * n.y) + irradianceSH[5] * (n.y * n.z) + irradianceSH[6] * (3.0 * n.z * n.z - 1.0)
+		+ irradianceSH[7] * (n.x * n.z) + irradianceSH[8] * (n.x * n.x - n.y * n.y);
+	return max(irradiance, vec3(0.0));
+}
+
+vec3 WorldPosition(vec2 uv, float depth)
+{
+	vec4 P = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+	return P.xyz / P.w;
+}
+
+vec3 DecodeNormal(vec2 encoded)
+{
+	vec2 e = encoded * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+void main()
+{             
+    // retrieve data from gbuffer
+    vec3 FragPos = WorldPosition(TexCoords, texture(gDepth, TexCoords).r);
+    vec3 N = DecodeNormal(texture(gNormal, TexCoords).rg);
+	// for dia-electrics the albedo is mostly diffuse while metals use specular, the geometry pass
+	// already mixed the two by how "metallic" the surface is
+	vec3 albedo = texture(gAlbedo, TexCoords).rgb;
+	vec2 material = texture(gMaterial, TexCoords).rg;
+	float roughness = material.x;
+	float metallic = material.y;
+	
+	// do PBR lighting
+	vec3 V = normalize(viewPos - FragPos);
+	
+	// calculate reflectance at normal incidence; if dia-electric (like plastic) use F0 
+    // of 0.04 and if it's a metal, use the albedo color as F0 (metallic workflow)    
+    vec3 F0 = vec3(0.04);
+	F0 = mix(F0, albedo, metallic);
+	
+	// reflectance equation
+    vec3 Lo = vec3(0.0);
+	// calculate per-light radiance
+	vec3 L = normalize(gLight.Position - FragPos);
+	float distance = length(gLight.Position - FragPos);
+	float attenuation = 1.0 / (distance * distance);
+	vec3 radiance = gLight.Intensity * gLight.Color * attenuation;
+	
+	// add to outgoing radiance Lo
+	Lo += CookTorrance(N, V, L, radiance, albedo, roughness, metallic, F0);
+	
+	// shadowed lights of the shadow atlas
+	for(int i = 0; i < shadowedLightCount; i++)
+	{
+		ShadowedLight light = shadowedLights[i];
+		if(light.position.w == 0.0)
+		{
+			L = -light.direction.xyz;
+			radiance = light.color.rgb;
+		}
+		else
+		{
+			L = light.position.xyz - FragPos;
+			distance = length(L);
+			L /= distance;
+			// soft edge over the outer part of the cone
+			float cone = Linstep(light.direction.w, mix(light.direction.w, 1.0, 0.1), dot(-L, light.direction.xyz));
+			radiance = light.color.rgb * cone / (distance * distance);
+		}
+		if(dot(N, L) <= 0.0 || all(equal(radiance, vec3(0.0))))
+			continue;
+		
+		float lightShadow = ReduceLightBleeding(AtlasShadow(light, FragPos), 0.25);
+		Lo += CookTorrance(N, V, L, radiance, albedo, roughness, metallic, F0) * lightShadow;
+	}
 	
 	// ambient lighting (use IBL as the ambient term)
-    F = FresnelSchlickRoughness(max(dot(N, V), 0.0), F0, roughness);
+    vec3 F = FresnelSchlickRoughness(max(dot(N, V), 0.0), F0, roughness);
 	
-	kS = F;
-    kD = 1.0 - kS;
+	vec3 kS = F;
+    vec3 kD = 1.0 - kS;
     kD *= 1.0 - metallic;
 	
-	vec3 irradiance = texture(irradianceMap, N).rgb;
+	vec3 irradiance = IrradianceSH(N);
 	vec3 diffuse      = irradiance * albedo;
 	
 	vec3 specularIBL = SpecularIBL(N, V, roughness);
 	vec2 brdf  = texture(brdfLUT, vec2(max(dot(N, V), 0.0), roughness)).rg;
-    specular = specularIBL * (F * brdf.x + brdf.y);
+    vec3 specular = specularIBL * (F * brdf.x + brdf.y);
 	
 	// calculate shadow using Moment Shadow Map
 	float shadowFactor = CalculateSATShadow(FragPos);
@@ -454,6 +635,8 @@ void main()
 	vec3 ambient = (kD * diffuse + specular) * shadowFactor * AO;
 	
 	vec3 color = ambient + Lo;
+	if(tiledPointLights)
+		color += texture(pointLighting, TexCoords).rgb;
 	
 	// HDR tonemapping
     color = color / (color + vec3(1.0));
@@ -6,21 +6,26 @@ layout (location = 0) in vec3 aPos;
 uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
 
+// compact positions are unorm16 over the mesh bounds
+uniform vec3 positionScale = vec3(1.0);
+uniform vec3 positionBias = vec3(0.0);
+
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    gl_Position = lightSpaceMatrix * model * vec4(aPos * positionScale + positionBias, 1.0);
 }
 
 -- Fragment
 
-out vec4 FragColor;
+// the shadow map is RG32F, only the first two moments are written
+out vec2 FragColor;
 
 void main()
 {
     float depth = gl_FragCoord.z;	
     float squared = depth * depth;
 	
-    vec4 moment = vec4(0);
+    vec2 moment = vec2(0);
     moment.x = depth;
     moment.y = squared;
     float dx = dFdx(depth);
@@ -29,4 +34,105 @@ void main()
 	moment.y += 0.25 * (dx * dx + dy * dy);
 	moment.y -= 0.5;	
     FragColor = moment;
-}
\ No newline at end of file
+}
+-- FragmentDepthOnly
+
+// light pass of the fused moments path: only depth is written, computeSAT.DepthMomentsScan
+// derives the moments while it scans
+void main()
+{
+}
+
+-- VertexLayered
+
+// shadow atlas pass: the light transforms are applied per layer in GeometryLayered
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+
+// compact positions are unorm16 over the mesh bounds
+uniform vec3 positionScale = vec3(1.0);
+uniform vec3 positionBias = vec3(0.0);
+
+void main()
+{
+    gl_Position = model * vec4(aPos * positionScale + positionBias, 1.0);
+}
+
+-- GeometryLayered
+
+// One invocation per shadowed light sends the triangle to that light's layer of the shadow atlas,
+// so one draw call renders the casters into every light's moments (Fragment writes them).
+
+layout (triangles, invocations = MAX_SHADOWED_LIGHTS) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+struct ShadowedLight
+{
+	mat4 lightSpaceMatrix;
+	vec4 position;
+	vec4 direction;
+	vec4 color;		// w = atlas layer
+};
+
+layout(std430, binding = 4) readonly buffer ShadowedLights { ShadowedLight shadowedLights[]; };
+
+uniform int shadowedLightCount;
+
+void main()
+{
+	if (gl_InvocationID >= shadowedLightCount)
+		return;
+
+	mat4 lightSpaceMatrix = shadowedLights[gl_InvocationID].lightSpaceMatrix;
+	int layer = int(shadowedLights[gl_InvocationID].color.w);
+	for (int i = 0; i < 3; i++)
+	{
+		gl_Layer = layer;
+		gl_Position = lightSpaceMatrix * gl_in[i].gl_Position;
+		EmitVertex();
+	}
+	EndPrimitive();
+}
+
+-- GeometryParaboloid
+
+// Dual-paraboloid moments of point lights: every invocation renders one hemisphere of one light
+// into its layer of the staging atlas. lightSpaceMatrix moves the light to the origin with the
+// hemisphere's axis along +y, color.w is the layer. Depth is the distance to the light over
+// POINT_SHADOW_RANGE, so the maps don't depend on the light radius.
+
+layout (triangles, invocations = MAX_POINT_SHADOW_UPDATES * 2) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+struct ShadowedLight
+{
+	mat4 lightSpaceMatrix;
+	vec4 position;
+	vec4 direction;
+	vec4 color;		// w = atlas layer
+};
+
+layout(std430, binding = 4) readonly buffer ShadowedLights { ShadowedLight shadowedLights[]; };
+
+uniform int shadowedLightCount;
+
+void main()
+{
+	if (gl_InvocationID >= shadowedLightCount)
+		return;
+
+	mat4 lightSpaceMatrix = shadowedLights[gl_InvocationID].lightSpaceMatrix;
+	int layer = int(shadowedLights[gl_InvocationID].color.w);
+	for (int i = 0; i < 3; i++)
+	{
+		vec3 v = (lightSpaceMatrix * gl_in[i].gl_Position).xyz;
+		float distanceToLight = length(v);
+		gl_Layer = layer;
+		// the other hemisphere is clipped away
+		gl_ClipDistance[0] = v.y;
+		gl_Position = vec4(v.xz / (distanceToLight + v.y), 2.0 * distanceToLight / POINT_SHADOW_RANGE - 1.0, 1.0);
+		EmitVertex();
+	}
+	EndPrimitive();
+}
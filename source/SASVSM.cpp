@@ -12,6 +12,19 @@
 #include "framebuffer.h"
 #include "utility.h"
 #include "openglblurdata.h"
+#include "cpu_sat.h"
+#include "sat_backend.h"
+#include "shadow_cache.h"
+#include "gpu_timer.h"
+#include "light_bounds.h"
+#include "frustum_cull.h"
+#include "shadow_atlas.h"
+#include "shadow_scheduler.h"
+#include "tiled_lighting.h"
+#include "depth_pyramid.h"
+#include "sh_irradiance.h"
+#include "hdr_loader.h"
+#include "env_cache.h"
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw.h"
@@ -38,6 +51,11 @@ using namespace gl;
 #endif
 
 #include <iostream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <memory>
 #include <experimental/filesystem>
 namespace fs = std::experimental::filesystem;
 
@@ -51,7 +69,23 @@ void processInput(GLFWwindow *window);
 unsigned int loadTexture(const char *path, bool gammaCorrection);
 void renderQuad();
 void renderCube();
-void renderCubemap(int cubemap, Shader& equirectangularToCubemapShader, Shader& irradianceShader);
+std::string hdrCubemapPath(int cubemap);
+std::string environmentCachePath(int cubemap);
+std::vector<CachedTexture> environmentCacheTextures(unsigned int cubemap, unsigned int prefilter);
+void swapEnvironmentMaps();
+void saveEnvironmentCache(HDRLoader& hdrLoader, uint64_t key, const std::string& cachePath);
+void createEnvironmentMaps(unsigned int& cubemap, unsigned int& prefilter);
+bool buildEnvironmentStep(int step, unsigned int cubemap, unsigned int prefilter, Shader& equirectangularToCubemapShader, Shader& prefilterShader);
+void fitShadowCascades(const glm::mat4& cameraView, float fovY, float aspect, float nearPlane, float shadowDistance, float splitLambda,
+    const glm::mat4& lightView, int cascadeCount, glm::mat4* cascadeMatrices, float* cascadeSplits, float* cascadeFilterScale);
+void addShadowFootprint(glm::ivec2& rectMin, glm::ivec2& rectMax, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& lightModelMatrix);
+std::size_t cullInstances(const FrustumCuller& culler, bool enabled, const glm::mat4& viewProjection, std::vector<unsigned char>& visible);
+void bindGBuffer(FrameBuffer& gBuffer, unsigned int depthTexture);
+FrameBuffer* createAOBuffer(int aoScale);
+unsigned int createCascadeArray();
+void copyToCascadeLayer(FrameBuffer& frameBuffer, int attachment, unsigned int cascadeArray, int layer, int width, int height);
+struct AtlasLight;
+ShadowedLightGPU shadowedLightData(const AtlasLight& light);
 
 
 // settings
@@ -60,11 +94,39 @@ const unsigned int SCR_HEIGHT = 768;
 //const unsigned int SCR_WIDTH = 2048;
 //const unsigned int SCR_HEIGHT = 1535;
 const unsigned int SHADOW_MAP_SIZE = 1024;
+// edge of the tile-local SATs of the tiled SAT format
+const unsigned int SAT_TILE_SIZE = 64;
+static_assert(SHADOW_MAP_SIZE % SAT_TILE_SIZE == 0, "the shadow map has to be made of whole SAT tiles");
+// cascades of the directional light shadow, each with its own moments and SAT
+const int MAX_SHADOW_CASCADES = 4;
+// distance a cascade's depth range extends past its slice toward the light, for off-slice casters
+const float CASCADE_CASTER_MARGIN = 20.0f;
+// half extent of the single light box, the filter widths in the UI are in its texels
+const float SHADOW_BOX_HALF_SIZE = 10.0f;
+// additional shadowed lights, one layer of the shadow atlas each
+const int MAX_SHADOWED_LIGHTS = 8;
+const unsigned int SHADOW_ATLAS_SIZE = 512;
+static_assert(SHADOW_ATLAS_SIZE <= SAT_BLOCK_SIZE, "computeSAT.ScanArray scans an atlas row in one workgroup");
+// dual-paraboloid shadows of the point light grid: two maps per light, at most
+// MAX_POINT_SHADOW_UPDATES lights re-rendered per frame, depths normalized by POINT_SHADOW_RANGE
+const unsigned int POINT_SHADOW_SIZE = 128;
+const int MAX_POINT_SHADOW_UPDATES = 16;
+const float POINT_SHADOW_RANGE = 2.5f;
+static_assert(POINT_SHADOW_SIZE <= SHADOW_ATLAS_SIZE, "the point shadow maps share computeSAT.ScanArray with the atlas");
 const unsigned int ENV_CUBEMAP_SIZE = 512;
 const unsigned int IRRADIANCE_CUBEMAP_SIZE = 64;
+const unsigned int PREFILTER_CUBEMAP_SIZE = 128;
+const unsigned int PREFILTER_MIP_LEVELS = 5;     // roughness 0, 0.25, ... 1
+const unsigned int ENV_MIP_LEVELS = 9;
+const int BRDF_LUT_SIZE = 512;
+// passes of buildEnvironmentStep(): a mip level of the cubemap or a face and mip level of the prefiltered map
+const int ENVIRONMENT_BUILD_STEPS = ENV_MIP_LEVELS + 6 * PREFILTER_MIP_LEVELS;
 const float MAX_CAMERA_DISTANCE = 200.0f;
-const unsigned int LIGHT_GRID_WIDTH = 5;  // point light grid size
+const unsigned int LIGHT_GRID_WIDTH = 5;  // initial point light grid size
 const unsigned int LIGHT_GRID_HEIGHT = 4;  // point light vertical grid height
+const unsigned int MAX_LIGHT_GRID_WIDTH = 50;  // 10000 lights, for the tiled lighting pass
+// only the first lights of the grid (as many as the initial grid has) get point shadows
+const int MAX_SHADOWED_POINT_LIGHTS = LIGHT_GRID_WIDTH * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT;
 const float INITIAL_POINT_LIGHT_RADIUS = 0.870f;
 
 // compute shader related:
@@ -94,12 +156,20 @@ enum GBufferRender : int8_t
     Final,
     WorldPosition,
     WorldNormal,
-    Diffuse,
-    Specular,
+    Albedo,
+    Material,   // roughness, metallic
     Occlusion, // ambient occlusion
     Count
 };
 
+// how the summed-area table is stored, must match the SAT_FORMAT constants in deferredSASVSM.glsl
+enum SATFormat : int8_t
+{
+    Float,      // one RG32F table over the whole shadow map
+    FixedPoint, // one RG32UI fixed-point table, differenced exactly in integers
+    Tiled       // SAT_TILE_SIZE^2 tile-local RG32F tables plus double-precision tile offsets
+};
+
 // struct to hold information about scene light
 struct SceneLight {
     SceneLight(const glm::vec3& _position, const glm::vec3& _color, float _radius, float _intensity)
@@ -122,13 +192,32 @@ struct Material {
     float     metallic;     // how metalic material is
 };
 
+// spot or directional light with its own layer in the shadow atlas
+struct AtlasLight {
+    AtlasLight(const glm::vec3& _position, const glm::vec3& _target, const glm::vec3& _color, float _intensity, float _coneAngle)
+        : position(_position), target(_target), color(_color), intensity(_intensity), coneAngle(_coneAngle), layer(-1)
+    {}
+    glm::vec3 position;      // world light position, for a directional light the eye of its light box
+    glm::vec3 target;        // point the light is aimed at
+    glm::vec3 color;         // light's color
+    float     intensity;     // light's intensity
+    float     coneAngle;     // half angle of the spot cone in degrees, 0 for a directional light
+    int       layer;         // shadow atlas layer, -1 while the light is switched off
+};
+
 // buffer for light instance data
 unsigned int matrixBuffer;
 unsigned int colorSizeBuffer;
+unsigned int lightGridWidth = LIGHT_GRID_WIDTH;  // lightGridWidth^2 * LIGHT_GRID_HEIGHT point lights
 
-// cubemap and irradiance map ids
+// cubemap and prefiltered specular map ids, SH irradiance of the cubemap
 unsigned int envCubemap = 0;
-unsigned int irradianceMap = 0;
+unsigned int prefilterMap = 0;
+glm::vec3 irradianceSH[SH_COEFFICIENTS];
+// maps of the skybox being built from hdrTexture, swapped with the ones above when complete
+unsigned int pendingEnvCubemap = 0;
+unsigned int pendingPrefilterMap = 0;
+glm::vec3 pendingIrradianceSH[SH_COEFFICIENTS];
 unsigned int hdrTexture = 0;
 // fbo for rendering into cubemap and LUT texture
 unsigned int captureFBO;
@@ -136,9 +225,28 @@ unsigned int captureRBO;
 
 void configurePointLights(std::vector<glm::mat4>& modelMatrices, std::vector<glm::vec4>& modelColorSizes, float radius = 1.0f, float separation = 1.0f, float yOffset = 0.0f);
 void updatePointLights(std::vector<glm::mat4>& modelMatrices, std::vector<glm::vec4>& modelColorSizes, float separation, float yOffset, float radiusScale);
+void uploadPointLights(const std::vector<glm::mat4>& modelMatrices, const std::vector<glm::vec4>& modelColorSizes);
 
-int main()
+int main(int argc, char** argv)
 {
+    // headless mode: time the CPU SAT generation and exit without creating a window
+    bool satBenchmark = false;
+    const char* satBackendName = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--cpu-sat-benchmark") == 0) {
+            benchmarkCpuSAT(std::cout);
+            return 0;
+        }
+        // times all SAT backends once the GL context is up, then exits
+        else if (std::strcmp(argv[i], "--sat-benchmark") == 0) {
+            satBenchmark = true;
+        }
+        else if (std::strcmp(argv[i], "--sat-backend") == 0 && i + 1 < argc) {
+            satBackendName = argv[++i];
+        }
+    }
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -215,23 +323,85 @@ int main()
     globalShaderConstants = cStringFormatA("#define CS_THREAD_GROUP_SIZE %d\n", CS_THREAD_GROUP_SIZE);
     glswAddDirectiveToken("*", globalShaderConstants.c_str());
 
+    globalShaderConstants = cStringFormatA("#define SAT_TILE_SIZE %d\n", SAT_TILE_SIZE);
+    glswAddDirectiveToken("*", globalShaderConstants.c_str());
+
+    globalShaderConstants = cStringFormatA("#define SAT_TRANSPOSE_TILE %d\n", SAT_TRANSPOSE_TILE);
+    glswAddDirectiveToken("*", globalShaderConstants.c_str());
+
+    globalShaderConstants = cStringFormatA("#define MAX_SHADOW_CASCADES %d\n", MAX_SHADOW_CASCADES);
+    glswAddDirectiveToken("*", globalShaderConstants.c_str());
+
+    globalShaderConstants = cStringFormatA("#define MAX_SHADOWED_LIGHTS %d\n", MAX_SHADOWED_LIGHTS);
+    glswAddDirectiveToken("*", globalShaderConstants.c_str());
+
+    globalShaderConstants = cStringFormatA("#define SHADOW_ATLAS_SIZE %d\n", SHADOW_ATLAS_SIZE);
+    glswAddDirectiveToken("*", globalShaderConstants.c_str());
+
+    globalShaderConstants = cStringFormatA("#define MAX_POINT_SHADOW_UPDATES %d\n", MAX_POINT_SHADOW_UPDATES);
+    glswAddDirectiveToken("*", globalShaderConstants.c_str());
+
+    globalShaderConstants = cStringFormatA("#define POINT_SHADOW_RANGE %f\n", POINT_SHADOW_RANGE);
+    glswAddDirectiveToken("*", globalShaderConstants.c_str());
+
+    globalShaderConstants = cStringFormatA("#define LIGHT_TILE_SIZE %d\n", LIGHT_TILE_SIZE);
+    glswAddDirectiveToken("*", globalShaderConstants.c_str());
+
+    globalShaderConstants = cStringFormatA("#define MAX_LIGHTS_PER_TILE %d\n", MAX_LIGHTS_PER_TILE);
+    glswAddDirectiveToken("*", globalShaderConstants.c_str());
+
+    globalShaderConstants = cStringFormatA("#define DEPTH_PYRAMID_GROUP_SIZE %d\n", DEPTH_PYRAMID_GROUP_SIZE);
+    glswAddDirectiveToken("*", globalShaderConstants.c_str());
+
 
     // SAT
     Shader shaderSATHorizontal(glswGetShader("SAT.Vertex"), glswGetShader("SAT.FragmentH"));
     Shader shaderSATVertical(glswGetShader("SAT.Vertex"), glswGetShader("SAT.FragmentV"));
     Shader computeSAT(glswGetShader("computeSAT.ComputeSAT"));
+    // same scan with the transpose done in shared memory, so the stores are coalesced
+    Shader computeSATScanTransposed(glswGetShader("computeSAT.ScanTransposed"));
+    // ComputeSAT over every layer of the shadow atlas
+    Shader computeSATScanArray(glswGetShader("computeSAT.ScanArray"));
+    // depth to moments and the first ComputeSAT pass in one dispatch
+    Shader computeSATDepthMoments(glswGetShader("computeSAT.DepthMomentsScan"));
+    // multi-block SAT scan for shadow maps larger than SAT_BLOCK_SIZE
+    Shader computeSATScanBlocks(glswGetShader("computeSAT.ScanBlocks"));
+    Shader computeSATScanBlockSums(glswGetShader("computeSAT.ScanBlockSums"));
+    Shader computeSATAddBlockSums(glswGetShader("computeSAT.AddBlockSums"));
+    // fixed-point SAT: quantize the moments, then the same multi-block scan on integers
+    Shader computeSATQuantize(glswGetShader("computeSATFixed.Quantize"));
+    Shader computeSATFixedScanBlocks(glswGetShader("computeSATFixed.ScanBlocks"));
+    Shader computeSATFixedScanBlockSums(glswGetShader("computeSATFixed.ScanBlockSums"));
+    Shader computeSATFixedAddBlockSums(glswGetShader("computeSATFixed.AddBlockSums"));
+    // tiled SAT: local SATs per tile and the tile offsets
+    Shader computeSATScanTiles(glswGetShader("computeSATTiled.ScanTiles"));
+    Shader computeSATTileStrips(glswGetShader("computeSATTiled.TileStrips"));
+    Shader computeSATTileGrid(glswGetShader("computeSATTiled.TileGrid"));
+    // light view bounds of the visible receivers, for fitting the light projection
+    Shader computeLightBounds(glswGetShader("lightBounds.Reduce"));
     // hdr cubemap shaders
     Shader equirectangularToCubemapShader(glswGetShader("equirectToCubemap.Vertex"), glswGetShader("equirectToCubemap.Fragment"));
     Shader cubemapShader(glswGetShader("cubemap.Vertex"), glswGetShader("cubemap.Fragment"));
     // SSAO shaders
     Shader shaderSSAO(glswGetShader("ambientOcclusion.Vertex"), glswGetShader("ambientOcclusion.Fragment"));
+    Shader shaderSSAOUpsample(glswGetShader("ambientOcclusion.Vertex"), glswGetShader("ambientOcclusion.Upsample"));
     Shader computeBilateralBlur(glswGetShader("bilateralBlur.Compute"));
-    // PBR irradiance generation shader
-    Shader irradianceShader(glswGetShader("irradianceGen.Vertex"), glswGetShader("irradianceGen.Fragment"));
+    Shader computeDepthLinearize(glswGetShader("depthPyramid.Linearize"));
+    Shader computeDepthDownsample(glswGetShader("depthPyramid.Downsample"));
+    // PBR prefiltered specular environment generation shader
+    Shader prefilterShader(glswGetShader("prefilterGen.Vertex"), glswGetShader("prefilterGen.Fragment"));
     // BRDR LUT generation shader
     Shader brdfShader(glswGetShader("brdf.Vertex"), glswGetShader("brdf.Fragment"));
     // Shader for writing into a depth texture
     Shader shaderDepthWrite(glswGetShader("varianceShadowMap.Vertex"), glswGetShader("varianceShadowMap.Fragment"));
+    // depth-only light pass of the fused moments path
+    Shader shaderDepthOnly(glswGetShader("varianceShadowMap.Vertex"), glswGetShader("varianceShadowMap.FragmentDepthOnly"));
+    // moments of all shadow atlas lights in one layered pass
+    Shader shaderAtlasMoments(glswGetShader("varianceShadowMap.VertexLayered"), glswGetShader("varianceShadowMap.Fragment"),
+        glswGetShader("varianceShadowMap.GeometryLayered"));
+    // moments of both paraboloids of the refreshed point lights in one layered pass
+    Shader shaderPointShadowMoments(glswGetShader("varianceShadowMap.VertexLayered"), glswGetShader("varianceShadowMap.Fragment"),
+        glswGetShader("varianceShadowMap.GeometryParaboloid"));
     // Compute shader for doing multi-pass moving average box filtering
     Shader computeBlurShaderH(glswGetShader("blurCompute.ComputeH"));
     Shader computeBlurShaderV(glswGetShader("blurCompute.ComputeV"));
@@ -254,6 +424,8 @@ int main()
     Shader shaderLightSphere(glswGetShader("deferredLightInstanced.Vertex"), glswGetShader("deferredLightInstanced.Fragment"));
     // Shader for a final composite rendering of point(area) lights with generated G-Buffer
     Shader shaderPointLightingPass(glswGetShader("deferredPointLightInstanced.Vertex"), glswGetShader("deferredPointLightInstanced.Fragment"));
+    // light culling per screen tile and shading of the point lights in one dispatch
+    Shader computeTiledLighting(glswGetShader("tiledLighting.Compute"));
 
     // pbr: load the HDR environment map and render it into cubemap
     // ---------------------------------
@@ -265,8 +437,33 @@ int main()
     glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, ENV_CUBEMAP_SIZE, ENV_CUBEMAP_SIZE);
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
 
-    // pbr: generate an environment and irradiance cubemaps for IBL
-    renderCubemap(0, equirectangularToCubemapShader, irradianceShader);
+    // pbr: generate an environment and prefiltered specular cubemaps and the SH irradiance for IBL;
+    // the first skybox is waited for, later ones are decoded and built in the background
+    // baked maps are cached per skybox, keyed on the contents of the .hdr
+    fs::create_directories(PATH + "/OpenGL/cache");
+    SHIrradiance shIrradiance;
+    HDRLoader hdrLoader(shIrradiance, environmentCacheTextures(0, 0));
+    glGenTextures(1, &hdrTexture);
+    createEnvironmentMaps(envCubemap, prefilterMap);
+    createEnvironmentMaps(pendingEnvCubemap, pendingPrefilterMap);
+    hdrLoader.request(hdrCubemapPath(0), environmentCachePath(0));
+    hdrLoader.wait();
+    HDRLoader::Result environmentLoaded = HDRLoader::Result::None;
+    while (hdrLoader.busy() && environmentLoaded == HDRLoader::Result::None) {
+        environmentLoaded = hdrLoader.update(hdrTexture, environmentCacheTextures(envCubemap, prefilterMap), irradianceSH);
+    }
+    if (environmentLoaded == HDRLoader::Result::Image) {
+        for (int step = 0; step < ENVIRONMENT_BUILD_STEPS; ++step)
+        {
+            buildEnvironmentStep(step, envCubemap, prefilterMap, equirectangularToCubemapShader, prefilterShader);
+        }
+        saveEnvironmentCache(hdrLoader, hdrLoader.key(), hdrLoader.cachePath());
+    }
+    // next pass of the pending maps, -1 while no skybox is being built
+    int environmentBuildStep = -1;
+    // cache key and file of the image being built, the loader may move on to the next one meanwhile
+    uint64_t environmentBuildKey = 0;
+    std::string environmentBuildCachePath;
 
     // pbr: generate a 2D LUT from the BRDF equations used.
     // ----------------------------------------------------
@@ -274,7 +471,7 @@ int main()
     glGenTextures(1, &brdfLUTTexture);
     // pre-allocate enough memory for the LUT texture.
     glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, BRDF_LUT_SIZE, BRDF_LUT_SIZE, 0, GL_RG, GL_FLOAT, 0);
 
     // be sure to set wrapping mode to GL_CLAMP_TO_EDGE
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -282,18 +479,32 @@ int main()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // then re-configure capture framebuffer object and render screen-space quad with BRDF shader.
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdfLUTTexture, 0);
+    // the LUT only depends on brdf.glsl, so its cache is keyed on the shader source
+    std::string brdfCachePath = PATH + "/OpenGL/cache/brdfLUT.cache";
+    std::vector<CachedTexture> brdfCacheTextures = { { brdfLUTTexture, GL_TEXTURE_2D, GL_RG, 2, BRDF_LUT_SIZE, 1 } };
+    uint64_t brdfKey = hashFile(PATH + "/OpenGL/shaders/brdf.glsl");
+    MappedFile brdfCache;
+    if (brdfKey && brdfCache.open(brdfCachePath) && validTextureCache(brdfCache, brdfKey, brdfCacheTextures, 0)) {
+        loadTextureCache(brdfCache, brdfCacheTextures, nullptr, 0);
+    }
+    else {
+        // then re-configure capture framebuffer object and render screen-space quad with BRDF shader.
+        glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+        glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, BRDF_LUT_SIZE, BRDF_LUT_SIZE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdfLUTTexture, 0);
 
-    glViewport(0, 0, 512, 512);
-    brdfShader.use();
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    renderQuad();
+        glViewport(0, 0, BRDF_LUT_SIZE, BRDF_LUT_SIZE);
+        brdfShader.use();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        renderQuad();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (!brdfKey || !saveTextureCache(brdfCachePath, brdfKey, brdfCacheTextures, nullptr, 0)) {
+            std::cout << "Failed to write BRDF LUT cache " << brdfCachePath << std::endl;
+        }
+    }
+    brdfCache.close();
 
     // set up vertex data (and buffer(s)) and configure vertex attributes
     // ------------------------------------------------------------------
@@ -336,11 +547,14 @@ int main()
     std::string lucyPath = PATH + "/OpenGL/models/Lucy.obj";
     std::string heptoroid = PATH + "/OpenGL/models/heptoroid.obj";
     //std::string modelPath = PATH + "/OpenGL/models/Aphrodite.obj";
-    Model meshModelA(dragonPath);
+    // imported meshes are cached next to the baked IBL maps; the scene models use the compact
+    // vertex layout, the light sphere keeps full floats for the instanced light shaders
+    std::string meshCacheDirectory = PATH + "/OpenGL/cache";
+    Model meshModelA(dragonPath, false, meshCacheDirectory, VertexFormat::Compact);
     //Model meshModelB(dragonPath);
    // Model meshModelC(bunnyPath);
     std::string spherePath = PATH + "/OpenGL/models/Sphere.obj";
-    Model lightModel(spherePath);
+    Model lightModel(spherePath, false, meshCacheDirectory);
     
     std::vector<glm::vec3> objectPositions;
     objectPositions.push_back(glm::vec3(0.0, 0.4, 0.0));
@@ -361,8 +575,9 @@ int main()
     // configure depth map framebuffer for shadow generation/filtering
     // ----------------------
     FrameBuffer sBuffer(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
-    sBuffer.attachTexture(GL_RGBA32F);
-    sBuffer.attachTexture(GL_RGBA32F);            // attach secondary texture for ping-pong blurring
+    // only the first two moments are stored, RG32F halves the memory and SAT bandwidth of RGBA32F
+    sBuffer.attachTexture(GL_RG32F);
+    sBuffer.attachTexture(GL_RG32F);              // attach secondary texture for ping-pong blurring
     sBuffer.attachRender(GL_DEPTH_COMPONENT32);     // attach Depth render buffer
     sBuffer.bindInput(0);
     // Remove artifacts on the edges of the shadowmap
@@ -380,10 +595,32 @@ int main()
     glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
+    // depth-only shadow map for the fused moments path: no color attachment, the moments are
+    // derived from depth by computeSAT.DepthMomentsScan
+    unsigned int shadowDepthTexture;
+    glGenTextures(1, &shadowDepthTexture);
+    glBindTexture(GL_TEXTURE_2D, shadowDepthTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    unsigned int shadowDepthFBO;
+    glGenFramebuffers(1, &shadowDepthFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, shadowDepthFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowDepthTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "Depth-only shadow framebuffer not complete!" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
     // configure SAT generation framebuffer
     FrameBuffer satBuffer(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
-    satBuffer.attachTexture(GL_RGBA32F);
-    satBuffer.attachTexture(GL_RGBA32F);
+    satBuffer.attachTexture(GL_RG32F);
+    satBuffer.attachTexture(GL_RG32F);
     satBuffer.attachRender(GL_DEPTH_COMPONENT32);     // attach Depth render buffer
     satBuffer.bindInput(0);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
@@ -392,29 +629,177 @@ int main()
     glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 
+    // per-row block totals for the fixed-point multi-block scan (one texel per SAT_BLOCK_SIZE texels of a row)
+    const int satBlockCount = (SHADOW_MAP_SIZE + SAT_BLOCK_SIZE - 1) / SAT_BLOCK_SIZE;
+
+    // fixed-point SAT textures, the quantized moments and the two scan passes ping-pong between them
+    unsigned int satFixed[2];
+    glGenTextures(2, satFixed);
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+        glBindTexture(GL_TEXTURE_2D, satFixed[i]);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32UI, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+        // integer textures can't be filtered, VSMFixed() reads the corners with texelFetch
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    unsigned int satFixedBlockSums;
+    glGenTextures(1, &satFixedBlockSums);
+    glBindTexture(GL_TEXTURE_2D, satFixedBlockSums);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32UI, satBlockCount, SHADOW_MAP_SIZE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // tiled SAT: tile-local SATs plus the double-precision tile offsets (see computeSATTiled.glsl)
+    const int satTileCount = SHADOW_MAP_SIZE / SAT_TILE_SIZE;
+    unsigned int satTiled;
+    glGenTextures(1, &satTiled);
+    glBindTexture(GL_TEXTURE_2D, satTiled);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32F, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    unsigned int satColumnStrips, satRowStrips, satTileGrid;
+    glGenBuffers(1, &satColumnStrips);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, satColumnStrips);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, satTileCount * SHADOW_MAP_SIZE * 2 * sizeof(double), nullptr, GL_DYNAMIC_COPY);
+    glGenBuffers(1, &satRowStrips);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, satRowStrips);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, satTileCount * SHADOW_MAP_SIZE * 2 * sizeof(double), nullptr, GL_DYNAMIC_COPY);
+    glGenBuffers(1, &satTileGrid);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, satTileGrid);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, satTileCount * satTileCount * 2 * sizeof(double), nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // what the tiled SAT was last built from, so a moving caster only rebuilds the tiles it touches
+    bool tiledSATValid = false;
+    glm::mat4 tiledLightSpaceMatrix;
+    std::vector<glm::mat4> casterTransforms, tiledCasterTransforms;
+    int tiledSATTilesRebuilt = 0;
+
+    // CPU SAT generation, used as a fallback for the compute shader and to validate its output
+    CpuSAT cpuSAT;
+    std::vector<float> cpuMoments, cpuScratch, cpuSATTexels, gpuSATTexels;
+
+    // ways of building the float SAT, selectable at run time (see sat_backend.h)
+    ComputeScanSATBackend computeScanBackend(computeSAT, computeSATScanBlocks, computeSATScanBlockSums, computeSATAddBlockSums, false);
+    ComputeScanSATBackend multiBlockBackend(computeSAT, computeSATScanBlocks, computeSATScanBlockSums, computeSATAddBlockSums, true);
+    CoalescedSATBackend coalescedBackend(computeSATScanTransposed);
+    RecursiveDoublingSATBackend recursiveDoublingBackend(shaderSATHorizontal, shaderSATVertical, renderQuad);
+    CpuSATBackend cpuBackend(cpuSAT);
+    std::vector<SATBackend*> satBackends = { &computeScanBackend, &multiBlockBackend, &coalescedBackend, &recursiveDoublingBackend, &cpuBackend };
+    int satBackend = 0;    // the compute scan switches to the multi-block scan by itself above SAT_BLOCK_SIZE
+    if (satBackendName) {
+        int index = findSATBackend(satBackends, satBackendName);
+        if (index < 0) {
+            std::cout << "Unknown SAT backend " << satBackendName << ", available:";
+            for (SATBackend* backend : satBackends)
+                std::cout << " " << backend->id();
+            std::cout << std::endl;
+        }
+        else {
+            satBackend = index;
+        }
+    }
+    bool validateSAT = false;
+    int satMismatches = -1;
+    float satMaxError = 0.0f;
+
+    // skips the shadow and SAT passes while the light and the shadow casters don't move
+    ShadowCache shadowCache;
+    bool shadowCaching = true;
+
+    // fused path: depth-only light pass plus computeSAT.DepthMomentsScan instead of rasterized
+    // moments; needs the float format and rows that fit into one ComputeSAT workgroup, and
+    // replaces the selected SAT backend while it is active
+    bool fusedMoments = false;
+    bool fusedMomentsActive = false;    // what the current shadow textures were built with
+
+    // cascaded shadows (float SAT format only): cascade 0 renders into sBuffer/satBuffer, the
+    // others get their own moments and SAT frame buffers the first time they are used
+    int shadowCascades = 1;
+    float shadowDistance = 30.0f;       // view depth the last cascade ends at
+    float cascadeSplitLambda = 0.75f;   // 0 = uniform splits, 1 = logarithmic splits
+    float cascadeBlend = 0.1f;          // part of a cascade that fades into the next one
+    int cascadeCount = 1;
+    glm::mat4 cascadeMatrices[MAX_SHADOW_CASCADES];
+    float cascadeSplits[MAX_SHADOW_CASCADES] = {};
+    float cascadeFilterScale[MAX_SHADOW_CASCADES] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    // the cascades after the first render and scan in one scratch pair, and their results are
+    // copied into layer cascade - 1 of two arrays, so the lighting pass needs two samplers for them
+    std::unique_ptr<FrameBuffer> cascadeMoments;
+    std::unique_ptr<FrameBuffer> cascadeSAT;
+    unsigned int cascadeMomentsArray = 0;
+    unsigned int cascadeSATArray = 0;
+
+    // sample distribution shadow map (single map only): the light box shrinks to the bounds of
+    // the receivers the camera saw in the last frames instead of covering the whole scene
+    bool fitLightToView = false;
+    LightBoundsReduction lightBounds;
+    float fittedHalfSize = SHADOW_BOX_HALF_SIZE;
+
+    // bounding sphere culling of the model instances against the light and camera frustums
+    bool frustumCulling = true;
+    FrustumCuller instanceCuller;
+    std::vector<unsigned char> casterVisible, receiverVisible;
+    std::size_t castersDrawn = 0, castersTested = 0;
+    std::size_t receiversDrawn = 0;
+
+    // shadow atlas lights: a ring of spot lights around the models and one directional light,
+    // the first atlasLightCount of them are switched on
+    ShadowAtlas shadowAtlas(SHADOW_ATLAS_SIZE, MAX_SHADOWED_LIGHTS);
+    ShadowCache atlasCache;
+    std::vector<AtlasLight> atlasLights;
+    const glm::vec3 atlasLightColors[] = { glm::vec3(1.0f, 0.6f, 0.3f), glm::vec3(0.3f, 0.5f, 1.0f), glm::vec3(0.4f, 1.0f, 0.4f), glm::vec3(1.0f, 0.4f, 0.8f) };
+    for (int i = 0; i < MAX_SHADOWED_LIGHTS - 1; ++i)
+    {
+        float angle = glm::radians(360.0f * i / (MAX_SHADOWED_LIGHTS - 1));
+        glm::vec3 position(4.0f * std::cos(angle), 3.5f + 0.5f * (i % 2), 4.0f * std::sin(angle));
+        atlasLights.emplace_back(position, glm::vec3(0.0f, 0.5f, 0.0f), atlasLightColors[i % 4], 15.0f, 25.0f);
+    }
+    atlasLights.emplace_back(glm::vec3(4.0f, 6.0f, -3.0f), glm::vec3(0.0f), glm::vec3(1.0f, 0.95f, 0.9f), 0.5f, 0.0f);
+    int atlasLightCount = 0;
+    std::vector<ShadowedLightGPU> atlasLightData;
+
+    // GPU time of the shadow passes, to compare SAT kernels across drivers
+    GpuTimer shadowDepthTimer;
+    GpuTimer satTimer;
+    const char* glRenderer = (const char*)glGetString(GL_RENDERER);
 
     // configure g-buffer framebuffer
     // ------------------------------
+    // 10 bytes of color per pixel plus depth; positions are reconstructed from the depth texture
     FrameBuffer gBuffer(SCR_WIDTH, SCR_HEIGHT);
-    gBuffer.attachTexture(GL_RGBA16F, GL_LINEAR_MIPMAP_LINEAR); // Position color buffer + Depth
-    gBuffer.attachTexture(GL_RGB16F, GL_NEAREST);  // Normal color buffer
-    gBuffer.attachTexture(GL_RGBA, GL_NEAREST);    // Diffuse (Kd)
-    gBuffer.attachTexture(GL_RGBA, GL_NEAREST);    // Specular (Ks)
+    gBuffer.attachTexture(GL_RG16, GL_NEAREST);    // Normal, octahedral encoded
+    gBuffer.attachTexture(GL_RGBA8, GL_NEAREST);   // Albedo, Kd mixed with Ks by metallic
+    gBuffer.attachTexture(GL_RG8, GL_NEAREST);     // Roughness, metallic
     gBuffer.bindOutput();                          // calls glDrawBuffers[i] for all attached textures
-    gBuffer.attachRender(GL_DEPTH_COMPONENT);      // attach Depth render buffer
-
-    gBuffer.bindInput(0);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    // depth goes into a texture instead of a render buffer so the later passes can sample it
+    unsigned int gBufferDepth;
+    glGenTextures(1, &gBufferDepth);
+    glBindTexture(GL_TEXTURE_2D, gBufferDepth);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, SCR_WIDTH, SCR_HEIGHT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gBufferDepth, 0);
     gBuffer.check();
     FrameBuffer::unbind();                        // unbind framebuffer for now
 
-    // configure SSAO capture framebuffer
-    FrameBuffer aoBuffer(SCR_WIDTH, SCR_HEIGHT);
-    aoBuffer.attachTexture(GL_RGBA32F, GL_NEAREST);
-    aoBuffer.attachTexture(GL_RGBA32F, GL_NEAREST);
-    aoBuffer.bindOutput();                         // calls glDrawBuffers[i] for all attached textures
-    aoBuffer.check();
-    FrameBuffer::unbind();                         // unbind framebuffer for now
+    // configure SSAO capture framebuffer, at 1 / aoScale of the screen resolution
+    int aoResolution = 1;   // full, half, quarter
+    int aoScale = 1 << aoResolution;
+    std::unique_ptr<FrameBuffer> aoBuffer(createAOBuffer(aoScale));
+    // full resolution AO, joint bilateral upsampled from aoBuffer when aoScale > 1
+    FrameBuffer aoResolved(SCR_WIDTH, SCR_HEIGHT);
+    aoResolved.attachTexture(GL_R16F, GL_NEAREST);
+    aoResolved.bindOutput();
+    aoResolved.check();
+    FrameBuffer::unbind();
+    // view depth mips the SSAO kernel samples, rebuilt from the G-buffer every frame
+    DepthPyramid depthPyramid(SCR_WIDTH, SCR_HEIGHT);
 
     // lighting info
     // -------------
@@ -439,7 +824,9 @@ int main()
     materials.push_back(Material(glm::vec3(0.0 / 255.0, 0.0 / 255.0, 0.0 / 255.0), glm::vec3(196.0 / 255.0, 172.0 / 255.0, 61.0 / 255.0), 0.2f, 1.0f));
     //materials.push_back(Material(glm::vec3(211.0 / 255.0, 186.0 / 255.0, 161.0 / 255.0), glm::vec3(255.0 / 255.0, 255.0 / 255.0, 255.0 / 255.0), 0.226f, 0.072f));
     //float roughness = 0.2f;
+    bool pointLightsEnabled = false;
     float pointLightIntensity = 0.545f;
+    float glossiness = 32.0f;
     float pointLightRadius = INITIAL_POINT_LIGHT_RADIUS;
     float pointLightVerticalOffset = 1.205f;
     float pointLightSeparation = 0.620f;
@@ -448,8 +835,8 @@ int main()
     int lightSourceRadius = 16;
     float modelScale = 0.9f;
     bool softSATVSM = false;
-    // IBL
-    int iblSamples = 30;
+    int satFormat = SATFormat::Float;
+    int fixedPointBits = 16;    // fractional bits of the fixed-point moments
     // SSAO
     int aoSamples = 20;
     float sampleRadius = 1.0;
@@ -458,7 +845,9 @@ int main()
     int sampleTurns = 16;       // sampling turns
     bool bilateralBlur = true;
 
-    const int totalLights = LIGHT_GRID_WIDTH * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT;
+    int totalLights = lightGridWidth * lightGridWidth * LIGHT_GRID_HEIGHT;
+    int shadowedPointLights = std::min(totalLights, MAX_SHADOWED_POINT_LIGHTS);
+    int lightGridWidthSetting = (int)lightGridWidth;
     // initialize point lights
     configurePointLights(modelMatrices, modelColorSizes, pointLightRadius, pointLightSeparation, pointLightVerticalOffset);
     
@@ -489,7 +878,6 @@ int main()
 
     // configure instanced array of light colors
     // -------------------------
-    unsigned int colorSizeBuffer;
     glGenBuffers(1, &colorSizeBuffer);
    
     glBindVertexArray(VAO);
@@ -501,36 +889,86 @@ int main()
     glVertexAttribDivisor(2, 1);
 
     glBindVertexArray(0);
+
+    // point light shadows: the refreshed lights render into a staging atlas, their SATs are
+    // then copied into the cache array, where light i owns layers 2i (+y) and 2i + 1 (-y)
+    bool pointLightShadows = true;
+    int pointShadowBudget = 4;
+    ShadowAtlas pointShadowStaging(POINT_SHADOW_SIZE, 2 * MAX_POINT_SHADOW_UPDATES);
+    unsigned int pointShadowSAT;
+    glGenTextures(1, &pointShadowSAT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, pointShadowSAT);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RG32F, POINT_SHADOW_SIZE, POINT_SHADOW_SIZE, 2 * MAX_SHADOWED_POINT_LIGHTS);
+    // zero SATs until a light gets its first refresh
+    std::vector<float> zeroSAT(2 * POINT_SHADOW_SIZE * POINT_SHADOW_SIZE * 2 * MAX_SHADOWED_POINT_LIGHTS, 0.0f);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, POINT_SHADOW_SIZE, POINT_SHADOW_SIZE, 2 * MAX_SHADOWED_POINT_LIGHTS, GL_RG, GL_FLOAT, zeroSAT.data());
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // same zero border as the staging atlas the SATs are copied from
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    float pointShadowBorder[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, pointShadowBorder);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    ShadowScheduler pointShadowScheduler;
+    pointShadowScheduler.resize(shadowedPointLights);
+    FrustumCuller pointLightCuller;
+    pointLightCuller.resize(shadowedPointLights);
+    std::vector<unsigned char> pointLightVisible;
+    std::vector<glm::vec3> pointLightPositions(shadowedPointLights);
+    std::vector<float> pointLightCoverage(shadowedPointLights);
+    std::vector<ShadowedLightGPU> pointShadowData;
+    uint64_t pointShadowSceneKey = 0;
+    int pointShadowsRefreshed = 0;
+    GpuTimer pointShadowTimer;
+
+    // tiled compute lighting of the point lights, the light volumes only scale to a few hundred
+    bool tiledPointLighting = true;
+    TiledPointLighting tiledLighting(SCR_WIDTH, SCR_HEIGHT);
+    GpuTimer pointLightTimer;
     
     // shader configuration
     // --------------------
     pbrShader.use();
-    pbrShader.setUniformInt("gPosition", 0);
-    pbrShader.setUniformInt("gNormal", 1);
-    pbrShader.setUniformInt("gDiffuse", 2);
-    pbrShader.setUniformInt("gSpecular", 3);
+    pbrShader.setUniformInt("gNormal", 0);
+    pbrShader.setUniformInt("gAlbedo", 1);
+    pbrShader.setUniformInt("gMaterial", 2);
+    pbrShader.setUniformInt("gDepth", 3);
     pbrShader.setUniformInt("shadowSAT", 4);
-    pbrShader.setUniformInt("environmentMap", 5);
-    pbrShader.setUniformInt("irradianceMap", 6);
+    pbrShader.setUniformInt("prefilterMap", 5);
     pbrShader.setUniformInt("brdfLUT", 7);
     pbrShader.setUniformInt("ambientOcclusion", 8);
     pbrShader.setUniformInt("shadowMap", 9);
-    pbrShader.setUniformInt("iblSamples", iblSamples);
+    pbrShader.setUniformInt("shadowSATFixed", 10);
+    pbrShader.setUniformInt("shadowSATTiled", 11);
+    pbrShader.setUniformInt("cascadeSATs", 12);
+    pbrShader.setUniformInt("cascadeMaps", 13);
+    pbrShader.setUniformInt("shadowAtlasSAT", 14);
+    pbrShader.setUniformInt("pointLighting", 15);
 
     // deferred point lighting shader
     shaderPointLightingPass.use();
-    shaderPointLightingPass.setUniformInt("gPosition", 0);
-    shaderPointLightingPass.setUniformInt("gNormal", 1);
-    shaderPointLightingPass.setUniformInt("gDiffuse", 2);
-    shaderPointLightingPass.setUniformInt("gSpecular", 3);
+    shaderPointLightingPass.setUniformInt("gNormal", 0);
+    shaderPointLightingPass.setUniformInt("gAlbedo", 1);
+    shaderPointLightingPass.setUniformInt("gMaterial", 2);
+    shaderPointLightingPass.setUniformInt("gDepth", 3);
     shaderPointLightingPass.setUniformVec2f("screenSize", SCR_WIDTH, SCR_HEIGHT);
+    shaderPointLightingPass.setUniformInt("pointShadowSAT", 4);
+
+    // tiled point lighting shader
+    computeTiledLighting.use();
+    computeTiledLighting.setUniformInt("gNormal", 0);
+    computeTiledLighting.setUniformInt("gAlbedo", 1);
+    computeTiledLighting.setUniformInt("gMaterial", 2);
+    computeTiledLighting.setUniformInt("gDepth", 3);
+    computeTiledLighting.setUniformInt("pointShadowSAT", 4);
 
     // G-Buffer debug shader
     shaderGBufferDebug.use();
-    shaderGBufferDebug.setUniformInt("gPosition", 0);
-    shaderGBufferDebug.setUniformInt("gNormal", 1);
-    shaderGBufferDebug.setUniformInt("gDiffuse", 2);
-    shaderGBufferDebug.setUniformInt("gSpecular", 3);
+    shaderGBufferDebug.setUniformInt("gNormal", 0);
+    shaderGBufferDebug.setUniformInt("gAlbedo", 1);
+    shaderGBufferDebug.setUniformInt("gMaterial", 2);
+    shaderGBufferDebug.setUniformInt("gDepth", 3);
     shaderGBufferDebug.setUniformInt("gBufferMode", 1);
 
     // SSAO debug shader
@@ -539,8 +977,14 @@ int main()
 
     // SSAO generation shader
     shaderSSAO.use();
-    shaderSSAO.setUniformInt("gPosition", 0);
-    shaderSSAO.setUniformInt("gNormal", 1);
+    shaderSSAO.setUniformInt("gNormal", 0);
+    shaderSSAO.setUniformInt("depthPyramid", 4);
+    computeDepthLinearize.use();
+    computeDepthLinearize.setUniformInt("gDepth", 0);
+    shaderSSAOUpsample.use();
+    shaderSSAOUpsample.setUniformInt("gNormal", 0);
+    shaderSSAOUpsample.setUniformInt("gDepth", 3);
+    shaderSSAOUpsample.setUniformInt("aoTexture", 4);
 
     // SAT generation shader
     shaderSATHorizontal.use();
@@ -551,7 +995,16 @@ int main()
     computeSAT.use();
     computeSAT.setUniformInt("input_image", 0);
     computeSAT.setUniformInt("output_image", 1);
+    computeSATDepthMoments.use();
+    computeSATDepthMoments.setUniformInt("depth_map", 0);
+    computeLightBounds.use();
+    computeLightBounds.setUniformInt("gDepth", 0);
 
+    if (satBenchmark) {
+        benchmarkSATBackends(satBackends, std::cout);
+        glfwTerminate();
+        return 0;
+    }
 
     OpenGLBlurData data(8, 8.0f);
     // Create our blur data uniform buffer object
@@ -568,7 +1021,7 @@ int main()
     computeBilateralBlur.setUniformInt("uSrc", 0);
     computeBilateralBlur.setUniformInt("uDst", 1);
     computeBilateralBlur.setUniformVec2f("screenSize", SCR_WIDTH, SCR_HEIGHT);
-    computeBilateralBlur.setUniformInt("gPosition", 2);
+    computeBilateralBlur.setUniformInt("gDepth", 2);
     computeBilateralBlur.setUniformInt("gNormal", 3);
 
     // cubemap render shader
@@ -597,6 +1050,26 @@ int main()
         // -----
         processInput(window);
 
+        // background skybox switch: upload the decoded image, then build the maps a pass per frame
+        // -------------------------------------------------------------------------------------------
+        environmentLoaded = hdrLoader.update(hdrTexture, environmentCacheTextures(pendingEnvCubemap, pendingPrefilterMap), pendingIrradianceSH);
+        if (environmentLoaded == HDRLoader::Result::Image) {
+            environmentBuildStep = 0;
+            environmentBuildKey = hdrLoader.key();
+            environmentBuildCachePath = hdrLoader.cachePath();
+        }
+        else if (environmentLoaded == HDRLoader::Result::Cached) {
+            // a cache hit arrives complete and replaces a build that is still going on
+            swapEnvironmentMaps();
+            environmentBuildStep = -1;
+        }
+        if (environmentBuildStep >= 0 &&
+            buildEnvironmentStep(environmentBuildStep++, pendingEnvCubemap, pendingPrefilterMap, equirectangularToCubemapShader, prefilterShader)) {
+            swapEnvironmentMaps();
+            saveEnvironmentCache(hdrLoader, environmentBuildKey, environmentBuildCachePath);
+            environmentBuildStep = -1;
+        }
+
         // render
         // ------
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -609,85 +1082,290 @@ int main()
         glm::mat4 model = glm::mat4(1.0f);
         float zNear = 1.0f, zFar = 15.0f;
 
+        // world space bounding spheres of the instances, shared by all the culling below
+        instanceCuller.resize(objectPositions.size());
+        for (unsigned int i = 0; i < objectPositions.size(); i++)
+        {
+            const Bounds& bounds = meshModels[i]->bounds;
+            instanceCuller.setSphere(i, objectPositions[i] + modelScale * bounds.center, modelScale * bounds.radius);
+        }
+
         if (enableShadows) {
-            lightProjection = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, zNear, zFar);
+            lightProjection = glm::ortho(-SHADOW_BOX_HALF_SIZE, SHADOW_BOX_HALF_SIZE, -SHADOW_BOX_HALF_SIZE, SHADOW_BOX_HALF_SIZE, zNear, zFar);
             glm::vec3 lightPosition = arcballLight.eye();
             lightView = glm::lookAt(lightPosition, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
             lightSpaceMatrix = lightProjection * lightView;
-            // render scene from light's point of view
-            shaderDepthWrite.use();
-            shaderDepthWrite.setUniformMat4("lightSpaceMatrix", lightSpaceMatrix);
-            shaderDepthWrite.setUniformMat4("model", model);
 
-            glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
-            sBuffer.bindOutput();
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            // render the textured floor
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, woodTexture);
-            glBindVertexArray(planeVAO);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+            int width = (int)SHADOW_MAP_SIZE;
+            int height = (int)SHADOW_MAP_SIZE;
 
-            for (unsigned int i = 0; i < objectPositions.size(); i++)
-            {
-                model = glm::mat4(1.0f);
-                model = glm::translate(model, objectPositions[i]);
-                model = glm::scale(model, glm::vec3(modelScale));
-                shaderDepthWrite.setUniformMat4("model", model);
-                meshModels[i]->draw(shaderDepthWrite);
+            // cascades replace the fixed light box with one fitted to each slice of the view frustum
+            cascadeCount = satFormat == SATFormat::Float ? shadowCascades : 1;
+            if (cascadeCount > 1) {
+                fitShadowCascades(arcballCamera.transform(), glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, shadowDistance, cascadeSplitLambda,
+                    lightView, cascadeCount, cascadeMatrices, cascadeSplits, cascadeFilterScale);
+                lightSpaceMatrix = cascadeMatrices[0];
+                if (!cascadeMoments) {
+                    cascadeMoments.reset(new FrameBuffer(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE));
+                    cascadeMoments->attachTexture(GL_RG32F);
+                    cascadeMoments->attachRender(GL_DEPTH_COMPONENT32);
+                    cascadeSAT.reset(new FrameBuffer(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE));
+                    cascadeSAT->attachTexture(GL_RG32F);
+                    cascadeSAT->attachTexture(GL_RG32F);
+                    // same edge handling as sBuffer and satBuffer
+                    float borderColor[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                    for (FrameBuffer* buffer : { cascadeMoments.get(), cascadeSAT.get() })
+                    {
+                        buffer->bindInput(buffer == cascadeSAT.get() ? 1 : 0);
+                        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+                        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+                        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+                    }
+                    cascadeMomentsArray = createCascadeArray();
+                    cascadeSATArray = createCascadeArray();
+                }
+            }
+            else {
+                cascadeFilterScale[0] = 1.0f;
+                fittedHalfSize = SHADOW_BOX_HALF_SIZE;
+                glm::vec3 boundsMin, boundsMax;
+                if (fitLightToView && lightBounds.result(boundsMin, boundsMax)) {
+                    // square box around the receivers with some room for the camera moving since
+                    // the reduction; the size is quantized and the center snapped to shadow map
+                    // texels, so the map doesn't shimmer and the shadow cache still gets hits
+                    float halfSize = 0.5f * std::max(boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y) * 1.05f + 0.1f;
+                    halfSize = std::ceil(halfSize * 4.0f) / 4.0f;
+                    float texelSize = 2.0f * halfSize / (float)SHADOW_MAP_SIZE;
+                    glm::vec2 center = 0.5f * (glm::vec2(boundsMin) + glm::vec2(boundsMax));
+                    center = glm::floor(center / texelSize) * texelSize;
+                    // casters between the light and the receivers still need the near plane,
+                    // but nothing behind the farthest receiver does
+                    float lightFar = std::max(zNear + 0.5f, std::min(zFar, -boundsMin.z + 0.5f));
+                    lightProjection = glm::ortho(center.x - halfSize, center.x + halfSize, center.y - halfSize, center.y + halfSize, zNear, lightFar);
+                    lightSpaceMatrix = lightProjection * lightView;
+                    // the filter sizes are tuned for the fixed box
+                    cascadeFilterScale[0] = SHADOW_BOX_HALF_SIZE / halfSize;
+                    fittedHalfSize = halfSize;
+                }
+                cascadeMatrices[0] = lightSpaceMatrix;
             }
-            FrameBuffer::unbind();
 
-            // perform shadow map blurring 
-            int width = (int)SHADOW_MAP_SIZE;
-            int height = (int)SHADOW_MAP_SIZE;
+            // the shadow map and SAT only depend on the light, the shadow casters and the SAT
+            // settings, so while none of them change the textures of the last frame are reused
+            uint64_t shadowKey = hashValue(lightSpaceMatrix);
+            shadowKey = hashBytes(objectPositions.data(), objectPositions.size() * sizeof(glm::vec3), shadowKey);
+            shadowKey = hashValue(modelScale, shadowKey);
+            shadowKey = hashValue(satBackend, shadowKey);
+            shadowKey = hashValue(fusedMoments, shadowKey);
+            shadowKey = hashValue(cascadeCount, shadowKey);
+            shadowKey = hashBytes(cascadeMatrices, cascadeCount * sizeof(glm::mat4), shadowKey);
+            shadowKey = hashValue(satFormat, shadowKey);
+            shadowKey = hashValue(fixedPointBits, shadowKey);
+            if (!shadowCaching) {
+                shadowCache.invalidate();
+            }
 
-            // compute shader SAT generation as described in OpenGL SuperBible 7th Edition (CH 10)
-            computeSAT.use();
-            // bind shadow buffer as first texture
-            sBuffer.bindImage(0, 0, GL_RGBA32F);
-            satBuffer.bindImage(1, 0, GL_RGBA32F);
-            glDispatchCompute(width, 1, 1);
-            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-            satBuffer.bindImage(0, 0, GL_RGBA32F);
-            satBuffer.bindImage(1, 1, GL_RGBA32F);
-            glDispatchCompute(width, 1, 1);
-            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            if (!shadowCache.lookup(shadowKey)) {
+                casterTransforms.resize(objectPositions.size());
+                for (unsigned int i = 0; i < objectPositions.size(); i++)
+                {
+                    casterTransforms[i] = glm::translate(glm::mat4(1.0f), objectPositions[i]);
+                    casterTransforms[i] = glm::scale(casterTransforms[i], glm::vec3(modelScale));
+                }
+
+                // texels of the shadow map that have to be rendered again; the tiled SAT keeps the
+                // tiles no moving caster touches, everything else rebuilds the whole map
+                glm::ivec2 dirtyMin(0), dirtyMax((int)SHADOW_MAP_SIZE - 1);
+                bool partialUpdate = satFormat == SATFormat::Tiled && tiledSATValid && tiledLightSpaceMatrix == lightSpaceMatrix &&
+                    tiledCasterTransforms.size() == casterTransforms.size();
+                if (partialUpdate) {
+                    dirtyMin = glm::ivec2(SHADOW_MAP_SIZE);
+                    dirtyMax = glm::ivec2(-1);
+                    for (unsigned int i = 0; i < casterTransforms.size(); i++)
+                    {
+                        if (casterTransforms[i] != tiledCasterTransforms[i]) {
+                            // clear where the caster was and draw where it is now
+                            addShadowFootprint(dirtyMin, dirtyMax, meshModels[i]->bounds.min, meshModels[i]->bounds.max, lightSpaceMatrix * tiledCasterTransforms[i]);
+                            addShadowFootprint(dirtyMin, dirtyMax, meshModels[i]->bounds.min, meshModels[i]->bounds.max, lightSpaceMatrix * casterTransforms[i]);
+                        }
+                    }
+                    if (dirtyMin.x > dirtyMax.x || dirtyMin.y > dirtyMax.y) {
+                        dirtyMin = glm::ivec2(0);
+                        dirtyMax = glm::ivec2(-1);
+                    }
+                    else {
+                        // round out to whole tiles
+                        dirtyMin = dirtyMin / (int)SAT_TILE_SIZE * (int)SAT_TILE_SIZE;
+                        dirtyMax = (dirtyMax / (int)SAT_TILE_SIZE + 1) * (int)SAT_TILE_SIZE - 1;
+                    }
+                    glEnable(GL_SCISSOR_TEST);
+                    glScissor(dirtyMin.x, dirtyMin.y, dirtyMax.x - dirtyMin.x + 1, dirtyMax.y - dirtyMin.y + 1);
+                }
 
+                fusedMomentsActive = fusedMoments && satFormat == SATFormat::Float && cascadeCount == 1 && SHADOW_MAP_SIZE <= SAT_BLOCK_SIZE;
+                Shader& lightPassShader = fusedMomentsActive ? shaderDepthOnly : shaderDepthWrite;
+
+                // render scene from light's point of view
+                shadowDepthTimer.start();
+                lightPassShader.use();
+                lightPassShader.setUniformMat4("lightSpaceMatrix", lightSpaceMatrix);
+                lightPassShader.setUniformMat4("model", model);
 
-            // SAT Generation as developed by Hensley
-            /*int maxIterations = glm::log2(float(SHADOW_MAP_SIZE));
-            for (int iteration = 0; iteration < maxIterations; ++iteration)
-            {
                 glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
-                satBufferA.bindOutput();
-                glClearColor(1, 1, 1, 1);
-                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                shaderSATHorizontal.use();
-                shaderSATHorizontal.setUniformInt("iteration", iteration);
-                if (iteration == 0) {
-                    glActiveTexture(GL_TEXTURE0);
-                    sBuffer.bindInput(0);
+                if (fusedMomentsActive) {
+                    glBindFramebuffer(GL_FRAMEBUFFER, shadowDepthFBO);
+                    glClear(GL_DEPTH_BUFFER_BIT);
                 }
                 else {
-                    satBufferB.bindInput();
+                    sBuffer.bindOutput();
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                }
+                // render the textured floor
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, woodTexture);
+                glBindVertexArray(planeVAO);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+
+                castersDrawn = cullInstances(instanceCuller, frustumCulling, lightSpaceMatrix, casterVisible);
+                castersTested = objectPositions.size();
+                for (unsigned int i = 0; i < objectPositions.size(); i++)
+                {
+                    if (!casterVisible[i])
+                        continue;
+                    lightPassShader.setUniformMat4("model", casterTransforms[i]);
+                    meshModels[i]->drawDepth(lightPassShader);
                 }
-                renderQuad();
                 FrameBuffer::unbind();
+                glDisable(GL_SCISSOR_TEST);
+                shadowDepthTimer.stop();
+
+                satTimer.start();
+                tiledSATValid = satFormat == SATFormat::Tiled;
+                if (satFormat == SATFormat::FixedPoint) {
+                    // quantize the moments to fixed point and sum them as integers, which is exact
+                    // for any shadow map size; the result ends up back in satFixed[0]
+                    computeSATQuantize.use();
+                    computeSATQuantize.setUniformFloat("fixedPointScale", float(1u << fixedPointBits));
+                    sBuffer.bindImage(0, 0, GL_RG32F);
+                    glBindImageTexture(1, satFixed[0], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32UI);
+                    glDispatchCompute((width + 15) / 16, (height + 15) / 16, 1);
+                    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+                    glBindImageTexture(2, satFixedBlockSums, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32UI);
+                    glBindImageTexture(0, satFixed[0], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32UI);
+                    glBindImageTexture(1, satFixed[1], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32UI);
+                    multiBlockSATPass(computeSATFixedScanBlocks, computeSATFixedScanBlockSums, computeSATFixedAddBlockSums, width, height);
+                    glBindImageTexture(0, satFixed[1], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32UI);
+                    glBindImageTexture(1, satFixed[0], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32UI);
+                    multiBlockSATPass(computeSATFixedScanBlocks, computeSATFixedScanBlockSums, computeSATFixedAddBlockSums, height, width);
+                    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+                }
+                else if (satFormat == SATFormat::Tiled) {
+                    // local SATs of the dirty tiles, then the offsets of all tiles, which is cheap
+                    // next to the tiles themselves (one pass over two texel rows per tile)
+                    glm::ivec2 firstTile = dirtyMin / (int)SAT_TILE_SIZE;
+                    glm::ivec2 tileCount = (dirtyMax + 1) / (int)SAT_TILE_SIZE - firstTile;
+                    computeSATScanTiles.use();
+                    computeSATScanTiles.setUniformVec2i("firstTile", firstTile.x, firstTile.y);
+                    sBuffer.bindImage(0, 0, GL_RG32F);
+                    glBindImageTexture(1, satTiled, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32F);
+                    glDispatchCompute(tileCount.x, tileCount.y, 1);
+                    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, satColumnStrips);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, satRowStrips);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, satTileGrid);
+                    computeSATTileStrips.use();
+                    glDispatchCompute((width + 63) / 64, 1, 1);
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                    computeSATTileGrid.use();
+                    glDispatchCompute((satTileCount + 63) / 64, 1, 1);
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+                    tiledLightSpaceMatrix = lightSpaceMatrix;
+                    tiledCasterTransforms = casterTransforms;
+                    tiledSATTilesRebuilt = tileCount.x * tileCount.y;
+                }
+                else if (fusedMomentsActive) {
+                    // moments and horizontal scan straight from depth, then the vertical ComputeSAT pass
+                    computeSATDepthMoments.use();
+                    glActiveTexture(GL_TEXTURE0);
+                    glBindTexture(GL_TEXTURE_2D, shadowDepthTexture);
+                    satBuffer.bindImage(1, 0, GL_RG32F);
+                    glDispatchCompute(height, 1, 1);
+                    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+                    computeSAT.use();
+                    satBuffer.bindImage(0, 0, GL_RG32F);
+                    satBuffer.bindImage(1, 1, GL_RG32F);
+                    glDispatchCompute(width, 1, 1);
+                    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+                }
+                else {
+                    satBackends[satBackend]->generate(sBuffer, satBuffer, width, height);
+                }
 
-                glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
-                satBufferB.bindOutput();
-                glClearColor(1, 1, 1, 1);
-                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                shaderSATVertical.use();
-                shaderSATVertical.setUniformInt("iteration", iteration);
-                satBufferA.bindInput();
-                renderQuad();
-                FrameBuffer::unbind();
+                // the remaining cascades: moments and SAT of each, with the same backend
+                for (int cascade = 1; cascade < cascadeCount; ++cascade)
+                {
+                    FrameBuffer& moments = *cascadeMoments;
+                    shaderDepthWrite.use();
+                    shaderDepthWrite.setUniformMat4("lightSpaceMatrix", cascadeMatrices[cascade]);
+                    shaderDepthWrite.setUniformMat4("model", glm::mat4(1.0f));
+
+                    glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+                    moments.bindOutput();
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                    glActiveTexture(GL_TEXTURE0);
+                    glBindTexture(GL_TEXTURE_2D, woodTexture);
+                    glBindVertexArray(planeVAO);
+                    glDrawArrays(GL_TRIANGLES, 0, 6);
+                    castersDrawn += cullInstances(instanceCuller, frustumCulling, cascadeMatrices[cascade], casterVisible);
+                    castersTested += objectPositions.size();
+                    for (unsigned int i = 0; i < objectPositions.size(); i++)
+                    {
+                        if (!casterVisible[i])
+                            continue;
+                        shaderDepthWrite.setUniformMat4("model", casterTransforms[i]);
+                        meshModels[i]->drawDepth(shaderDepthWrite);
+                    }
+                    FrameBuffer::unbind();
+
+                    satBackends[satBackend]->generate(moments, *cascadeSAT, width, height);
+                    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+                    copyToCascadeLayer(moments, 0, cascadeMomentsArray, cascade - 1, width, height);
+                    copyToCascadeLayer(*cascadeSAT, 1, cascadeSATArray, cascade - 1, width, height);
+                }
+                satTimer.stop();
+            }
+
+            if (validateSAT && satFormat == SATFormat::Float && !fusedMomentsActive && satBackends[satBackend]->matchesComputeShaderOrder()) {
+                // replay the compute shader's summation order on the CPU and compare bit for bit
+                glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+                readbackTexture(sBuffer, 0, width, height, cpuMoments);
+                readbackTexture(satBuffer, 1, width, height, gpuSATTexels);
+                cpuSATTexels.resize(cpuMoments.size());
+                cpuScratch.resize(cpuMoments.size());
+                cpuSAT.generate(cpuMoments.data(), cpuScratch.data(), cpuSATTexels.data(), width, height, CpuSAT::ScanOrder::ComputeShader);
+                satMismatches = 0;
+                satMaxError = 0.0f;
+                for (size_t i = 0; i < gpuSATTexels.size(); ++i)
+                {
+                    if (std::memcmp(&gpuSATTexels[i], &cpuSATTexels[i], sizeof(float)) != 0) {
+                        satMismatches++;
+                        satMaxError = std::max(satMaxError, std::abs(gpuSATTexels[i] - cpuSATTexels[i]));
+                    }
+                }
+                validateSAT = false;
             }
-            */
         }
         else {
+            // the cleared map below replaces the cached shadow
+            shadowCache.invalidate();
+            tiledSATValid = false;
+            fusedMomentsActive = false;
+            cascadeCount = 1;
+            cascadeMatrices[0] = lightSpaceMatrix;
+            cascadeFilterScale[0] = 1.0f;
             // just clear the depth texture if shadows aren't being generated
             glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
             sBuffer.bindOutput();
@@ -695,6 +1373,50 @@ int main()
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
             glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         }
+
+        // 1b. shadow atlas: moments of all atlas lights in one layered pass, then all their SATs
+        // -------------------------------------------------------------------------------------
+        atlasLightData.clear();
+        for (int i = 0; i < (int)atlasLights.size(); ++i)
+        {
+            AtlasLight& light = atlasLights[i];
+            if (i < atlasLightCount && light.layer < 0) {
+                light.layer = shadowAtlas.allocate();
+            }
+            else if (i >= atlasLightCount && light.layer >= 0) {
+                shadowAtlas.free(light.layer);
+                light.layer = -1;
+            }
+            if (light.layer >= 0) {
+                atlasLightData.push_back(shadowedLightData(light));
+            }
+        }
+        if (!atlasLightData.empty()) {
+            uint64_t atlasKey = hashBytes(atlasLightData.data(), atlasLightData.size() * sizeof(ShadowedLightGPU));
+            atlasKey = hashBytes(objectPositions.data(), objectPositions.size() * sizeof(glm::vec3), atlasKey);
+            atlasKey = hashValue(modelScale, atlasKey);
+            if (!atlasCache.lookup(atlasKey)) {
+                shadowAtlas.uploadLights(atlasLightData);
+                shadowAtlas.bindLights(4);
+                shadowAtlas.beginMoments();
+                shaderAtlasMoments.use();
+                shaderAtlasMoments.setUniformInt("shadowedLightCount", (int)atlasLightData.size());
+                shaderAtlasMoments.setUniformMat4("model", glm::mat4(1.0f));
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, woodTexture);
+                glBindVertexArray(planeVAO);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+                for (unsigned int i = 0; i < objectPositions.size(); i++)
+                {
+                    model = glm::translate(glm::mat4(1.0f), objectPositions[i]);
+                    model = glm::scale(model, glm::vec3(modelScale));
+                    shaderAtlasMoments.setUniformMat4("model", model);
+                    meshModels[i]->drawDepth(shaderAtlasMoments);
+                }
+                FrameBuffer::unbind();
+                shadowAtlas.buildSATs(computeSATScanArray, shadowAtlas.usedLayers());
+            }
+        }
         
         // 2. geometry pass: render scene's geometry/color data into gbuffer
         // -----------------------------------------------------------------
@@ -704,6 +1426,9 @@ int main()
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 150.0f);
         glm::mat4 view = arcballCamera.transform();
+        // the passes reading the G-buffer reconstruct positions from depth with these
+        glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+        glm::mat4 inverseProjection = glm::inverse(projection);
         model = glm::mat4(1.0f);
         cubemapShader.use();
         cubemapShader.setUniformMat4("projection", projection);
@@ -726,8 +1451,11 @@ int main()
         shaderGeometryPass.setUniformMat4("view", view);
         glm::vec4 specular = glm::vec4(1.0f, 1.0f, 1.0f, 0.1f);
        
+        receiversDrawn = cullInstances(instanceCuller, frustumCulling, projection * view, receiverVisible);
         for (unsigned int i = 0; i < objectPositions.size(); i++)
         {
+            if (!receiverVisible[i])
+                continue;
             model = glm::mat4(1.0f);
             model = glm::translate(model, objectPositions[i]);
             model = glm::scale(model, glm::vec3(modelScale));
@@ -740,18 +1468,112 @@ int main()
         }
         FrameBuffer::unbind();
 
-        // 2a. generate SSAO texture
-        // ------------------------
-        aoBuffer.bindOutput();
+        // 2a. light view bounds of what the camera sees, used by the next frames' light box
+        // ---------------------------------------------------------------------------------
+        if (enableShadows && fitLightToView && cascadeCount == 1) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, gBufferDepth);
+            computeLightBounds.use();
+            computeLightBounds.setUniformMat4("inverseViewProjection", inverseViewProjection);
+            lightBounds.reduce(computeLightBounds, lightView, SCR_WIDTH, SCR_HEIGHT);
+        }
+
+        // 2b. point light shadows: the stale maps that matter most on screen, up to the budget
+        // -----------------------------------------------------------------------------------
+        pointShadowsRefreshed = 0;
+        if (pointLightsEnabled && pointLightShadows && gBufferMode == GBufferRender::Final) {
+            // a moved caster invalidates every cached map
+            uint64_t sceneKey = hashBytes(objectPositions.data(), objectPositions.size() * sizeof(glm::vec3));
+            sceneKey = hashValue(modelScale, sceneKey);
+            if (sceneKey != pointShadowSceneKey) {
+                pointShadowScheduler.invalidateAll();
+                pointShadowSceneKey = sceneKey;
+            }
+            for (int i = 0; i < shadowedPointLights; ++i)
+            {
+                pointLightPositions[i] = glm::vec3(modelMatrices[i][3]);
+                pointLightCuller.setSphere(i, pointLightPositions[i], modelColorSizes[i].w);
+            }
+            pointLightCuller.cull(projection * view, pointLightVisible);
+            for (int i = 0; i < shadowedPointLights; ++i)
+            {
+                pointLightCoverage[i] = pointLightVisible[i] ? sphereScreenCoverage(pointLightPositions[i], modelColorSizes[i].w, view, projection) : 0.0f;
+            }
+            const std::vector<int>& refreshed = pointShadowScheduler.schedule(pointLightPositions, pointLightCoverage, pointShadowBudget);
+            pointShadowsRefreshed = (int)refreshed.size();
+            if (!refreshed.empty()) {
+                pointShadowTimer.start();
+                // two layers per light, the -y paraboloid looks down through a mirrored view
+                pointShadowData.clear();
+                for (int k = 0; k < (int)refreshed.size(); ++k)
+                {
+                    glm::vec3 position = pointLightPositions[refreshed[k]];
+                    glm::mat4 toLight = glm::translate(glm::mat4(1.0f), -position);
+                    for (int hemisphere = 0; hemisphere < 2; ++hemisphere)
+                    {
+                        ShadowedLightGPU light;
+                        light.lightSpaceMatrix = hemisphere == 0 ? toLight : glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, -1.0f, 1.0f)) * toLight;
+                        light.position = glm::vec4(position, 1.0f);
+                        light.direction = glm::vec4(0.0f, hemisphere == 0 ? 1.0f : -1.0f, 0.0f, 0.0f);
+                        light.color = glm::vec4(1.0f, 1.0f, 1.0f, float(2 * k + hemisphere));
+                        pointShadowData.push_back(light);
+                    }
+                }
+                pointShadowStaging.uploadLights(pointShadowData);
+                pointShadowStaging.bindLights(4);
+                pointShadowStaging.beginMoments();
+                glEnable(GL_CLIP_DISTANCE0);
+                shaderPointShadowMoments.use();
+                shaderPointShadowMoments.setUniformInt("shadowedLightCount", (int)pointShadowData.size());
+                shaderPointShadowMoments.setUniformMat4("model", glm::mat4(1.0f));
+                glBindVertexArray(planeVAO);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+                for (unsigned int i = 0; i < objectPositions.size(); i++)
+                {
+                    model = glm::translate(glm::mat4(1.0f), objectPositions[i]);
+                    model = glm::scale(model, glm::vec3(modelScale));
+                    shaderPointShadowMoments.setUniformMat4("model", model);
+                    meshModels[i]->drawDepth(shaderPointShadowMoments);
+                }
+                glDisable(GL_CLIP_DISTANCE0);
+                FrameBuffer::unbind();
+                pointShadowStaging.buildSATs(computeSATScanArray, (int)pointShadowData.size());
+                glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+                for (int k = 0; k < (int)refreshed.size(); ++k)
+                {
+                    glCopyImageSubData(pointShadowStaging.satTexture(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, 2 * k,
+                        pointShadowSAT, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 2 * refreshed[k], POINT_SHADOW_SIZE, POINT_SHADOW_SIZE, 2);
+                }
+                pointShadowTimer.stop();
+                glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+            }
+        }
+
+        // 2c. generate SSAO texture from the view depth pyramid
+        // ----------------------------------------------------
+        computeDepthLinearize.use();
+        computeDepthLinearize.setUniformMat4("inverseProjection", inverseProjection);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, gBufferDepth);
+        depthPyramid.build(computeDepthLinearize, computeDepthDownsample);
+
+        int aoWidth = (SCR_WIDTH + aoScale - 1) / aoScale;
+        int aoHeight = (SCR_HEIGHT + aoScale - 1) / aoScale;
+        glViewport(0, 0, aoWidth, aoHeight);
+        aoBuffer->bindOutput();
         glClear(GL_COLOR_BUFFER_BIT);
         shaderSSAO.use();
+        shaderSSAO.setUniformInt("aoScale", aoScale);
         shaderSSAO.setUniformMat4("view", view);
+        shaderSSAO.setUniformMat4("inverseProjection", inverseProjection);
         shaderSSAO.setUniformInt("aoSamples", aoSamples);
         shaderSSAO.setUniformFloat("sampleRadius", sampleRadius);
         shaderSSAO.setUniformInt("sampleTurns", sampleTurns);
         shaderSSAO.setUniformFloat("shadowScalar", shadowScalar);
         shaderSSAO.setUniformFloat("shadowContrast", shadowContrast);
-        gBuffer.bindInput();
+        bindGBuffer(gBuffer, gBufferDepth);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, depthPyramid.texture());
         renderQuad();
         FrameBuffer::unbind();
 
@@ -762,21 +1584,62 @@ int main()
             glBindBufferBase(GL_UNIFORM_BUFFER, 7, uboBlurData);
             computeBilateralBlur.setUniformMat4("projection", projection);
             computeBilateralBlur.setUniformMat4("view", view);
-            aoBuffer.bindImage(0, 0, GL_RGBA32F, GL_READ_ONLY);
-            aoBuffer.bindImage(1, 1, GL_RGBA32F, GL_WRITE_ONLY);
+            computeBilateralBlur.setUniformMat4("inverseProjection", inverseProjection);
+            computeBilateralBlur.setUniformInt("aoScale", aoScale);
+            aoBuffer->bindImage(0, 0, GL_R16F, GL_READ_ONLY);
+            aoBuffer->bindImage(1, 1, GL_R16F, GL_WRITE_ONLY);
             computeBilateralBlur.setUniformVec2i("direction", 1, 0);
             glActiveTexture(GL_TEXTURE2);
-            gBuffer.bindInput(0);
+            glBindTexture(GL_TEXTURE_2D, gBufferDepth);
             glActiveTexture(GL_TEXTURE3);
-            gBuffer.bindInput(1);
-            glDispatchCompute(std::ceil(float(SCR_WIDTH) / 128), SCR_HEIGHT, 1);
+            gBuffer.bindInput(0);
+            glDispatchCompute(std::ceil(float(aoWidth) / 128), aoHeight, 1);
             glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
-            aoBuffer.bindImage(0, 1, GL_RGBA32F, GL_READ_ONLY);
-            aoBuffer.bindImage(1, 0, GL_RGBA32F, GL_WRITE_ONLY);
+            aoBuffer->bindImage(0, 1, GL_R16F, GL_READ_ONLY);
+            aoBuffer->bindImage(1, 0, GL_R16F, GL_WRITE_ONLY);
             computeBilateralBlur.setUniformVec2i("direction", 0, 1);
-            glDispatchCompute(std::ceil(float(SCR_HEIGHT) / 128), SCR_WIDTH, 1);
-            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            glDispatchCompute(std::ceil(float(aoHeight) / 128), aoWidth, 1);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+        }
+
+        // upsample the AO to the screen resolution, guided by the G-buffer depth and normals
+        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+        if (aoScale > 1)
+        {
+            aoResolved.bindOutput();
+            shaderSSAOUpsample.use();
+            shaderSSAOUpsample.setUniformMat4("inverseProjection", inverseProjection);
+            shaderSSAOUpsample.setUniformInt("aoScale", aoScale);
+            bindGBuffer(gBuffer, gBufferDepth);
+            glActiveTexture(GL_TEXTURE4);
+            aoBuffer->bindInput(0);
+            renderQuad();
+            FrameBuffer::unbind();
+        }
+        FrameBuffer& ao = aoScale > 1 ? aoResolved : *aoBuffer;
+
+        // 2d. tiled point lighting: cull the point lights per screen tile and shade them in one dispatch
+        // --------------------------------------------------------------------------------------------
+        if (pointLightsEnabled && tiledPointLighting && gBufferMode == GBufferRender::Final) {
+            pointLightTimer.start();
+            computeTiledLighting.use();
+            computeTiledLighting.setUniformMat4("view", view);
+            computeTiledLighting.setUniformMat4("inverseProjection", inverseProjection);
+            computeTiledLighting.setUniformMat4("inverseViewProjection", inverseViewProjection);
+            glm::vec3 eye = arcballCamera.eye();
+            computeTiledLighting.setUniformVec3f("viewPos", eye);
+            computeTiledLighting.setUniformFloat("lightIntensity", pointLightIntensity);
+            computeTiledLighting.setUniformFloat("glossiness", glossiness);
+            computeTiledLighting.setUniformBool("pointShadows", pointLightShadows);
+            computeTiledLighting.setUniformInt("shadowedPointLights", shadowedPointLights);
+            computeTiledLighting.setUniformFloat("penumbraSize", penumbraSize);
+            computeTiledLighting.setUniformFloat("shadowSaturation", shadowSaturation);
+            bindGBuffer(gBuffer, gBufferDepth);
+            glActiveTexture(GL_TEXTURE4);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, pointShadowSAT);
+            tiledLighting.shade(computeTiledLighting, matrixBuffer, colorSizeBuffer, totalLights);
+            pointLightTimer.stop();
         }
 
         // 3. lighting pass: calculate lighting by iterating over a screen filled quad pixel-by-pixel using the gbuffer's content and shadow map
@@ -785,23 +1648,48 @@ int main()
         if (gBufferMode == GBufferRender::Final)
         {
             pbrShader.use();
+            pbrShader.setUniformMat4("inverseViewProjection", inverseViewProjection);
             // bind all of our input textures
-            gBuffer.bindInput();
+            bindGBuffer(gBuffer, gBufferDepth);
 
             // bind depth texture
             glActiveTexture(GL_TEXTURE4);
             //sBuffer.bindTex(1);
             satBuffer.bindInput(1);
             glActiveTexture(GL_TEXTURE5);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-            glActiveTexture(GL_TEXTURE6);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
+            for (int i = 0; i < SH_COEFFICIENTS; ++i)
+            {
+                pbrShader.setUniformVec3f(cStringFormatA("irradianceSH[%d]", i), irradianceSH[i]);
+            }
             glActiveTexture(GL_TEXTURE7);
             glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
             glActiveTexture(GL_TEXTURE8);
-            aoBuffer.bindInput(0);
+            ao.bindInput(0);
             glActiveTexture(GL_TEXTURE9);
-            sBuffer.bindInput(0);
+            if (fusedMomentsActive) {
+                glBindTexture(GL_TEXTURE_2D, shadowDepthTexture);
+            }
+            else {
+                sBuffer.bindInput(0);
+            }
+            glActiveTexture(GL_TEXTURE10);
+            glBindTexture(GL_TEXTURE_2D, satFixed[0]);
+            glActiveTexture(GL_TEXTURE11);
+            glBindTexture(GL_TEXTURE_2D, satTiled);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, satColumnStrips);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, satRowStrips);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, satTileGrid);
+            shadowAtlas.bindLights(4);
+            glActiveTexture(GL_TEXTURE14);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, shadowAtlas.satTexture());
+            pbrShader.setUniformInt("shadowedLightCount", (int)atlasLightData.size());
+            if (cascadeCount > 1) {
+                glActiveTexture(GL_TEXTURE12);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, cascadeSATArray);
+                glActiveTexture(GL_TEXTURE13);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, cascadeMomentsArray);
+            }
 
             glm::vec3 lightPosition = arcballLight.eye();
             pbrShader.setUniformVec3f("gLight.Position", lightPosition);
@@ -811,40 +1699,53 @@ int main()
             glm::vec3 camPosition = arcballCamera.eye();
             pbrShader.setUniformVec3f("viewPos", camPosition);
             pbrShader.setUniformMat4("lightSpaceMatrix", lightSpaceMatrix);
-            pbrShader.setUniformInt("iblSamples", iblSamples);
+            pbrShader.setUniformInt("cascadeCount", cascadeCount);
+            for (int i = 0; i < cascadeCount; ++i)
+            {
+                pbrShader.setUniformMat4(cStringFormatA("cascadeMatrices[%d]", i), cascadeMatrices[i]);
+                pbrShader.setUniformFloat(cStringFormatA("cascadeSplits[%d]", i), cascadeSplits[i]);
+                pbrShader.setUniformFloat(cStringFormatA("cascadeFilterScale[%d]", i), cascadeFilterScale[i]);
+            }
+            pbrShader.setUniformFloat("cascadeBlend", cascadeBlend);
+            glm::vec3 viewDirection = arcballCamera.dir();
+            pbrShader.setUniformVec3f("viewDirection", viewDirection);
             pbrShader.setUniformFloat("shadowSaturation", shadowSaturation);
             pbrShader.setUniformFloat("PenumbraSize", penumbraSize);
             pbrShader.setUniformInt("lightSourceRadius", lightSourceRadius);
             pbrShader.setUniformFloat("zNear", zNear);
             pbrShader.setUniformFloat("zFar", zFar);
             pbrShader.setUniformBool("softSATVSM", softSATVSM);
+            pbrShader.setUniformInt("satFormat", satFormat);
+            pbrShader.setUniformBool("shadowMapIsDepth", fusedMomentsActive);
+            pbrShader.setUniformFloat("fixedPointScale", float(1u << fixedPointBits));
+            pbrShader.setUniformBool("tiledPointLights", pointLightsEnabled && tiledPointLighting);
+            glActiveTexture(GL_TEXTURE15);
+            glBindTexture(GL_TEXTURE_2D, tiledLighting.texture());
         }
         else if (gBufferMode == GBufferRender::Occlusion)
         {
             shaderSSAODebug.use();
             glActiveTexture(GL_TEXTURE0);
-            aoBuffer.bindInput(0);
+            ao.bindInput(0);
         }
         else // for G-Buffer debuging 
         {
             shaderGBufferDebug.use();
             shaderGBufferDebug.setUniformInt("gBufferMode", gBufferMode);
+            shaderGBufferDebug.setUniformMat4("inverseViewProjection", inverseViewProjection);
             // bind all of our input textures
-            gBuffer.bindInput();
+            bindGBuffer(gBuffer, gBufferDepth);
         }
         
         // finally render quad
         renderQuad();
 
-        static bool colorSizeBufferDirty = false;
-
         // 3.5 lighting pass: render point lights on top of main scene with additive blending and utilizing G-Buffer for lighting.
         // -----------------------------------------------------------------------------------------------------------------------
-        if (gBufferMode == GBufferRender::Final) {
-            // TODO: Disable the point lights for now
-            /*
+        if (gBufferMode == GBufferRender::Final && pointLightsEnabled && !tiledPointLighting) {
             shaderPointLightingPass.use();
-            gBuffer.bindInput();
+            bindGBuffer(gBuffer, gBufferDepth);
+            shaderPointLightingPass.setUniformMat4("inverseViewProjection", inverseViewProjection);
             shaderPointLightingPass.setUniformMat4("projection", projection);
             shaderPointLightingPass.setUniformMat4("view", view);
 
@@ -859,20 +1760,20 @@ int main()
             shaderPointLightingPass.setUniformVec3f("viewPos", camPosition);
             shaderPointLightingPass.setUniformFloat("lightIntensity", pointLightIntensity);
             shaderPointLightingPass.setUniformFloat("glossiness", glossiness);
+            shaderPointLightingPass.setUniformBool("pointShadows", pointLightShadows);
+            shaderPointLightingPass.setUniformInt("shadowedPointLights", shadowedPointLights);
+            shaderPointLightingPass.setUniformFloat("penumbraSize", penumbraSize);
+            shaderPointLightingPass.setUniformFloat("shadowSaturation", shadowSaturation);
+            glActiveTexture(GL_TEXTURE4);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, pointShadowSAT);
             glBindVertexArray(lightModel.meshes[0].VAO);
-            // don't update the color and size buffer every frame
-            if (colorSizeBufferDirty) {
-                glBindBuffer(GL_ARRAY_BUFFER, colorSizeBuffer);
-                glBufferData(GL_ARRAY_BUFFER, LIGHT_GRID_WIDTH * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT * sizeof(glm::vec4), &modelColorSizes[0], GL_STATIC_DRAW);
-            }
-            glDrawElementsInstanced(GL_TRIANGLES, lightModel.meshes[0].indices.size(), GL_UNSIGNED_INT, 0, totalLights);
+            glDrawElementsInstanced(GL_TRIANGLES, lightModel.meshes[0].indexCount, lightModel.meshes[0].indexType, 0, totalLights);
             glBindVertexArray(0);
 
             glDisable(GL_BLEND);
             glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
             glFrontFace(GL_CCW);
             glDisable(GL_CULL_FACE);
-            */
         }
 
         // render cubemap with depth testing enabled
@@ -907,7 +1808,7 @@ int main()
 
             glPolygonMode(GL_FRONT_AND_BACK, drawPointLightsWireframe ? GL_LINE : GL_FILL);
             glBindVertexArray(lightModel.meshes[0].VAO);
-            glDrawElementsInstanced(GL_TRIANGLES, lightModel.meshes[0].indices.size(), GL_UNSIGNED_INT, 0, totalLights);
+            glDrawElementsInstanced(GL_TRIANGLES, lightModel.meshes[0].indexCount, lightModel.meshes[0].indexType, 0, totalLights);
             glBindVertexArray(0);
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
@@ -941,7 +1842,7 @@ int main()
             /*shaderDebugCubemap.use();
             shaderDebugCubemap.setUniformMat4("transform", model);
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
             renderQuad();*/
         }
 
@@ -963,14 +1864,21 @@ int main()
                 ImGui::SliderFloat("Intensity scale", &shadowScalar, 0.1f, 20.0f);
                 ImGui::SliderFloat("Contrast", &shadowContrast, 0.1f, 10.0f);
                 ImGui::Checkbox("Bilateral Blur", &bilateralBlur);
+                const char* aoResolutions[] = { "Full", "Half", "Quarter" };
+                if (ImGui::Combo("Resolution", &aoResolution, aoResolutions, IM_ARRAYSIZE(aoResolutions))) {
+                    aoScale = 1 << aoResolution;
+                    aoBuffer.reset(createAOBuffer(aoScale));
+                }
             }
 
             if (ImGui::CollapsingHeader("IBL")) {
-                ImGui::SliderInt("Random samples", &iblSamples, 1, 100);
                 // list of cubemaps
                 const char* cubeMaps[] = { "Newport Loft", "Tropical Beach", "Alexs Apartment", "Malibu Overloop", "Tokyo BigSight", "Barcelona Rooftops", "Winter Forest", "Ueno Shrine" };
                 if (ImGui::Combo("Skybox", &CubemapSelection, cubeMaps, IM_ARRAYSIZE(cubeMaps))) {
-                    renderCubemap(CubemapSelection, equirectangularToCubemapShader, irradianceShader);
+                    hdrLoader.request(hdrCubemapPath(CubemapSelection), environmentCachePath(CubemapSelection));
+                }
+                if (hdrLoader.busy() || environmentBuildStep >= 0) {
+                    ImGui::Text("Loading skybox...");
                 }
             }
 
@@ -1007,13 +1915,23 @@ int main()
                 }
 
                 if (ImGui::CollapsingHeader("Point Lights")) {
+                    ImGui::Checkbox("Lighting pass", &pointLightsEnabled);
+                    ImGui::SameLine();
+                    ImGui::Checkbox("Tiled (compute)", &tiledPointLighting);
+                    if (ImGui::SliderInt("Grid width", &lightGridWidthSetting, 1, MAX_LIGHT_GRID_WIDTH)) {
+                        lightGridWidth = lightGridWidthSetting;
+                        totalLights = lightGridWidth * lightGridWidth * LIGHT_GRID_HEIGHT;
+                        configurePointLights(modelMatrices, modelColorSizes, pointLightRadius, pointLightSeparation, pointLightVerticalOffset);
+                        uploadPointLights(modelMatrices, modelColorSizes);
+                        shadowedPointLights = std::min(totalLights, MAX_SHADOWED_POINT_LIGHTS);
+                        pointShadowScheduler.resize(shadowedPointLights);
+                        pointLightCuller.resize(shadowedPointLights);
+                        pointLightPositions.resize(shadowedPointLights);
+                        pointLightCoverage.resize(shadowedPointLights);
+                    }
                     ImGui::SliderFloat("Intensity", &pointLightIntensity, 0.0f, 10.0f, "%.3f");
                     if (ImGui::SliderFloat("Radius", &pointLightRadius, 0.3f, 2.5f, "%.3f")) {
                         updatePointLights(modelMatrices, modelColorSizes, pointLightSeparation, pointLightVerticalOffset, pointLightRadius);
-                        colorSizeBufferDirty = true;
-                    }
-                    else {
-                        colorSizeBufferDirty = false;
                     }
                     if (ImGui::SliderFloat("Separation", &pointLightSeparation, 0.4f, 1.5f, "%.3f")) {
                         updatePointLights(modelMatrices, modelColorSizes, pointLightSeparation, pointLightVerticalOffset, pointLightRadius);
@@ -1021,6 +1939,14 @@ int main()
                     if (ImGui::SliderFloat("Vertical Offset", &pointLightVerticalOffset, -2.0f, 3.0f)) {
                         updatePointLights(modelMatrices, modelColorSizes, pointLightSeparation, pointLightVerticalOffset, pointLightRadius);
                     }
+                    ImGui::Checkbox("Point light shadows", &pointLightShadows);
+                    ImGui::SliderInt("Shadow updates / frame", &pointShadowBudget, 1, MAX_POINT_SHADOW_UPDATES);
+                    if (pointLightsEnabled && pointLightShadows) {
+                        ImGui::Text("Refreshed %i, stale %i of %i lights, %.3f ms", pointShadowsRefreshed, pointShadowScheduler.staleCount(), shadowedPointLights, pointShadowTimer.milliseconds());
+                    }
+                    if (pointLightsEnabled && tiledPointLighting) {
+                        ImGui::Text("Tiled lighting: %.3f ms", pointLightTimer.milliseconds());
+                    }
                 }
 
                 // Shadows
@@ -1030,10 +1956,84 @@ int main()
                     ImGui::SliderFloat("Penumbra", &penumbraSize, 0.5f, 10.0f, "%.4f");
                     ImGui::SliderInt("Light radius", &lightSourceRadius, 4, 40);
                     ImGui::Checkbox("Contact-hardening", &softSATVSM);
+                    // the fused scan writes the horizontal pass itself and always finishes with
+                    // ComputeSAT, so it takes the place of the selected backend
+                    bool fusedScan = fusedMoments && satFormat == SATFormat::Float && cascadeCount == 1 && SHADOW_MAP_SIZE <= SAT_BLOCK_SIZE;
+                    if (fusedScan) {
+                        ImGui::TextDisabled("SAT backend: %s (unused by the fused scan)", satBackends[satBackend]->name());
+                    }
+                    else if (ImGui::BeginCombo("SAT backend", satBackends[satBackend]->name())) {
+                        for (int i = 0; i < (int)satBackends.size(); ++i)
+                        {
+                            if (ImGui::Selectable(satBackends[i]->name(), satBackend == i)) {
+                                satBackend = i;
+                            }
+                        }
+                        ImGui::EndCombo();
+                    }
+                    if (SHADOW_MAP_SIZE <= SAT_BLOCK_SIZE) {
+                        ImGui::Checkbox("Fused depth-to-moments scan", &fusedMoments);
+                    }
+                    if (satFormat == SATFormat::Float) {
+                        ImGui::SliderInt("Cascades", &shadowCascades, 1, MAX_SHADOW_CASCADES);
+                        if (shadowCascades > 1) {
+                            ImGui::SliderFloat("Shadow distance", &shadowDistance, 5.0f, 150.0f, "%.1f");
+                            ImGui::SliderFloat("Split lambda", &cascadeSplitLambda, 0.0f, 1.0f, "%.2f");
+                            ImGui::SliderFloat("Cascade blend", &cascadeBlend, 0.0f, 0.5f, "%.2f");
+                        }
+                    }
+                    if (cascadeCount == 1) {
+                        ImGui::Checkbox("Fit light to visible receivers (SDSM)", &fitLightToView);
+                        if (fitLightToView) {
+                            ImGui::Text("Light box: %.2f x %.2f (fixed %.0f x %.0f)", 2.0f * fittedHalfSize, 2.0f * fittedHalfSize,
+                                2.0f * SHADOW_BOX_HALF_SIZE, 2.0f * SHADOW_BOX_HALF_SIZE);
+                        }
+                    }
+                    const char* satFormats[] = { "Float", "Fixed point", "Tiled" };
+                    ImGui::Combo("SAT format", &satFormat, satFormats, IM_ARRAYSIZE(satFormats));
+                    if (satFormat == SATFormat::FixedPoint) {
+                        ImGui::SliderInt("Fractional bits", &fixedPointBits, 8, 24);
+                        // a box sum of moments in [0, 1] has to fit into 32 bits
+                        ImGui::Text("Max filter width: %i texels", (int)std::sqrt(std::ldexp(1.0, 32 - fixedPointBits) - 1.0));
+                    }
+                    else if (satFormat == SATFormat::Tiled) {
+                        ImGui::Text("Tiles rebuilt: %i of %i", tiledSATTilesRebuilt, satTileCount * satTileCount);
+                    }
+                    else if (fusedMoments && SHADOW_MAP_SIZE <= SAT_BLOCK_SIZE) {
+                        // the moments never exist in memory, there is nothing to replay on the CPU
+                        ImGui::TextDisabled("Validation needs rasterized moments");
+                    }
+                    else if (!satBackends[satBackend]->matchesComputeShaderOrder()) {
+                        // different summation order, the CPU replay of ComputeSAT wouldn't match bit for bit
+                        ImGui::TextDisabled("Validation needs a compute scan backend");
+                    }
+                    else if (ImGui::Button("Validate SAT against CPU")) {
+                        validateSAT = true;
+                    }
+                    if (satMismatches >= 0) {
+                        ImGui::Text("SAT mismatches: %i (max error %g)", satMismatches, satMaxError);
+                    }
+                    ImGui::SliderInt("Shadow atlas lights", &atlasLightCount, 0, MAX_SHADOWED_LIGHTS);
+                    if (atlasLightCount > 0) {
+                        ImGui::Text("Atlas: %i of %i layers, %ix%i each", shadowAtlas.usedLayers(), MAX_SHADOWED_LIGHTS, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE);
+                    }
+                    ImGui::Checkbox("Cache shadow map", &shadowCaching);
+                    ImGui::Text("Shadow cache: %llu hits, %llu misses", shadowCache.hits(), shadowCache.misses());
+                    ImGui::SameLine();
+                    if (ImGui::SmallButton("Reset")) {
+                        shadowCache.resetCounters();
+                    }
+                    ImGui::Text("GPU time (%s):", glRenderer);
+                    ImGui::Text("  shadow map %.3f ms, SAT %.3f ms", shadowDepthTimer.milliseconds(), satTimer.milliseconds());
+                    ImGui::SameLine();
+                    if (ImGui::SmallButton("Reset##timers")) {
+                        shadowDepthTimer.reset();
+                        satTimer.reset();
+                    }
                 }
             }
             if (ImGui::CollapsingHeader("Debug")) {
-                const char* gBuffers[] = { "Final render", "Position (world)", "Normal (world)", "Diffuse", "Specular", "Occlusion"};
+                const char* gBuffers[] = { "Final render", "Position (world)", "Normal (world)", "Albedo", "Roughness / metallic", "Occlusion"};
                 ImGui::Combo("G-Buffer View", &gBufferMode, gBuffers, IM_ARRAYSIZE(gBuffers));
                 pbrShader.setUniformInt("gBufferMode", gBufferMode);
                 ImGui::Checkbox("Point lights volumes", &drawPointLights);
@@ -1047,7 +2047,13 @@ int main()
             //ImGui::ShowDemoWindow();
 
             ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
-            ImGui::Text("Point lights in scene: %i", LIGHT_GRID_WIDTH * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT);
+            ImGui::Text("Point lights in scene: %i", totalLights);
+            ImGui::Checkbox("Frustum culling", &frustumCulling);
+            ImGui::SameLine();
+            ImGui::TextDisabled("(%s)", FrustumCuller::simdPath());
+            // the shadow pass numbers are from the last time the shadow map was rendered
+            ImGui::Text("Camera: %zu of %zu instances culled", objectPositions.size() - receiversDrawn, objectPositions.size());
+            ImGui::Text("Light: %zu of %zu caster draws culled", castersTested - castersDrawn, castersTested);
             ImGui::End();
 
         }
@@ -1066,6 +2072,24 @@ int main()
     // ------------------------------------------------------------------------
     glDeleteVertexArrays(1, &planeVAO);
     glDeleteBuffers(1, &planeVBO);
+    glDeleteFramebuffers(1, &shadowDepthFBO);
+    glDeleteTextures(1, &shadowDepthTexture);
+    glDeleteTextures(1, &gBufferDepth);
+    shadowDepthTimer.release();
+    satTimer.release();
+    lightBounds.release();
+    shadowAtlas.release();
+    pointShadowStaging.release();
+    glDeleteTextures(1, &pointShadowSAT);
+    glDeleteTextures(1, &cascadeMomentsArray);
+    glDeleteTextures(1, &cascadeSATArray);
+    pointShadowTimer.release();
+    tiledLighting.release();
+    depthPyramid.release();
+    hdrLoader.release();
+    pointLightTimer.release();
+    for (SATBackend* backend : satBackends)
+        backend->release();
 
     glfwTerminate();
     return 0;
@@ -1076,16 +2100,18 @@ int main()
 void configurePointLights(std::vector<glm::mat4>& modelMatrices, std::vector<glm::vec4>& modelColorSizes, float radius, float separation, float yOffset)
 {
     srand(glfwGetTime());
+    modelMatrices.clear();
+    modelColorSizes.clear();
     // add some uniformly spaced point lights
-    for (unsigned int lightIndexX = 0; lightIndexX < LIGHT_GRID_WIDTH; lightIndexX++)
+    for (unsigned int lightIndexX = 0; lightIndexX < lightGridWidth; lightIndexX++)
     {
-        for (unsigned int lightIndexZ = 0; lightIndexZ < LIGHT_GRID_WIDTH; lightIndexZ++)
+        for (unsigned int lightIndexZ = 0; lightIndexZ < lightGridWidth; lightIndexZ++)
         {
             for (unsigned int lightIndexY = 0; lightIndexY < LIGHT_GRID_HEIGHT; lightIndexY++)
             {
                 float diameter = 2.0f * radius;
-                float xPos = (lightIndexX - (LIGHT_GRID_WIDTH - 1.0f) / 2.0f) * (diameter * separation);
-                float zPos = (lightIndexZ - (LIGHT_GRID_WIDTH - 1.0f) / 2.0f) * (diameter * separation);
+                float xPos = (lightIndexX - (lightGridWidth - 1.0f) / 2.0f) * (diameter * separation);
+                float zPos = (lightIndexZ - (lightGridWidth - 1.0f) / 2.0f) * (diameter * separation);
                 float yPos = (lightIndexY - (LIGHT_GRID_HEIGHT - 1.0f) / 2.0f) * (diameter * separation) + yOffset;
                 double angle = double(rand()) * 2.0 * glm::pi<float>() / (double(RAND_MAX));
                 double length = double(rand()) * 0.5 / (double(RAND_MAX));
@@ -1098,7 +2124,7 @@ void configurePointLights(std::vector<glm::mat4>& modelMatrices, std::vector<glm
                 float gColor = ((rand() % 100) / 200.0f) + 0.5; // between 0.5 and 1.0
                 float bColor = ((rand() % 100) / 200.0f) + 0.5; // between 0.5 and 1.0
 
-                int curLight = lightIndexX * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT + lightIndexZ * LIGHT_GRID_HEIGHT + lightIndexY;
+                int curLight = lightIndexX * lightGridWidth * LIGHT_GRID_HEIGHT + lightIndexZ * LIGHT_GRID_HEIGHT + lightIndexY;
                 glm::mat4 model = glm::mat4(1.0f);
                 model = glm::translate(model, glm::vec3(xPos, yPos, zPos));
                 // now add to list of matrices
@@ -1115,16 +2141,16 @@ void updatePointLights(std::vector<glm::mat4>& modelMatrices, std::vector<glm::v
         return;
     }
     // add some uniformly spaced point lights
-    for (unsigned int lightIndexX = 0; lightIndexX < LIGHT_GRID_WIDTH; lightIndexX++)
+    for (unsigned int lightIndexX = 0; lightIndexX < lightGridWidth; lightIndexX++)
     {
-        for (unsigned int lightIndexZ = 0; lightIndexZ < LIGHT_GRID_WIDTH; lightIndexZ++)
+        for (unsigned int lightIndexZ = 0; lightIndexZ < lightGridWidth; lightIndexZ++)
         {
             for (unsigned int lightIndexY = 0; lightIndexY < LIGHT_GRID_HEIGHT; lightIndexY++)
             {
-                int curLight = lightIndexX * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT + lightIndexZ * LIGHT_GRID_HEIGHT + lightIndexY;
+                int curLight = lightIndexX * lightGridWidth * LIGHT_GRID_HEIGHT + lightIndexZ * LIGHT_GRID_HEIGHT + lightIndexY;
                 float diameter = 2.0f * INITIAL_POINT_LIGHT_RADIUS;
-                float xPos = (lightIndexX - (LIGHT_GRID_WIDTH - 1.0f) / 2.0f) * (diameter * separation);
-                float zPos = (lightIndexZ - (LIGHT_GRID_WIDTH - 1.0f) / 2.0f) * (diameter * separation);
+                float xPos = (lightIndexX - (lightGridWidth - 1.0f) / 2.0f) * (diameter * separation);
+                float zPos = (lightIndexZ - (lightGridWidth - 1.0f) / 2.0f) * (diameter * separation);
                 float yPos = (lightIndexY - (LIGHT_GRID_HEIGHT - 1.0f) / 2.0f) * (diameter * separation);
                 
                 // modify matrix translation
@@ -1134,9 +2160,17 @@ void updatePointLights(std::vector<glm::mat4>& modelMatrices, std::vector<glm::v
         }
     }
 
-    // update the instance matrix buffer
+    uploadPointLights(modelMatrices, modelColorSizes);
+}
+
+// instance buffers of the light volumes, also read by the tiled lighting pass
+// -------------------------------------------------------------------------
+void uploadPointLights(const std::vector<glm::mat4>& modelMatrices, const std::vector<glm::vec4>& modelColorSizes)
+{
     glBindBuffer(GL_ARRAY_BUFFER, matrixBuffer);
-    glBufferData(GL_ARRAY_BUFFER, LIGHT_GRID_WIDTH * LIGHT_GRID_WIDTH * LIGHT_GRID_HEIGHT * sizeof(glm::mat4), &modelMatrices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, modelMatrices.size() * sizeof(glm::mat4), &modelMatrices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, colorSizeBuffer);
+    glBufferData(GL_ARRAY_BUFFER, modelColorSizes.size() * sizeof(glm::vec4), &modelColorSizes[0], GL_STATIC_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
@@ -1394,67 +2428,259 @@ unsigned int loadTexture(char const * path, bool gammaCorrection)
     return textureID;
 }
 
-void renderCubemap(int cubemap, Shader& equirectangularToCubemapShader, Shader& irradianceShader) {
-
-    static const std::string hdrCubemaps[] = {
-        PATH + "/OpenGL/images/newport_loft.hdr",
-        PATH + "/OpenGL/images/tropical_beach.hdr",
-        PATH + "/OpenGL/images/alexs_apartment.hdr",
-        PATH + "/OpenGL/images/malibu_overlook.hdr",
-        PATH + "/OpenGL/images/tokyo_bigsight.hdr",
-        PATH + "/OpenGL/images/barcelona_rooftops.hdr",
-        PATH + "/OpenGL/images/winter_forest.hdr",
-        PATH + "/OpenGL/images/ueno_shrine.hdr"
-    };
-
-    int width, height, nrComponents;
-    float *data = stbi_loadf(hdrCubemaps[cubemap].c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+// splits the view frustum between nearPlane and shadowDistance into cascadeCount slices and fits
+// an orthographic light box around the bounding sphere of each slice; the sphere keeps the box
+// size constant under camera rotation and the box is moved in whole texels, so the cascades
+// don't shimmer
+// --------------------------------------------------------------------------------------------
+void fitShadowCascades(const glm::mat4& cameraView, float fovY, float aspect, float nearPlane, float shadowDistance, float splitLambda,
+    const glm::mat4& lightView, int cascadeCount, glm::mat4* cascadeMatrices, float* cascadeSplits, float* cascadeFilterScale)
+{
+    glm::mat4 inverseView = glm::inverse(cameraView);
+    float tanY = std::tan(0.5f * fovY);
+    float tanX = tanY * aspect;
+    float sliceNear = nearPlane;
+    for (int cascade = 0; cascade < cascadeCount; ++cascade)
     {
-        if (hdrTexture == 0) {
-            glGenTextures(1, &hdrTexture);
+        // blend of the logarithmic and the uniform split scheme
+        float p = float(cascade + 1) / float(cascadeCount);
+        float logSplit = nearPlane * std::pow(shadowDistance / nearPlane, p);
+        float uniformSplit = nearPlane + (shadowDistance - nearPlane) * p;
+        float sliceFar = glm::mix(uniformSplit, logSplit, splitLambda);
+
+        glm::vec3 corners[8];
+        glm::vec3 center(0.0f);
+        for (int i = 0; i < 8; ++i)
+        {
+            float depth = (i & 4) ? sliceFar : sliceNear;
+            glm::vec4 viewCorner((i & 1 ? 1.0f : -1.0f) * tanX * depth, (i & 2 ? 1.0f : -1.0f) * tanY * depth, -depth, 1.0f);
+            corners[i] = glm::vec3(inverseView * viewCorner);
+            center += corners[i] / 8.0f;
         }
-        glBindTexture(GL_TEXTURE_2D, hdrTexture);
-        // load a floating point HDR texture data
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, data);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
+        float radius = 0.0f;
+        for (int i = 0; i < 8; ++i)
+            radius = std::max(radius, glm::length(corners[i] - center));
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+        float texelSize = 2.0f * radius / float(SHADOW_MAP_SIZE);
+        lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+        lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+
+        // the depth range covers the slice sphere and reaches CASCADE_CASTER_MARGIN further toward
+        // the light (the light looks down -z), so casters outside the slice still throw shadows into it
+        float lightNear = -(lightCenter.z + radius + CASCADE_CASTER_MARGIN);
+        float lightFar = -(lightCenter.z - radius);
+        glm::mat4 lightProjection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius, lightNear, lightFar);
+        cascadeMatrices[cascade] = lightProjection * lightView;
+        cascadeSplits[cascade] = sliceFar;
+        cascadeFilterScale[cascade] = SHADOW_BOX_HALF_SIZE / radius;
+        sliceNear = sliceFar;
     }
-    else
+}
+
+// grows the texel rectangle [rectMin, rectMax] by the part of the shadow map a bounding box covers
+// ------------------------------------------------------------------------------------------------
+void addShadowFootprint(glm::ivec2& rectMin, glm::ivec2& rectMax, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& lightModelMatrix)
+{
+    glm::vec2 footprintMin(std::numeric_limits<float>::max());
+    glm::vec2 footprintMax(-std::numeric_limits<float>::max());
+    for (int i = 0; i < 8; ++i)
     {
-        std::cout << "Failed to load HDR image." << std::endl;
+        glm::vec3 corner((i & 1) ? boundsMax.x : boundsMin.x, (i & 2) ? boundsMax.y : boundsMin.y, (i & 4) ? boundsMax.z : boundsMin.z);
+        glm::vec4 clip = lightModelMatrix * glm::vec4(corner, 1.0f);
+        glm::vec2 texel = (glm::vec2(clip) / clip.w * 0.5f + 0.5f) * float(SHADOW_MAP_SIZE);
+        footprintMin = glm::min(footprintMin, texel);
+        footprintMax = glm::max(footprintMax, texel);
     }
+    // one texel of margin for the depth derivatives varianceShadowMap.glsl adds to the moments
+    glm::ivec2 texelMin = glm::max(glm::ivec2(glm::floor(footprintMin)) - 1, glm::ivec2(0));
+    glm::ivec2 texelMax = glm::min(glm::ivec2(glm::ceil(footprintMax)) + 1, glm::ivec2((int)SHADOW_MAP_SIZE - 1));
+    if (texelMin.x > texelMax.x || texelMin.y > texelMax.y) {
+        // outside of the shadow map
+        return;
+    }
+    rectMin = glm::min(rectMin, texelMin);
+    rectMax = glm::max(rectMax, texelMax);
+}
 
-    // pbr: setup cubemap to render to and attach to framebuffer
-    // ---------------------------------------------------------
-    if (envCubemap == 0) {
-        glGenTextures(1, &envCubemap);
+// frustum culling that can be switched off; returns the number of visible instances
+// ---------------------------------------------------------------------------------
+std::size_t cullInstances(const FrustumCuller& culler, bool enabled, const glm::mat4& viewProjection, std::vector<unsigned char>& visible)
+{
+    if (!enabled) {
+        visible.assign(culler.size(), 1);
+        return culler.size();
     }
-    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 9);
-    for (unsigned int i = 0; i < 6; ++i)
+    return culler.cull(viewProjection, visible);
+}
+
+// G-buffer attachments to texture units 0 - 2, its depth texture to unit 3
+// ----------------------------------------------------------------------
+void bindGBuffer(FrameBuffer& gBuffer, unsigned int depthTexture)
+{
+    gBuffer.bindInput();
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+}
+
+// single channel SSAO target and blur scratch at 1 / aoScale of the screen resolution
+// ----------------------------------------------------------------------------------
+FrameBuffer* createAOBuffer(int aoScale)
+{
+    FrameBuffer* aoBuffer = new FrameBuffer((SCR_WIDTH + aoScale - 1) / aoScale, (SCR_HEIGHT + aoScale - 1) / aoScale);
+    aoBuffer->attachTexture(GL_R16F, GL_NEAREST);
+    aoBuffer->attachTexture(GL_R16F, GL_NEAREST);
+    aoBuffer->bindOutput();                         // calls glDrawBuffers[i] for all attached textures
+    aoBuffer->check();
+    FrameBuffer::unbind();                          // unbind framebuffer for now
+    return aoBuffer;
+}
+
+// RG32F array with a layer for each cascade after the first, zero outside like the single map
+// ---------------------------------------------------------------------------------------------
+unsigned int createCascadeArray()
+{
+    unsigned int cascadeArray;
+    glGenTextures(1, &cascadeArray);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, cascadeArray);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RG32F, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, MAX_SHADOW_CASCADES - 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    float borderColor[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return cascadeArray;
+}
+
+// copies a FrameBuffer attachment into one layer of a cascade array
+// -----------------------------------------------------------------
+void copyToCascadeLayer(FrameBuffer& frameBuffer, int attachment, unsigned int cascadeArray, int layer, int width, int height)
+{
+    GLint texture;
+    glActiveTexture(GL_TEXTURE0);
+    frameBuffer.bindInput(attachment);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    glCopyImageSubData(texture, GL_TEXTURE_2D, 0, 0, 0, 0, cascadeArray, GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1);
+}
+
+// light matrix and lighting pass data of a shadow atlas light
+// -----------------------------------------------------------
+ShadowedLightGPU shadowedLightData(const AtlasLight& light)
+{
+    glm::vec3 direction = glm::normalize(light.target - light.position);
+    glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 lightView = glm::lookAt(light.position, light.target, up);
+
+    ShadowedLightGPU data;
+    glm::mat4 lightProjection;
+    if (light.coneAngle > 0.0f) {
+        lightProjection = glm::perspective(glm::radians(2.0f * light.coneAngle), 1.0f, 0.5f, 25.0f);
+        data.position = glm::vec4(light.position, 1.0f);
+        data.direction = glm::vec4(direction, std::cos(glm::radians(light.coneAngle)));
+    }
+    else {
+        lightProjection = glm::ortho(-SHADOW_BOX_HALF_SIZE, SHADOW_BOX_HALF_SIZE, -SHADOW_BOX_HALF_SIZE, SHADOW_BOX_HALF_SIZE, 1.0f, 25.0f);
+        data.position = glm::vec4(light.position, 0.0f);
+        data.direction = glm::vec4(direction, -1.0f);
+    }
+    data.lightSpaceMatrix = lightProjection * lightView;
+    data.color = glm::vec4(light.color * light.intensity, float(light.layer));
+    return data;
+}
+
+static const char* hdrCubemaps[] = {
+    "newport_loft",
+    "tropical_beach",
+    "alexs_apartment",
+    "malibu_overlook",
+    "tokyo_bigsight",
+    "barcelona_rooftops",
+    "winter_forest",
+    "ueno_shrine"
+};
+
+std::string hdrCubemapPath(int cubemap)
+{
+    return PATH + "/OpenGL/images/" + hdrCubemaps[cubemap] + ".hdr";
+}
+
+std::string environmentCachePath(int cubemap)
+{
+    return PATH + "/OpenGL/cache/" + hdrCubemaps[cubemap] + ".envcache";
+}
+
+// what an environment cache file holds besides the SH irradiance: the cubemap and prefiltered map
+// ----------------------------------------------------------------------------------------------
+std::vector<CachedTexture> environmentCacheTextures(unsigned int cubemap, unsigned int prefilter)
+{
+    return {
+        { cubemap, GL_TEXTURE_CUBE_MAP, GL_RGB, 3, (int)ENV_CUBEMAP_SIZE, (int)ENV_MIP_LEVELS },
+        { prefilter, GL_TEXTURE_CUBE_MAP, GL_RGB, 3, (int)PREFILTER_CUBEMAP_SIZE, (int)PREFILTER_MIP_LEVELS }
+    };
+}
+
+// make the pending skybox the current one
+// ---------------------------------------
+void swapEnvironmentMaps()
+{
+    std::swap(envCubemap, pendingEnvCubemap);
+    std::swap(prefilterMap, pendingPrefilterMap);
+    std::copy(pendingIrradianceSH, pendingIrradianceSH + SH_COEFFICIENTS, irradianceSH);
+}
+
+// bake the current skybox under the key and cache file of the image it was built from; the
+// loader reads it back in the background and writes the file on its thread
+// ------------------------------------------------------------------------------------------
+void saveEnvironmentCache(HDRLoader& hdrLoader, uint64_t key, const std::string& cachePath)
+{
+    float payload[SH_COEFFICIENTS * 3];
+    for (int i = 0; i < SH_COEFFICIENTS; ++i)
     {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, ENV_CUBEMAP_SIZE, ENV_CUBEMAP_SIZE, 0, GL_RGB, GL_FLOAT, nullptr);
+        payload[3 * i] = irradianceSH[i].x;
+        payload[3 * i + 1] = irradianceSH[i].y;
+        payload[3 * i + 2] = irradianceSH[i].z;
     }
+    hdrLoader.save(key, cachePath, environmentCacheTextures(envCubemap, prefilterMap), payload, SH_COEFFICIENTS * 3);
+}
+
+// environment cubemap and prefiltered specular cubemap storage, see buildEnvironmentStep()
+// --------------------------------------------------------------------------------------
+void createEnvironmentMaps(unsigned int& cubemap, unsigned int& prefilter)
+{
+    glGenTextures(1, &cubemap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, ENV_MIP_LEVELS, GL_RGB16F, ENV_CUBEMAP_SIZE, ENV_CUBEMAP_SIZE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // generate mipmaps for the cubemap so OpenGL automatically allocates the required memory.
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
+    glGenTextures(1, &prefilter);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, prefilter);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, PREFILTER_MIP_LEVELS, GL_RGB16F, PREFILTER_CUBEMAP_SIZE, PREFILTER_CUBEMAP_SIZE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
 
+// One pass of building the IBL cubemaps from hdrTexture, so a skybox switch is spread over
+// ENVIRONMENT_BUILD_STEPS frames: steps 0 - 8 render one mip level of the environment
+// cubemap straight from the equirectangular map, the rest prefilter one face of one mip
+// level of the specular map. Returns true after the last step.
+// ------------------------------------------------------------------------------------------
+bool buildEnvironmentStep(int step, unsigned int cubemap, unsigned int prefilter, Shader& equirectangularToCubemapShader, Shader& prefilterShader)
+{
     // pbr: set up projection and view matrices for capturing data onto the 6 cubemap face directions
     // ----------------------------------------------------------------------------------------------
-    glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
-    glm::mat4 captureViews[] =
+    static const glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
+    static const glm::mat4 captureViews[] =
     {
         glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
         glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
@@ -1464,72 +2690,51 @@ void renderCubemap(int cubemap, Shader& equirectangularToCubemapShader, Shader&
         glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f))
     };
 
-    // pbr: convert HDR equirectangular environment map to cubemap equivalent and generate mip levels
-    // ----------------------------------------------------------------------
-    equirectangularToCubemapShader.use();
-    equirectangularToCubemapShader.setUniformInt("equirectangularMap", 0);
-    equirectangularToCubemapShader.setUniformMat4("projection", captureProjection);
-
     glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    unsigned int maxMipLevels = 9;
-    for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
-    {
-        // resize framebuffer according to mip-level size.
-        unsigned int mipWidth = ENV_CUBEMAP_SIZE * std::pow(0.5, mip);
-        unsigned int mipHeight = ENV_CUBEMAP_SIZE * std::pow(0.5, mip);
-        glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
-        glViewport(0, 0, mipWidth, mipHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
+    glActiveTexture(GL_TEXTURE0);
+    if (step < (int)ENV_MIP_LEVELS) {
+        // pbr: convert HDR equirectangular environment map to one mip level of the cubemap
+        // --------------------------------------------------------------------------------
+        unsigned int mip = step;
+        unsigned int mipSize = ENV_CUBEMAP_SIZE >> mip;
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipSize, mipSize);
+        glViewport(0, 0, mipSize, mipSize);
+        equirectangularToCubemapShader.use();
+        equirectangularToCubemapShader.setUniformInt("equirectangularMap", 0);
+        equirectangularToCubemapShader.setUniformMat4("projection", captureProjection);
+        glBindTexture(GL_TEXTURE_2D, hdrTexture);
         for (unsigned int i = 0; i < 6; ++i)
         {
             equirectangularToCubemapShader.setUniformMat4("view", captureViews[i]);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, envCubemap, mip);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, cubemap, mip);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
             renderCube();
         }
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    // pbr: create an irradiance cubemap, and re-scale capture FBO to irradiance scale.
-    // --------------------------------------------------------------------------------
-    if (irradianceMap == 0) {
-        glGenTextures(1, &irradianceMap);
-    }
-    glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, IRRADIANCE_CUBEMAP_SIZE, IRRADIANCE_CUBEMAP_SIZE, 0, GL_RGB, GL_FLOAT, nullptr);
-    }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, IRRADIANCE_CUBEMAP_SIZE, IRRADIANCE_CUBEMAP_SIZE);
-
-    // pbr: solve diffuse integral by convolution to create an irradiance (cube)map.
-    // -----------------------------------------------------------------------------
-    irradianceShader.use();
-    irradianceShader.setUniformInt("environmentMap", 0);
-    irradianceShader.setUniformMat4("projection", captureProjection);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-    // set the viewport to match the cubemap size
-    glViewport(0, 0, IRRADIANCE_CUBEMAP_SIZE, IRRADIANCE_CUBEMAP_SIZE);
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        irradianceShader.setUniformMat4("view", captureViews[i]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, irradianceMap, 0);
+    else {
+        // pbr: GGX importance sampling convolution of one face and mip level of the specular map
+        // --------------------------------------------------------------------------------------
+        unsigned int mip = (step - ENV_MIP_LEVELS) / 6;
+        unsigned int face = (step - ENV_MIP_LEVELS) % 6;
+        unsigned int mipSize = PREFILTER_CUBEMAP_SIZE >> mip;
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipSize, mipSize);
+        glViewport(0, 0, mipSize, mipSize);
+        prefilterShader.use();
+        prefilterShader.setUniformInt("environmentMap", 0);
+        prefilterShader.setUniformFloat("resolution", float(ENV_CUBEMAP_SIZE));
+        prefilterShader.setUniformMat4("projection", captureProjection);
+        prefilterShader.setUniformFloat("roughness", float(mip) / float(PREFILTER_MIP_LEVELS - 1));
+        prefilterShader.setUniformMat4("view", captureViews[face]);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, prefilter, mip);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         renderCube();
     }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
+    return step == ENVIRONMENT_BUILD_STEPS - 1;
 }
-
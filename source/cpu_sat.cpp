@@ -0,0 +1,289 @@
+#include "cpu_sat.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <new>
+#include <vector>
+
+#if defined(__AVX__)
+#define CPU_SAT_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPU_SAT_SSE
+#include <emmintrin.h>
+#endif
+
+// floats per RG32F texel
+static const int TEXEL = 2;
+// rows scanned per band, also the edge of the tiles the band is transposed in
+static const int BLOCK = 16;
+
+// A texel is 64 bits, so the SIMD code moves texels around with the double-precision
+// shuffles and only does the arithmetic on floats.
+
+// dst[i] = src[0] + ... + src[i], summed left to right
+// note: the SIMD paths add neighbouring texels before the running sum, so their rounding can
+// differ from the scalar path in the last bit; use ScanOrder::ComputeShader for exact results
+static void scanRowSequential(const float* src, float* dst, int width)
+{
+    int x = 0;
+    float sum[TEXEL] = { 0.0f, 0.0f };
+#if defined(CPU_SAT_AVX)
+    const __m256d zero = _mm256_setzero_pd();
+    __m256 carry = _mm256_setzero_ps();
+    for (; x + 4 <= width; x += 4)
+    {
+        __m256 v = _mm256_loadu_ps(src + x * TEXEL);
+        // [t0, t1 | t2, t3] + [0, t0 | 0, t2] = [t0, t0 + t1 | t2, t2 + t3]
+        v = _mm256_add_ps(v, _mm256_castpd_ps(_mm256_shuffle_pd(zero, _mm256_castps_pd(v), 0x0)));
+        // add the last texel of the lower lane to the whole upper lane
+        __m256d low = _mm256_permute2f128_pd(_mm256_castps_pd(v), _mm256_castps_pd(v), 0x08);
+        v = _mm256_add_ps(v, _mm256_castpd_ps(_mm256_permute_pd(low, 0xF)));
+        v = _mm256_add_ps(v, carry);
+        _mm256_storeu_ps(dst + x * TEXEL, v);
+        // broadcast the last texel as the carry for the next four
+        __m256d high = _mm256_permute2f128_pd(_mm256_castps_pd(v), _mm256_castps_pd(v), 0x11);
+        carry = _mm256_castpd_ps(_mm256_permute_pd(high, 0xF));
+    }
+    _mm_storel_pi((__m64*)sum, _mm256_castps256_ps128(carry));
+#elif defined(CPU_SAT_SSE)
+    const __m128d zero = _mm_setzero_pd();
+    __m128 carry = _mm_setzero_ps();
+    for (; x + 2 <= width; x += 2)
+    {
+        __m128 v = _mm_loadu_ps(src + x * TEXEL);
+        // [t0, t1] + [0, t0] = [t0, t0 + t1]
+        v = _mm_add_ps(v, _mm_castpd_ps(_mm_shuffle_pd(zero, _mm_castps_pd(v), 0x0)));
+        v = _mm_add_ps(v, carry);
+        _mm_storeu_ps(dst + x * TEXEL, v);
+        carry = _mm_castpd_ps(_mm_unpackhi_pd(_mm_castps_pd(v), _mm_castps_pd(v)));
+    }
+    _mm_storel_pi((__m64*)sum, carry);
+#endif
+    for (; x < width; ++x)
+    {
+        for (int c = 0; c < TEXEL; ++c) {
+            sum[c] += src[x * TEXEL + c];
+            dst[x * TEXEL + c] = sum[c];
+        }
+    }
+}
+
+// adds one texel to count consecutive texels
+static void addCarry(float* dst, int count, const float* carryTexel)
+{
+    int i = 0;
+#if defined(CPU_SAT_AVX)
+    __m256 carry = _mm256_castpd_ps(_mm256_broadcast_sd((const double*)carryTexel));
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_ps(dst + i * TEXEL, _mm256_add_ps(_mm256_loadu_ps(dst + i * TEXEL), carry));
+    }
+    if (i + 2 <= count) {
+        _mm_storeu_ps(dst + i * TEXEL, _mm_add_ps(_mm_loadu_ps(dst + i * TEXEL), _mm256_castps256_ps128(carry)));
+        i += 2;
+    }
+#elif defined(CPU_SAT_SSE)
+    __m128 carry = _mm_castpd_ps(_mm_load1_pd((const double*)carryTexel));
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_ps(dst + i * TEXEL, _mm_add_ps(_mm_loadu_ps(dst + i * TEXEL), carry));
+    }
+#endif
+    for (; i < count; ++i) {
+        for (int c = 0; c < TEXEL; ++c) {
+            dst[i * TEXEL + c] += carryTexel[c];
+        }
+    }
+}
+
+// Replays the shared memory scan of computeSAT.glsl: at step s the upper half of every block
+// of 2^(s+1) texels gets the last texel of the lower half added to it. Rows longer than one
+// workgroup block then get the running total of the previous blocks added, like ScanBlockSums
+// and AddBlockSums do. Float addition is commutative, so doing the same adds in the same
+// order gives the same bits as the GPU.
+static void scanRowComputeShader(const float* src, float* dst, int width)
+{
+    const int blockSize = (int)SAT_BLOCK_SIZE;
+    std::memcpy(dst, src, (size_t)width * TEXEL * sizeof(float));
+    for (int blockStart = 0; blockStart < width; blockStart += blockSize)
+    {
+        int blockWidth = std::min(blockSize, width - blockStart);
+        float* block = dst + (size_t)blockStart * TEXEL;
+        for (int half = 1; half < blockWidth; half <<= 1)
+        {
+            for (int start = 0; start + half < blockWidth; start += 2 * half)
+            {
+                int end = std::min(start + 2 * half, blockWidth);
+                addCarry(block + (size_t)(start + half) * TEXEL, end - start - half, block + (size_t)(start + half - 1) * TEXEL);
+            }
+        }
+    }
+
+    // a block's local total is saved before its own offset gets added to it
+    float offset[TEXEL] = { 0.0f, 0.0f };
+    float total[TEXEL];
+    if (width > blockSize) {
+        std::memcpy(total, dst + (size_t)(blockSize - 1) * TEXEL, sizeof(total));
+    }
+    for (int blockStart = blockSize; blockStart < width; blockStart += blockSize)
+    {
+        for (int c = 0; c < TEXEL; ++c) {
+            offset[c] += total[c];
+        }
+        int blockWidth = std::min(blockSize, width - blockStart);
+        if (blockStart + blockWidth < width) {
+            std::memcpy(total, dst + (size_t)(blockStart + blockWidth - 1) * TEXEL, sizeof(total));
+        }
+        addCarry(dst + (size_t)blockStart * TEXEL, blockWidth, offset);
+    }
+}
+
+// dst[c][r] = src[r][c] for a rows x cols tile, strides are in texels
+static void transposeTile(const float* src, int srcStride, float* dst, int dstStride, int rows, int cols)
+{
+    int c = 0;
+#if defined(CPU_SAT_AVX) || defined(CPU_SAT_SSE)
+    // 2x2 texel blocks: two rows of two texels each are one pair of 128-bit registers
+    if ((rows & 1) == 0)
+    {
+        for (; c + 2 <= cols; c += 2)
+        {
+            for (int r = 0; r < rows; r += 2)
+            {
+                __m128d a = _mm_loadu_pd((const double*)(src + ((size_t)r * srcStride + c) * TEXEL));
+                __m128d b = _mm_loadu_pd((const double*)(src + ((size_t)(r + 1) * srcStride + c) * TEXEL));
+                _mm_storeu_pd((double*)(dst + ((size_t)c * dstStride + r) * TEXEL), _mm_unpacklo_pd(a, b));
+                _mm_storeu_pd((double*)(dst + ((size_t)(c + 1) * dstStride + r) * TEXEL), _mm_unpackhi_pd(a, b));
+            }
+        }
+    }
+#endif
+    for (; c < cols; ++c)
+    {
+        for (int r = 0; r < rows; ++r)
+        {
+            const float* in = src + ((size_t)r * srcStride + c) * TEXEL;
+            float* out = dst + ((size_t)c * dstStride + r) * TEXEL;
+            std::memcpy(out, in, TEXEL * sizeof(float));
+        }
+    }
+}
+
+CpuSAT::CpuSAT(unsigned int threadCount)
+    : pool(threadCount)
+{
+}
+
+unsigned int CpuSAT::threadCount() const
+{
+    return pool.size();
+}
+
+const char* CpuSAT::simdPath()
+{
+#if defined(CPU_SAT_AVX)
+    return "AVX";
+#elif defined(CPU_SAT_SSE)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+void CpuSAT::generate(const float* moments, float* scratch, float* sat, int width, int height, ScanOrder order)
+{
+    // same as the two ComputeSAT dispatches: each pass scans rows and writes columns
+    scanTransposed(moments, scratch, width, height, order);
+    scanTransposed(scratch, sat, height, width, order);
+}
+
+void CpuSAT::scanTransposed(const float* src, float* dst, int width, int height, ScanOrder order)
+{
+    int bands = (height + BLOCK - 1) / BLOCK;
+    pool.parallelFor(bands, 1, [=](int first, int last) {
+        // each thread keeps its band of scanned rows around between calls
+        thread_local std::vector<float> band;
+        band.resize((size_t)BLOCK * width * TEXEL);
+
+        for (int b = first; b < last; ++b)
+        {
+            int y0 = b * BLOCK;
+            int rows = std::min(BLOCK, height - y0);
+            for (int r = 0; r < rows; ++r)
+            {
+                const float* in = src + (size_t)(y0 + r) * width * TEXEL;
+                float* out = band.data() + (size_t)r * width * TEXEL;
+                if (order == ScanOrder::ComputeShader) {
+                    scanRowComputeShader(in, out, width);
+                }
+                else {
+                    scanRowSequential(in, out, width);
+                }
+            }
+            // write the band out one BLOCK x BLOCK tile at a time so that both the reads
+            // from the band and the writes to the transposed rows stay in cache
+            for (int x0 = 0; x0 < width; x0 += BLOCK)
+            {
+                int cols = std::min(BLOCK, width - x0);
+                transposeTile(band.data() + (size_t)x0 * TEXEL, width, dst + ((size_t)x0 * height + y0) * TEXEL, height, rows, cols);
+            }
+        }
+    });
+}
+
+void benchmarkCpuSAT(std::ostream& out)
+{
+    CpuSAT cpuSAT;
+    out << "CPU SAT benchmark: " << cpuSAT.threadCount() << " threads, " << CpuSAT::simdPath() << std::endl;
+    out << std::fixed << std::setprecision(2);
+
+    for (int size = 512; size <= 8192; size *= 2)
+    {
+        size_t texels = (size_t)size * size;
+        std::vector<float> moments, scratch, sat;
+        try {
+            moments.resize(texels * TEXEL);
+            scratch.resize(texels * TEXEL);
+            sat.resize(texels * TEXEL);
+        }
+        catch (const std::bad_alloc&) {
+            out << std::setw(5) << size << "^2  skipped (not enough memory)" << std::endl;
+            continue;
+        }
+
+        // centered moments of a blocky depth pattern, like varianceShadowMap.glsl writes
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+            {
+                float depth = float(((x >> 3) ^ (y >> 3)) & 255) / 255.0f;
+                float* texel = &moments[((size_t)y * size + x) * TEXEL];
+                texel[0] = depth - 0.5f;
+                texel[1] = depth * depth - 0.5f;
+            }
+        }
+
+        const CpuSAT::ScanOrder orders[] = { CpuSAT::ScanOrder::Sequential, CpuSAT::ScanOrder::ComputeShader };
+        const char* orderNames[] = { "sequential", "compute order" };
+        for (int i = 0; i < 2; ++i)
+        {
+            // warm up the band buffers and page in the outputs
+            cpuSAT.generate(moments.data(), scratch.data(), sat.data(), size, size, orders[i]);
+
+            int iterations = 0;
+            double seconds = 0.0;
+            auto start = std::chrono::high_resolution_clock::now();
+            while (iterations < 3 || seconds < 0.5)
+            {
+                cpuSAT.generate(moments.data(), scratch.data(), sat.data(), size, size, orders[i]);
+                ++iterations;
+                seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            }
+            double ms = 1000.0 * seconds / iterations;
+            double msamples = double(texels) * iterations / seconds / 1.0e6;
+            out << std::setw(5) << size << "^2  " << std::setw(13) << std::left << orderNames[i] << std::right
+                << std::setw(10) << ms << " ms  " << std::setw(10) << msamples << " Msamples/s" << std::endl;
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef CPU_SAT_H
+#define CPU_SAT_H
+
+#include "thread_pool.h"
+
+#include <ostream>
+
+// texels one ComputeSAT workgroup scans (local_size_x * 2); longer rows need the multi-block
+// scan, which ScanOrder::ComputeShader replays block by block
+const unsigned int SAT_BLOCK_SIZE = 2048;
+
+/* CPU version of the summed-area table build that computeSAT.glsl (ComputeSAT) does.
+ * It takes the RG32F centered moments written by varianceShadowMap.glsl and runs
+ * the same two passes as the glDispatchCompute calls: scan every row, store the
+ * result transposed, then repeat on the transposed image. Rows are scanned with
+ * AVX/SSE2, written back through a cache-blocked transpose and spread over a pool
+ * of worker threads.
+ */
+class CpuSAT {
+public:
+    enum class ScanOrder {
+        Sequential,     // running sum along the row, fastest
+        ComputeShader   // same summation order as computeSAT.glsl, bit-comparable with the GPU output
+    };
+
+    // threadCount == 0 uses one thread per hardware thread
+    explicit CpuSAT(unsigned int threadCount = 0);
+
+    /* Build the SAT of a width x height RG32F image.
+     * moments and sat must not overlap; scratch must hold width * height texels
+     * and receives the transposed result of the horizontal pass.
+     */
+    void generate(const float* moments, float* scratch, float* sat, int width, int height, ScanOrder order = ScanOrder::Sequential);
+    unsigned int threadCount() const;
+
+    // Name of the vector instruction set the scans were compiled for
+    static const char* simdPath();
+
+private:
+    ThreadPool pool;
+
+    // scan every row of src and write it transposed into dst (dst is height x width)
+    void scanTransposed(const float* src, float* dst, int width, int height, ScanOrder order);
+};
+
+// Times CpuSAT on 512^2 - 8192^2 maps and prints the throughput in Msamples/s
+void benchmarkCpuSAT(std::ostream& out);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef DEPTH_PYRAMID_H
+#define DEPTH_PYRAMID_H
+
+#include "shader_s.h"
+
+// workgroup edge of the depthPyramid shaders and number of levels the SSAO kernel samples
+const unsigned int DEPTH_PYRAMID_GROUP_SIZE = 8;
+const int MAX_DEPTH_PYRAMID_LEVELS = 5;
+
+/* Per-frame view depth mip pyramid for the SSAO kernel (McGuire et al., "Scalable Ambient
+ * Obscurance"). depthPyramid.Linearize writes the positive view depth of the G-buffer depth
+ * into level 0 of an R32F texture, and depthPyramid.Downsample builds each further level
+ * from the one above by keeping one of every 2x2 texels on a rotated grid, so every level
+ * holds depths that really exist in the scene instead of averages across edges.
+ * Needs a current OpenGL 4.3 context for construction and all calls.
+ */
+class DepthPyramid {
+public:
+    DepthPyramid(int width, int height);
+    // deletes the texture, call it while the context is still current
+    void release();
+
+    // the G-buffer depth texture has to be bound to unit 0 and inverseProjection set on linearize
+    void build(Shader& linearize, Shader& downsample);
+
+    unsigned int texture() const { return pyramid; }
+    int levels() const { return levelCount; }
+
+private:
+    unsigned int pyramid;
+    int width, height;
+    int levelCount;
+};
+
+#endif
@@ -0,0 +1,275 @@
+#include "env_cache.h"
+
+#include <glad/glad.h>
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char MAGIC[4] = { 'S', 'V', 'E', 'C' };
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t textureCount;
+    uint32_t payloadFloats;
+};
+
+struct CacheTextureHeader {
+    uint32_t target, format, components, size, levels;
+};
+
+MappedFile::MappedFile()
+    : bytes(nullptr), length(0)
+#ifdef _WIN32
+    , file(INVALID_HANDLE_VALUE), mapping(nullptr)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        close();
+        return false;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        close();
+        return false;
+    }
+    bytes = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    length = bytes ? (std::size_t)fileSize.QuadPart : 0;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* view = mmap(nullptr, (std::size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED) {
+            bytes = (const unsigned char*)view;
+            length = (std::size_t)info.st_size;
+        }
+    }
+    // the mapping stays valid without the descriptor
+    ::close(fd);
+#endif
+    return bytes != nullptr;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (bytes) {
+        UnmapViewOfFile(bytes);
+    }
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (bytes) {
+        munmap((void*)bytes, length);
+    }
+#endif
+    bytes = nullptr;
+    length = 0;
+}
+
+uint64_t hashFile(const std::string& path)
+{
+    MappedFile file;
+    if (!file.open(path)) {
+        return 0;
+    }
+    uint64_t hash = 14695981039346656037ull;
+    for (std::size_t i = 0; i < file.size(); ++i)
+    {
+        hash ^= file.data()[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static int faceCount(const CachedTexture& texture)
+{
+    return texture.target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+}
+
+// half floats of all levels and faces of a texture
+static std::size_t texelBytes(const CachedTexture& texture)
+{
+    std::size_t bytes = 0;
+    for (int level = 0; level < texture.levels; ++level)
+    {
+        std::size_t levelSize = texture.size >> level;
+        bytes += levelSize * levelSize * texture.components * sizeof(uint16_t) * faceCount(texture);
+    }
+    return bytes;
+}
+
+static std::size_t headerBytes(const std::vector<CachedTexture>& textures, std::size_t payloadFloats)
+{
+    return sizeof(CacheHeader) + textures.size() * sizeof(CacheTextureHeader) + payloadFloats * sizeof(float);
+}
+
+bool validTextureCache(const MappedFile& file, uint64_t key, const std::vector<CachedTexture>& textures, std::size_t payloadFloats)
+{
+    std::size_t expected = headerBytes(textures, payloadFloats);
+    for (const CachedTexture& texture : textures)
+        expected += texelBytes(texture);
+    if (!file.data() || file.size() != expected) {
+        return false;
+    }
+
+    CacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != ENV_CACHE_VERSION || header.key != key ||
+        header.textureCount != textures.size() || header.payloadFloats != payloadFloats) {
+        return false;
+    }
+    const unsigned char* read = file.data() + sizeof(header);
+    for (const CachedTexture& texture : textures)
+    {
+        CacheTextureHeader layout;
+        std::memcpy(&layout, read, sizeof(layout));
+        read += sizeof(layout);
+        if (layout.target != texture.target || layout.format != texture.format || layout.components != (uint32_t)texture.components ||
+            layout.size != (uint32_t)texture.size || layout.levels != (uint32_t)texture.levels) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void loadTextureCache(const MappedFile& file, const std::vector<CachedTexture>& textures, float* payload, std::size_t payloadFloats)
+{
+    const unsigned char* read = file.data() + sizeof(CacheHeader) + textures.size() * sizeof(CacheTextureHeader);
+    if (payloadFloats > 0) {
+        std::memcpy(payload, read, payloadFloats * sizeof(float));
+        read += payloadFloats * sizeof(float);
+    }
+
+    // rows of the cached levels are tightly packed
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (const CachedTexture& texture : textures)
+    {
+        glBindTexture(texture.target, texture.texture);
+        for (int level = 0; level < texture.levels; ++level)
+        {
+            int levelSize = texture.size >> level;
+            for (int face = 0; face < faceCount(texture); ++face)
+            {
+                GLenum target = texture.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : texture.target;
+                // straight from the mapping, the driver copies it out before returning
+                glTexSubImage2D(target, level, 0, 0, levelSize, levelSize, texture.format, GL_HALF_FLOAT, read);
+                read += (std::size_t)levelSize * levelSize * texture.components * sizeof(uint16_t);
+            }
+        }
+        glBindTexture(texture.target, 0);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+std::size_t textureCacheTexelBytes(const std::vector<CachedTexture>& textures)
+{
+    std::size_t bytes = 0;
+    for (const CachedTexture& texture : textures)
+        bytes += texelBytes(texture);
+    return bytes;
+}
+
+void readTextureCacheTexels(const std::vector<CachedTexture>& textures, void* texels)
+{
+    char* write = (char*)texels;
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    for (const CachedTexture& texture : textures)
+    {
+        glBindTexture(texture.target, texture.texture);
+        for (int level = 0; level < texture.levels; ++level)
+        {
+            int levelSize = texture.size >> level;
+            for (int face = 0; face < faceCount(texture); ++face)
+            {
+                GLenum target = texture.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : texture.target;
+                glGetTexImage(target, level, texture.format, GL_HALF_FLOAT, write);
+                write += (std::size_t)levelSize * levelSize * texture.components * sizeof(uint16_t);
+            }
+        }
+        glBindTexture(texture.target, 0);
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+}
+
+bool writeTextureCache(const std::string& path, uint64_t key, const std::vector<CachedTexture>& textures, const float* payload, std::size_t payloadFloats,
+    const void* texels)
+{
+    // written under a temporary name, so a cache that is cut short never looks valid
+    std::string temporaryPath = path + ".tmp";
+    FILE* out = std::fopen(temporaryPath.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+
+    CacheHeader header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = ENV_CACHE_VERSION;
+    header.key = key;
+    header.textureCount = (uint32_t)textures.size();
+    header.payloadFloats = (uint32_t)payloadFloats;
+    bool written = std::fwrite(&header, sizeof(header), 1, out) == 1;
+    for (const CachedTexture& texture : textures)
+    {
+        CacheTextureHeader layout = { texture.target, texture.format, (uint32_t)texture.components, (uint32_t)texture.size, (uint32_t)texture.levels };
+        written = written && std::fwrite(&layout, sizeof(layout), 1, out) == 1;
+    }
+    if (payloadFloats > 0) {
+        written = written && std::fwrite(payload, sizeof(float), payloadFloats, out) == payloadFloats;
+    }
+    std::size_t bytes = textureCacheTexelBytes(textures);
+    written = written && std::fwrite(texels, 1, bytes, out) == bytes;
+
+    written = std::fclose(out) == 0 && written;
+    std::remove(path.c_str());
+    if (!written || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool saveTextureCache(const std::string& path, uint64_t key, const std::vector<CachedTexture>& textures, const float* payload, std::size_t payloadFloats)
+{
+    std::vector<unsigned char> texels(textureCacheTexelBytes(textures));
+    readTextureCacheTexels(textures, texels.data());
+    return writeTextureCache(path, key, textures, payload, payloadFloats, texels.data());
+}
@@ -0,0 +1,69 @@
+#ifndef ENV_CACHE_H
+#define ENV_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// bump when the baking of any cached texture changes, older files then count as misses
+const uint32_t ENV_CACHE_VERSION = 1;
+
+// read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    const unsigned char* data() const { return bytes; }
+    std::size_t size() const { return length; }
+
+private:
+    const unsigned char* bytes;
+    std::size_t length;
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#endif
+};
+
+// 64-bit FNV-1a of the contents of a file, 0 if it can't be read
+uint64_t hashFile(const std::string& path);
+
+/* One texture of a cache file. Its storage has to exist with these dimensions before
+ * it is loaded; the texels are stored as GL_HALF_FLOAT in format, the way the lighting
+ * shaders sample them, so they go to glTexSubImage2D without conversion.
+ */
+struct CachedTexture {
+    unsigned int texture;
+    unsigned int target;    // GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP
+    unsigned int format;    // GL_RGB or GL_RG
+    int components;
+    int size;
+    int levels;
+};
+
+/* Baked texture cache files: a header with the version, the key of the source data
+ * and the layout of every texture, then payloadFloats floats of other baked data, then
+ * the texels of every texture level by level (cube faces in +X, -X, +Y, -Y, +Z, -Z order).
+ * A file whose header doesn't match the expected key and layout is a miss.
+ */
+bool validTextureCache(const MappedFile& file, uint64_t key, const std::vector<CachedTexture>& textures, std::size_t payloadFloats);
+// uploads the texels of a valid file into the textures and copies its payload out
+void loadTextureCache(const MappedFile& file, const std::vector<CachedTexture>& textures, float* payload, std::size_t payloadFloats);
+// bytes of the texels of all textures, in the order they are stored
+std::size_t textureCacheTexelBytes(const std::vector<CachedTexture>& textures);
+// reads the texels of all textures back in file order, to texels or at that offset into the bound pixel pack buffer
+void readTextureCacheTexels(const std::vector<CachedTexture>& textures, void* texels);
+// writes the file from texels read by readTextureCacheTexels(), needs no GL context; returns false if it couldn't be written
+bool writeTextureCache(const std::string& path, uint64_t key, const std::vector<CachedTexture>& textures, const float* payload, std::size_t payloadFloats,
+    const void* texels);
+// reads the textures back and writes the file right away, returns false if it couldn't be written
+bool saveTextureCache(const std::string& path, uint64_t key, const std::vector<CachedTexture>& textures, const float* payload, std::size_t payloadFloats);
+
+#endif
@@ -0,0 +1,127 @@
+#include "frustum_cull.h"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#define FRUSTUM_CULL_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_CULL_SSE
+#include <emmintrin.h>
+#endif
+
+void frustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+    // Gribb/Hartmann: a point is inside when -w <= x, y, z <= w in clip space, so every
+    // plane is the last row of the matrix plus or minus one of the others
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i)
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    for (int i = 0; i < 3; ++i)
+    {
+        planes[2 * i] = rows[3] + rows[i];
+        planes[2 * i + 1] = rows[3] - rows[i];
+    }
+    for (int i = 0; i < 6; ++i)
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+void FrustumCuller::resize(std::size_t count)
+{
+    centerX.resize(count);
+    centerY.resize(count);
+    centerZ.resize(count);
+    radius.resize(count);
+}
+
+std::size_t FrustumCuller::size() const
+{
+    return radius.size();
+}
+
+void FrustumCuller::setSphere(std::size_t index, const glm::vec3& center, float sphereRadius)
+{
+    centerX[index] = center.x;
+    centerY[index] = center.y;
+    centerZ[index] = center.z;
+    radius[index] = sphereRadius;
+}
+
+std::size_t FrustumCuller::cull(const glm::mat4& viewProjection, std::vector<unsigned char>& visible) const
+{
+    glm::vec4 planes[6];
+    frustumPlanes(viewProjection, planes);
+
+    const std::size_t count = size();
+    visible.resize(count);
+    std::size_t visibleCount = 0;
+    std::size_t i = 0;
+
+#if defined(FRUSTUM_CULL_AVX)
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&centerX[i]);
+        __m256 y = _mm256_loadu_ps(&centerY[i]);
+        __m256 z = _mm256_loadu_ps(&centerZ[i]);
+        __m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&radius[i]));
+        __m256 outside = _mm256_setzero_ps();
+        for (int p = 0; p < 6; ++p)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(planes[p].x)), _mm256_mul_ps(y, _mm256_set1_ps(planes[p].y))),
+                _mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(planes[p].z)), _mm256_set1_ps(planes[p].w)));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, negativeRadius, _CMP_LT_OQ));
+        }
+        int mask = _mm256_movemask_ps(outside);
+        for (int k = 0; k < 8; ++k)
+        {
+            visible[i + k] = (mask >> k & 1) ? 0 : 1;
+            visibleCount += visible[i + k];
+        }
+    }
+#elif defined(FRUSTUM_CULL_SSE)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&centerX[i]);
+        __m128 y = _mm_loadu_ps(&centerY[i]);
+        __m128 z = _mm_loadu_ps(&centerZ[i]);
+        __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius[i]));
+        __m128 outside = _mm_setzero_ps();
+        for (int p = 0; p < 6; ++p)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(planes[p].x)), _mm_mul_ps(y, _mm_set1_ps(planes[p].y))),
+                _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(planes[p].z)), _mm_set1_ps(planes[p].w)));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negativeRadius));
+        }
+        int mask = _mm_movemask_ps(outside);
+        for (int k = 0; k < 4; ++k)
+        {
+            visible[i + k] = (mask >> k & 1) ? 0 : 1;
+            visibleCount += visible[i + k];
+        }
+    }
+#endif
+    // the remaining spheres, same test and same rounding as the vector code
+    for (; i < count; ++i)
+    {
+        bool outside = false;
+        for (int p = 0; p < 6; ++p)
+        {
+            float distance = (centerX[i] * planes[p].x + centerY[i] * planes[p].y) + (centerZ[i] * planes[p].z + planes[p].w);
+            outside = outside || distance < -radius[i];
+        }
+        visible[i] = outside ? 0 : 1;
+        visibleCount += visible[i];
+    }
+    return visibleCount;
+}
+
+const char* FrustumCuller::simdPath()
+{
+#if defined(FRUSTUM_CULL_AVX)
+    return "AVX";
+#elif defined(FRUSTUM_CULL_SSE)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
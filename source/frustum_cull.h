@@ -0,0 +1,37 @@
+#ifndef FRUSTUM_CULL_H
+#define FRUSTUM_CULL_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+/* Bounding sphere vs. frustum culling for many instances at once. The spheres are kept
+ * as structure of arrays, so the plane tests run on 8 (AVX) or 4 (SSE2) spheres per
+ * instruction. A sphere is culled when it lies completely outside one of the six
+ * planes, which keeps a few spheres near the frustum corners that could be culled
+ * but never drops a visible one.
+ */
+class FrustumCuller {
+public:
+    void resize(std::size_t count);
+    std::size_t size() const;
+    void setSphere(std::size_t index, const glm::vec3& center, float radius);
+
+    // visible[i] becomes 1 if sphere i may intersect the clip volume of viewProjection
+    // (OpenGL conventions, works for perspective and orthographic matrices), else 0;
+    // returns the number of visible spheres
+    std::size_t cull(const glm::mat4& viewProjection, std::vector<unsigned char>& visible) const;
+
+    // Name of the vector instruction set the plane tests were compiled for
+    static const char* simdPath();
+
+private:
+    std::vector<float> centerX, centerY, centerZ, radius;
+};
+
+// the six planes (left, right, bottom, top, near, far) of the clip volume of viewProjection,
+// normalized and pointing inwards
+void frustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
+
+#endif
@@ -0,0 +1,83 @@
+#include "gpu_timer.h"
+
+#include <glad/glad.h>
+
+// weight of a new measurement in the running average
+const float SMOOTHING = 0.1f;
+
+GpuTimer::GpuTimer()
+    : first(0), pending(0), running(false), average(0.0f), sampleCount(0)
+{
+    glGenQueries(QUERY_COUNT, queries);
+}
+
+void GpuTimer::release()
+{
+    if (running) {
+        glEndQuery(GL_TIME_ELAPSED);
+        running = false;
+    }
+    glDeleteQueries(QUERY_COUNT, queries);
+    pending = 0;
+}
+
+void GpuTimer::start()
+{
+    if (running) {
+        return;
+    }
+    // all queries in flight: wait for the oldest instead of overwriting it
+    collect(pending == QUERY_COUNT);
+    glBeginQuery(GL_TIME_ELAPSED, queries[(first + pending) % QUERY_COUNT]);
+    running = true;
+}
+
+void GpuTimer::stop()
+{
+    if (!running) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    ++pending;
+    running = false;
+}
+
+float GpuTimer::milliseconds()
+{
+    collect(false);
+    return average;
+}
+
+unsigned int GpuTimer::samples() const
+{
+    return sampleCount;
+}
+
+void GpuTimer::reset()
+{
+    collect(false);
+    average = 0.0f;
+    sampleCount = 0;
+}
+
+void GpuTimer::collect(bool wait)
+{
+    while (pending > 0)
+    {
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(queries[first], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available && !wait) {
+            break;
+        }
+        // GL_QUERY_RESULT blocks until the result is there
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(queries[first], GL_QUERY_RESULT, &nanoseconds);
+        float ms = float(nanoseconds) * 1e-6f;
+        average = sampleCount == 0 ? ms : average + (ms - average) * SMOOTHING;
+        ++sampleCount;
+
+        first = (first + 1) % QUERY_COUNT;
+        --pending;
+        wait = false;
+    }
+}
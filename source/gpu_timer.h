@@ -0,0 +1,41 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+/* Measures the GPU time of one render or compute pass with GL_TIME_ELAPSED queries.
+ * Queries are kept in a small ring and read back a few frames later, so timing a
+ * pass never stalls the pipeline. The reported time is smoothed over the last
+ * results; it keeps its value while the pass isn't running (e.g. cached shadows).
+ * Needs a current OpenGL 3.3+ context for construction and all calls.
+ */
+class GpuTimer {
+public:
+    GpuTimer();
+    // deletes the query objects, call it while the context is still current
+    void release();
+
+    // start()/stop() bracket the GL calls of the pass; passes timed by different
+    // GpuTimers must not overlap
+    void start();
+    void stop();
+
+    // smoothed GPU time of the pass in milliseconds, 0 until the first result arrives
+    float milliseconds();
+    // number of finished measurements so far
+    unsigned int samples() const;
+    void reset();
+
+private:
+    static const int QUERY_COUNT = 4;
+
+    unsigned int queries[QUERY_COUNT];
+    int first;      // oldest query still in flight
+    int pending;    // queries in flight
+    bool running;
+    float average;
+    unsigned int sampleCount;
+
+    // reads finished queries; wait forces the oldest one to finish first
+    void collect(bool wait);
+};
+
+#endif
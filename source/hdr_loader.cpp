@@ -0,0 +1,261 @@
+#include "hdr_loader.h"
+
+#include <glad/glad.h>
+#include "stb/stb_image.h"
+
+#include <algorithm>
+#include <iostream>
+
+HDRLoader::HDRLoader(SHIrradiance& shIrradiance, const std::vector<CachedTexture>& cacheLayout)
+    : shIrradiance(shIrradiance), cacheLayout(cacheLayout), stopping(false), requested(false), decoding(false), decoded(nullptr),
+      decodedWidth(0), decodedHeight(0), decodedKey(0), uploading(nullptr), uploadWidth(0), uploadHeight(0), uploadedBytes(0), uploadKey(0), deliveredKey(0)
+{
+    glGenBuffers(1, &unpackBuffer);
+    worker = std::thread(&HDRLoader::workerLoop, this);
+}
+
+HDRLoader::~HDRLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    worker.join();
+    stbi_image_free(decoded);
+    stbi_image_free(uploading);
+}
+
+void HDRLoader::release()
+{
+    // saves still in flight are finished, the exit would otherwise leave the skybox unsaved
+    for (const std::unique_ptr<CacheSave>& save : saves)
+    {
+        if (save->fence) {
+            glClientWaitSync(save->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        }
+    }
+    collectSaves();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        writtenSignal.wait(lock, [this] {
+            return std::all_of(saves.begin(), saves.end(), [](const std::unique_ptr<CacheSave>& save) { return save->written; });
+        });
+    }
+    collectSaves();
+    glDeleteBuffers(1, &unpackBuffer);
+    unpackBuffer = 0;
+}
+
+void HDRLoader::request(const std::string& path, const std::string& cachePath)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requestedPath = path;
+        requestedCachePath = cachePath;
+        requested = true;
+    }
+    wakeup.notify_one();
+}
+
+void HDRLoader::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    decodedSignal.wait(lock, [this] { return !requested && !decoding; });
+}
+
+bool HDRLoader::busy()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return requested || decoding || decoded || decodedCache || uploading;
+}
+
+HDRLoader::Result HDRLoader::update(unsigned int texture, const std::vector<CachedTexture>& cacheTextures, glm::vec3 sh[SH_COEFFICIENTS])
+{
+    collectSaves();
+    if (!uploading) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (decodedCache) {
+            // a cache hit is uploaded in one go, glTexSubImage2D copies out of the mapping
+            std::unique_ptr<MappedFile> cache = std::move(decodedCache);
+            deliveredKey = decodedKey;
+            deliveredCachePath = decodedCachePath;
+            lock.unlock();
+            float payload[SH_COEFFICIENTS * 3];
+            loadTextureCache(*cache, cacheTextures, payload, SH_COEFFICIENTS * 3);
+            for (int i = 0; i < SH_COEFFICIENTS; ++i)
+                sh[i] = glm::vec3(payload[3 * i], payload[3 * i + 1], payload[3 * i + 2]);
+            return Result::Cached;
+        }
+        if (!decoded) {
+            return Result::None;
+        }
+        uploading = decoded;
+        uploadWidth = decodedWidth;
+        uploadHeight = decodedHeight;
+        std::copy(decodedSH, decodedSH + SH_COEFFICIENTS, uploadSH);
+        uploadedBytes = 0;
+        uploadKey = decodedKey;
+        uploadCachePath = decodedCachePath;
+        decoded = nullptr;
+    }
+
+    std::size_t size = (std::size_t)uploadWidth * uploadHeight * 3 * sizeof(float);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+    if (uploadedBytes == 0) {
+        // orphans the storage of the previous image in case the GPU still reads from it
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    }
+    std::size_t chunk = std::min(HDR_UPLOAD_CHUNK_SIZE, size - uploadedBytes);
+    glBufferSubData(GL_PIXEL_UNPACK_BUFFER, uploadedBytes, chunk, (const char*)uploading + uploadedBytes);
+    uploadedBytes += chunk;
+
+    bool complete = uploadedBytes == size;
+    if (complete) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, uploadWidth, uploadHeight, 0, GL_RGB, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        std::copy(uploadSH, uploadSH + SH_COEFFICIENTS, sh);
+        deliveredKey = uploadKey;
+        deliveredCachePath = uploadCachePath;
+        stbi_image_free(uploading);
+        uploading = nullptr;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return complete ? Result::Image : Result::None;
+}
+
+void HDRLoader::save(uint64_t key, const std::string& cachePath, const std::vector<CachedTexture>& textures, const float* payload, std::size_t payloadFloats)
+{
+    std::unique_ptr<CacheSave> save(new CacheSave());
+    save->key = key;
+    save->path = cachePath;
+    save->textures = textures;
+    save->payload.assign(payload, payload + payloadFloats);
+    save->texels = nullptr;
+    save->written = false;
+
+    // every save gets its own buffer, a previous one may still be mapped by the loader thread
+    glGenBuffers(1, &save->packBuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, save->packBuffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, textureCacheTexelBytes(textures), nullptr, GL_STREAM_READ);
+    // with a pack buffer bound the readback is queued, the texels pointer is an offset into it
+    readTextureCacheTexels(textures, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    save->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    saves.push_back(std::move(save));
+}
+
+void HDRLoader::collectSaves()
+{
+    for (std::size_t i = 0; i < saves.size();)
+    {
+        CacheSave& save = *saves[i];
+        if (save.fence) {
+            // zero timeout only polls
+            GLenum status = glClientWaitSync(save.fence, 0, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+                glDeleteSync(save.fence);
+                save.fence = nullptr;
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, save.packBuffer);
+                save.texels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, textureCacheTexelBytes(save.textures), GL_MAP_READ_BIT);
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+                std::lock_guard<std::mutex> lock(mutex);
+                if (save.texels) {
+                    writes.push_back(&save);
+                    wakeup.notify_one();
+                }
+                else {
+                    std::cout << "Failed to map the readback of environment cache " << save.path << std::endl;
+                    save.written = true;
+                }
+            }
+            ++i;
+            continue;
+        }
+
+        bool written;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            written = save.written;
+        }
+        if (!written) {
+            ++i;
+            continue;
+        }
+        if (save.texels) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, save.packBuffer);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &save.packBuffer);
+        saves.erase(saves.begin() + i);
+    }
+}
+
+void HDRLoader::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        wakeup.wait(lock, [this] { return stopping || requested || !writes.empty(); });
+        if (stopping) {
+            return;
+        }
+        if (!writes.empty()) {
+            // the buffer stays mapped until the render thread sees written
+            CacheSave* save = writes.front();
+            writes.pop_front();
+            lock.unlock();
+            if (!save->key || !writeTextureCache(save->path, save->key, save->textures, save->payload.data(), save->payload.size(), save->texels)) {
+                std::cout << "Failed to write environment cache " << save->path << std::endl;
+            }
+            lock.lock();
+            save->written = true;
+            writtenSignal.notify_all();
+            continue;
+        }
+        std::string path = requestedPath;
+        std::string cachePath = requestedCachePath;
+        requested = false;
+        decoding = true;
+        lock.unlock();
+
+        uint64_t key = hashFile(path);
+        std::unique_ptr<MappedFile> cache(new MappedFile());
+        float* data = nullptr;
+        int width = 0, height = 0, nrComponents;
+        glm::vec3 sh[SH_COEFFICIENTS];
+        if (!key || !cache->open(cachePath) || !validTextureCache(*cache, key, cacheLayout, SH_COEFFICIENTS * 3)) {
+            cache.reset();
+            data = stbi_loadf(path.c_str(), &width, &height, &nrComponents, 3);
+            if (data) {
+                shIrradiance.project(data, width, height, 3, sh);
+            }
+            else {
+                std::cout << "Failed to load HDR image " << path << std::endl;
+            }
+        }
+
+        lock.lock();
+        decoding = false;
+        // a newer request supersedes this image, and an image nobody took yet is dropped
+        if ((data || cache) && !requested) {
+            stbi_image_free(decoded);
+            decoded = data;
+            decodedCache = std::move(cache);
+            decodedWidth = width;
+            decodedHeight = height;
+            std::copy(sh, sh + SH_COEFFICIENTS, decodedSH);
+            decodedKey = key;
+            decodedCachePath = cachePath;
+        }
+        else {
+            stbi_image_free(data);
+        }
+        decodedSignal.notify_all();
+    }
+}
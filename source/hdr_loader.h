@@ -0,0 +1,120 @@
+#ifndef HDR_LOADER_H
+#define HDR_LOADER_H
+
+#include "sh_irradiance.h"
+#include "env_cache.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// bytes of decoded pixels moved into the pixel unpack buffer per update()
+const std::size_t HDR_UPLOAD_CHUNK_SIZE = 8 << 20;
+
+/* Loads HDR skyboxes without stalling the render thread. A loader thread decodes the
+ * .hdr file with stb_image and projects its SH irradiance; update(), called once per
+ * frame, then copies the pixels into a pixel unpack buffer a chunk at a time and, once
+ * they are all there, defines the RGB16F texture from it so the transfer runs on the
+ * GPU's schedule. Requests made while a file is still decoding replace each other,
+ * only the latest one is delivered.
+ * Before decoding, the loader thread looks for a baked cache of the file (see env_cache.h)
+ * keyed on the hash of its contents; a hit is memory-mapped and uploaded straight into
+ * the baked textures, skipping the decode, the SH projection and the GPU processing.
+ * Baked textures are saved the same way round: save() reads them back into a pixel pack
+ * buffer behind a fence, and once update() finds the fence signaled, the loader thread
+ * writes the mapped buffer to the cache file.
+ * update(), save() and release() need the GL context, request() can be called from any thread.
+ */
+class HDRLoader {
+public:
+    enum class Result {
+        None,       // nothing new this frame
+        Image,      // the texture holds a new image, the baked textures have to be built from it
+        Cached      // the baked textures were loaded from the cache
+    };
+
+    // cacheLayout describes the baked textures of a cache file, the texture ids are ignored
+    HDRLoader(SHIrradiance& shIrradiance, const std::vector<CachedTexture>& cacheLayout);
+    ~HDRLoader();
+    // finishes the saves still in flight and deletes the buffers, call it while the context is still current
+    void release();
+
+    // cachePath is where the baked textures of path are (or will be) cached
+    void request(const std::string& path, const std::string& cachePath);
+    // blocks until the last request has been decoded (or failed to)
+    void wait();
+    // true while a request hasn't been fully handed to the GPU yet
+    bool busy();
+
+    // uploads the next chunk of a decoded image, or a whole cache hit into cacheTextures;
+    // sh receives the irradiance coefficients when something other than None is returned
+    Result update(unsigned int texture, const std::vector<CachedTexture>& cacheTextures, glm::vec3 sh[SH_COEFFICIENTS]);
+
+    // hash and cache file of the image update() last returned Image or Cached for, for
+    // save(); a later image that is still uploading doesn't change them
+    uint64_t key() const { return deliveredKey; }
+    const std::string& cachePath() const { return deliveredCachePath; }
+
+    // queues the readback of textures for a cache file with the payload, see writeTextureCache();
+    // the textures may be overwritten right after, the readback is ordered before that on the GPU
+    void save(uint64_t key, const std::string& cachePath, const std::vector<CachedTexture>& textures, const float* payload, std::size_t payloadFloats);
+
+private:
+    // a cache file on its way out: read back, then mapped and written by the loader thread
+    struct CacheSave {
+        uint64_t key;
+        std::string path;
+        std::vector<CachedTexture> textures;
+        std::vector<float> payload;
+        unsigned int packBuffer;
+        GLsync fence;
+        const void* texels;     // the mapped pack buffer, once the fence signaled
+        bool written;           // set by the loader thread, guarded by mutex
+    };
+
+    SHIrradiance& shIrradiance;
+    std::vector<CachedTexture> cacheLayout;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wakeup, decodedSignal, writtenSignal;
+    bool stopping;
+
+    // shared with the loader thread, guarded by mutex
+    std::string requestedPath, requestedCachePath;
+    bool requested, decoding;
+    float* decoded;
+    std::unique_ptr<MappedFile> decodedCache;
+    int decodedWidth, decodedHeight;
+    glm::vec3 decodedSH[SH_COEFFICIENTS];
+    uint64_t decodedKey;
+    std::string decodedCachePath;
+    std::deque<CacheSave*> writes;
+
+    // image being uploaded, render thread only
+    float* uploading;
+    int uploadWidth, uploadHeight;
+    std::size_t uploadedBytes;
+    glm::vec3 uploadSH[SH_COEFFICIENTS];
+    uint64_t uploadKey;
+    std::string uploadCachePath;
+    unsigned int unpackBuffer;
+    // last image returned, render thread only
+    uint64_t deliveredKey;
+    std::string deliveredCachePath;
+    // saves in flight, render thread only
+    std::vector<std::unique_ptr<CacheSave>> saves;
+
+    // hands the saves whose readback finished to the loader thread, frees the written ones
+    void collectSaves();
+    void workerLoop();
+};
+
+#endif
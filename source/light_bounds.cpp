@@ -0,0 +1,106 @@
+#include "light_bounds.h"
+
+#include <cstring>
+
+// SSBO binding of LightBounds in lightBounds.glsl
+const unsigned int LIGHT_BOUNDS_BINDING = 3;
+
+// inverse of OrderedBits() in lightBounds.glsl
+static float decodeOrderedBits(GLuint bits)
+{
+    bits = (bits & 0x80000000u) != 0 ? bits & 0x7FFFFFFFu : ~bits;
+    float value;
+    std::memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+LightBoundsReduction::LightBoundsReduction()
+    : next(0), valid(false), lastMin(0.0f), lastMax(0.0f)
+{
+    glGenBuffers(BUFFER_COUNT, buffers);
+    for (int i = 0; i < BUFFER_COUNT; ++i)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 6 * sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+        fences[i] = nullptr;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void LightBoundsReduction::release()
+{
+    for (int i = 0; i < BUFFER_COUNT; ++i)
+    {
+        if (fences[i]) {
+            glDeleteSync(fences[i]);
+            fences[i] = nullptr;
+        }
+    }
+    glDeleteBuffers(BUFFER_COUNT, buffers);
+    valid = false;
+}
+
+void LightBoundsReduction::reduce(Shader& reduceShader, const glm::mat4& lightView, int width, int height)
+{
+    collect();
+    if (fences[next]) {
+        return;
+    }
+
+    // empty bounds: min starts at the largest encoding, max at the smallest
+    const GLuint initial[6] = { 0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu, 0u, 0u, 0u };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[next]);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(initial), initial);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BOUNDS_BINDING, buffers[next]);
+
+    reduceShader.use();
+    reduceShader.setUniformMat4("lightView", lightView);
+    glDispatchCompute((width + 15) / 16, (height + 15) / 16, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BOUNDS_BINDING, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    fences[next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    next = (next + 1) % BUFFER_COUNT;
+}
+
+bool LightBoundsReduction::result(glm::vec3& boundsMin, glm::vec3& boundsMax)
+{
+    collect();
+    boundsMin = lastMin;
+    boundsMax = lastMax;
+    return valid;
+}
+
+void LightBoundsReduction::collect()
+{
+    for (int k = 0; k < BUFFER_COUNT; ++k)
+    {
+        int i = (next + k) % BUFFER_COUNT;
+        if (!fences[i]) {
+            continue;
+        }
+        // zero timeout only polls; later buffers can't be done before this one
+        GLenum status = glClientWaitSync(fences[i], 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            break;
+        }
+        glDeleteSync(fences[i]);
+        fences[i] = nullptr;
+
+        GLuint bits[6];
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[i]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(bits), bits);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glm::vec3 boundsMin(decodeOrderedBits(bits[0]), decodeOrderedBits(bits[1]), decodeOrderedBits(bits[2]));
+        glm::vec3 boundsMax(decodeOrderedBits(bits[3]), decodeOrderedBits(bits[4]), decodeOrderedBits(bits[5]));
+        // no workgroup saw any geometry
+        valid = boundsMin.x <= boundsMax.x;
+        if (valid) {
+            lastMin = boundsMin;
+            lastMax = boundsMax;
+        }
+    }
+}
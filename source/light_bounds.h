@@ -0,0 +1,42 @@
+#ifndef LIGHT_BOUNDS_H
+#define LIGHT_BOUNDS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader_s.h"
+
+/* Light view space bounds of the visible receivers, reduced on the GPU from the G-buffer
+ * (lightBounds.Reduce). Results go through a small ring of storage buffers guarded by
+ * fences and are read once the GPU is done with them, so they lag a frame or two
+ * behind but never stall the pipeline. Needs a current OpenGL 4.3 context for
+ * construction and all calls.
+ */
+class LightBoundsReduction {
+public:
+    LightBoundsReduction();
+    // deletes the buffers and fences, call it while the context is still current
+    void release();
+
+    // reduces the positions reconstructed from the G-buffer depth on texture unit 0 of a
+    // width x height G-buffer; skipped while every buffer is still in flight
+    void reduce(Shader& reduceShader, const glm::mat4& lightView, int width, int height);
+
+    // latest finished bounds, false until the first reduction finished or when nothing
+    // was visible
+    bool result(glm::vec3& boundsMin, glm::vec3& boundsMax);
+
+private:
+    static const int BUFFER_COUNT = 2;
+
+    unsigned int buffers[BUFFER_COUNT];
+    GLsync fences[BUFFER_COUNT];
+    int next;       // buffer the next reduction writes, the oldest one in flight
+    bool valid;
+    glm::vec3 lastMin, lastMax;
+
+    // reads the buffers whose fences have signaled, oldest first
+    void collect();
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "shader_s.h"
+#include "vertex_format.h"
 
 #include <string>
 #include <fstream>
@@ -15,19 +16,6 @@
 #include <vector>
 using namespace std;
 
-struct Vertex {
-    // position
-    glm::vec3 Position;
-    // normal
-    glm::vec3 Normal;
-    // texCoords
-    glm::vec2 TexCoords;
-    // tangent
-    glm::vec3 Tangent;
-    // bitangent
-    glm::vec3 Bitangent;
-};
-
 struct Texture {
     unsigned int id;
     string type;
@@ -37,20 +25,31 @@ struct Texture {
 class Mesh {
 public:
     /*  Mesh Data  */
-    vector<Vertex> vertices;
-    vector<unsigned int> indices;
+    // the vertices and indices only live on the GPU
+    VertexFormat format;
+    unsigned int vertexCount;
+    unsigned int indexCount;
+    unsigned int indexType;
     vector<Texture> textures;
+    Bounds bounds;
     unsigned int VAO;
+    // position stream only, for the depth-only passes
+    unsigned int depthVAO;
     /*  Functions  */
-    // constructor
-    Mesh(const vector<Vertex>& vertices, const vector<unsigned int>& indices, const vector<Texture>& textures)
+    // constructor, the streams are uploaded as they are (packed by an import or in a mapped mesh cache)
+    Mesh(const VertexStreams& streams, const void* indices, size_t indexCount, unsigned int indexType, const vector<Texture>& textures, const Bounds& bounds,
+        const QuantizationRange& quantization)
     {
-        this->vertices = vertices;
-        this->indices = indices;
+        this->format = streams.format;
+        this->vertexCount = (unsigned int)streams.vertexCount;
+        this->indexCount = (unsigned int)indexCount;
+        this->indexType = indexType;
         this->textures = textures;
+        this->bounds = bounds;
+        positionDequantization(format, quantization, positionScale, positionBias);
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(streams, indices);
     }
 
     // render the mesh
@@ -82,58 +81,79 @@ public:
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
         }
         // draw mesh
+        setVertexUniforms(shader, true);
         glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, indexCount, indexType, 0);
         glBindVertexArray(0);
+        setVertexUniforms(shader, false);
 
         // always good practice to set everything back to defaults once configured.
         glActiveTexture(GL_TEXTURE0);
     }
 
+    // render the mesh into a depth-only pass, reading the position stream only
+    void drawDepth(Shader& shader)
+    {
+        setVertexUniforms(shader, true);
+        glBindVertexArray(depthVAO);
+        glDrawElements(GL_TRIANGLES, indexCount, indexType, 0);
+        glBindVertexArray(0);
+        setVertexUniforms(shader, false);
+    }
+
 private:
     /*  Render data  */
-    unsigned int VBO, EBO;
+    unsigned int VBO, positionVBO, EBO;
+    glm::vec3 positionScale, positionBias;
 
     /*  Functions    */
+    // compact vertices need their dequantization, which is reset afterwards so the
+    // uniform defaults hold for the other geometry drawn with the same shader
+    void setVertexUniforms(Shader& shader, bool bind)
+    {
+        if (format == VertexFormat::Full)
+            return;
+        if (bind) {
+            shader.setUniformVec3f("positionScale", positionScale);
+            shader.setUniformVec3f("positionBias", positionBias);
+            shader.setUniformBool("octahedralNormals", true);
+        }
+        else {
+            shader.setUniformVec3f("positionScale", 1.0f, 1.0f, 1.0f);
+            shader.setUniformVec3f("positionBias", 0.0f, 0.0f, 0.0f);
+            shader.setUniformBool("octahedralNormals", false);
+        }
+    }
+
     // initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(const VertexStreams& streams, const void* indices)
     {
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
+        glGenVertexArrays(1, &depthVAO);
         glGenBuffers(1, &VBO);
+        glGenBuffers(1, &positionVBO);
         glGenBuffers(1, &EBO);
 
         glBindVertexArray(VAO);
         // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vertexCount * vertexStride(format, streams.tangents), streams.vertices, GL_STATIC_DRAW);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)indexCount * indexSize(indexType), indices, GL_STATIC_DRAW);
 
         // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-
-        glBindVertexArray(0);
+        setVertexAttributes(format, streams.tangents);
 
+        // the depth passes share the indices
+        glBindVertexArray(depthVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vertexCount * positionStride(format), streams.positions, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        setPositionAttribute(format);
 
+        glBindVertexArray(0);
     }
 
 };
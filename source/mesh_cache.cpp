@@ -0,0 +1,205 @@
+#include "mesh_cache.h"
+
+#include <cstdio>
+#include <cstring>
+
+static const char MAGIC[4] = { 'S', 'V', 'M', 'C' };
+static const std::size_t BLOB_ALIGNMENT = 16;
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t meshCount;
+    uint32_t format;
+};
+
+struct MeshRecord {
+    uint64_t vertexOffset;
+    uint64_t positionOffset;
+    uint64_t indexOffset;
+    uint64_t textureOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t textureCount;
+    uint32_t textureBytes;
+    uint32_t tangents;
+    uint32_t indexType;
+    float min[3];
+    float max[3];
+    float center[3];
+    float radius;
+    float quantizationMin[3];
+    float quantizationMax[3];
+};
+
+static std::size_t align(std::size_t offset)
+{
+    return (offset + BLOB_ALIGNMENT - 1) & ~(BLOB_ALIGNMENT - 1);
+}
+
+// textures are stored as "type\0path\0" pairs
+static std::size_t textureBytes(const std::vector<Texture>& textures)
+{
+    std::size_t bytes = 0;
+    for (const Texture& texture : textures)
+        bytes += texture.type.size() + texture.path.size() + 2;
+    return bytes;
+}
+
+static bool inFile(const MappedFile& file, uint64_t offset, uint64_t bytes)
+{
+    return offset <= file.size() && bytes <= file.size() - offset;
+}
+
+bool readMeshCache(const MappedFile& file, uint64_t key, VertexFormat format, std::vector<CachedMesh>& meshes)
+{
+    if (file.size() < sizeof(MeshCacheHeader)) {
+        return false;
+    }
+    MeshCacheHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != MESH_CACHE_VERSION ||
+        header.key != key || header.format != (uint32_t)format ||
+        !inFile(file, sizeof(header), (uint64_t)header.meshCount * sizeof(MeshRecord))) {
+        return false;
+    }
+
+    std::vector<CachedMesh> cached(header.meshCount);
+    const unsigned char* records = file.data() + sizeof(header);
+    for (uint32_t i = 0; i < header.meshCount; ++i)
+    {
+        MeshRecord record;
+        std::memcpy(&record, records + i * sizeof(MeshRecord), sizeof(record));
+        if (record.vertexOffset % BLOB_ALIGNMENT != 0 || record.positionOffset % BLOB_ALIGNMENT != 0 || record.indexOffset % BLOB_ALIGNMENT != 0 ||
+            !inFile(file, record.vertexOffset, (uint64_t)record.vertexCount * vertexStride(format, record.tangents != 0)) ||
+            !inFile(file, record.positionOffset, (uint64_t)record.vertexCount * positionStride(format)) ||
+            indexSize(record.indexType) == 0 || !inFile(file, record.indexOffset, (uint64_t)record.indexCount * indexSize(record.indexType)) ||
+            !inFile(file, record.textureOffset, record.textureBytes)) {
+            return false;
+        }
+
+        CachedMesh& mesh = cached[i];
+        mesh.streams.format = format;
+        mesh.streams.tangents = record.tangents != 0;
+        mesh.streams.vertices = file.data() + record.vertexOffset;
+        mesh.streams.positions = file.data() + record.positionOffset;
+        mesh.streams.vertexCount = record.vertexCount;
+        mesh.indices = file.data() + record.indexOffset;
+        mesh.indexCount = record.indexCount;
+        mesh.indexType = record.indexType;
+        mesh.bounds.min = glm::vec3(record.min[0], record.min[1], record.min[2]);
+        mesh.bounds.max = glm::vec3(record.max[0], record.max[1], record.max[2]);
+        mesh.bounds.center = glm::vec3(record.center[0], record.center[1], record.center[2]);
+        mesh.bounds.radius = record.radius;
+        mesh.quantization.min = glm::vec3(record.quantizationMin[0], record.quantizationMin[1], record.quantizationMin[2]);
+        mesh.quantization.max = glm::vec3(record.quantizationMax[0], record.quantizationMax[1], record.quantizationMax[2]);
+
+        const char* strings = reinterpret_cast<const char*>(file.data() + record.textureOffset);
+        const char* end = strings + record.textureBytes;
+        for (uint32_t t = 0; t < record.textureCount; ++t)
+        {
+            const char* typeEnd = (const char*)std::memchr(strings, '\0', end - strings);
+            const char* pathEnd = typeEnd ? (const char*)std::memchr(typeEnd + 1, '\0', end - typeEnd - 1) : nullptr;
+            if (!pathEnd) {
+                return false;
+            }
+            Texture texture;
+            texture.id = 0;
+            texture.type.assign(strings, typeEnd);
+            texture.path.assign(typeEnd + 1, pathEnd);
+            strings = pathEnd + 1;
+            mesh.textures.push_back(texture);
+        }
+    }
+    meshes.swap(cached);
+    return true;
+}
+
+static bool pad(FILE* out, std::size_t& offset)
+{
+    static const unsigned char zeros[BLOB_ALIGNMENT] = {};
+    std::size_t padding = align(offset) - offset;
+    offset += padding;
+    return padding == 0 || std::fwrite(zeros, 1, padding, out) == padding;
+}
+
+bool saveMeshCache(const std::string& path, uint64_t key, VertexFormat format, const std::vector<MeshData>& meshes)
+{
+    // written under a temporary name, so a cache that is cut short never looks valid
+    std::string temporaryPath = path + ".tmp";
+    FILE* out = std::fopen(temporaryPath.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+
+    MeshCacheHeader header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = MESH_CACHE_VERSION;
+    header.key = key;
+    header.meshCount = (uint32_t)meshes.size();
+    header.format = (uint32_t)format;
+    bool written = std::fwrite(&header, sizeof(header), 1, out) == 1;
+
+    // lay the blobs out behind the records first, so the records can be written in one go
+    std::size_t offset = sizeof(header) + meshes.size() * sizeof(MeshRecord);
+    for (const MeshData& mesh : meshes)
+    {
+        MeshRecord record;
+        record.textureOffset = offset;
+        record.textureCount = (uint32_t)mesh.textures.size();
+        record.textureBytes = (uint32_t)textureBytes(mesh.textures);
+        record.vertexOffset = align(offset + record.textureBytes);
+        record.vertexCount = (uint32_t)vertexStreams(mesh.packed).vertexCount;
+        record.tangents = mesh.packed.tangents ? 1 : 0;
+        record.positionOffset = align(record.vertexOffset + mesh.packed.vertices.size());
+        record.indexOffset = align(record.positionOffset + mesh.packed.positions.size());
+        record.indexType = mesh.packedIndices.type;
+        record.indexCount = (uint32_t)(mesh.packedIndices.indices.size() / indexSize(record.indexType));
+        offset = record.indexOffset + mesh.packedIndices.indices.size();
+        for (int c = 0; c < 3; ++c)
+        {
+            record.min[c] = mesh.bounds.min[c];
+            record.max[c] = mesh.bounds.max[c];
+            record.center[c] = mesh.bounds.center[c];
+            record.quantizationMin[c] = mesh.quantization.min[c];
+            record.quantizationMax[c] = mesh.quantization.max[c];
+        }
+        record.radius = mesh.bounds.radius;
+        written = written && std::fwrite(&record, sizeof(record), 1, out) == 1;
+    }
+
+    offset = sizeof(header) + meshes.size() * sizeof(MeshRecord);
+    for (const MeshData& mesh : meshes)
+    {
+        for (const Texture& texture : mesh.textures)
+        {
+            written = written && std::fwrite(texture.type.c_str(), 1, texture.type.size() + 1, out) == texture.type.size() + 1;
+            written = written && std::fwrite(texture.path.c_str(), 1, texture.path.size() + 1, out) == texture.path.size() + 1;
+        }
+        offset += textureBytes(mesh.textures);
+        written = written && pad(out, offset);
+        if (!mesh.packed.vertices.empty()) {
+            written = written && std::fwrite(mesh.packed.vertices.data(), 1, mesh.packed.vertices.size(), out) == mesh.packed.vertices.size();
+        }
+        offset += mesh.packed.vertices.size();
+        written = written && pad(out, offset);
+        if (!mesh.packed.positions.empty()) {
+            written = written && std::fwrite(mesh.packed.positions.data(), 1, mesh.packed.positions.size(), out) == mesh.packed.positions.size();
+        }
+        offset += mesh.packed.positions.size();
+        written = written && pad(out, offset);
+        if (!mesh.packedIndices.indices.empty()) {
+            written = written && std::fwrite(mesh.packedIndices.indices.data(), 1, mesh.packedIndices.indices.size(), out) == mesh.packedIndices.indices.size();
+        }
+        offset += mesh.packedIndices.indices.size();
+    }
+
+    written = std::fclose(out) == 0 && written;
+    std::remove(path.c_str());
+    if (!written || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
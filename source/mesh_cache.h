@@ -0,0 +1,48 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "env_cache.h"
+#include "mesh.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// bump when the import or the vertex layout changes, older files then count as misses
+const uint32_t MESH_CACHE_VERSION = 4;
+
+// one mesh as it comes out of the importer, packed for the GPU before it is cached
+struct MeshData {
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    PackedVertices packed;
+    PackedIndices packedIndices;
+    std::vector<Texture> textures;
+    Bounds bounds;
+    QuantizationRange quantization;
+};
+
+/* One mesh of a mapped cache file. The streams and indices point into the mapping, so
+ * they are only valid while the file stays open; the textures only carry type and path.
+ */
+struct CachedMesh {
+    VertexStreams streams;
+    const void* indices;
+    std::size_t indexCount;
+    unsigned int indexType;
+    std::vector<Texture> textures;
+    Bounds bounds;
+    QuantizationRange quantization;
+};
+
+/* Mesh cache files: a header with the version, the key of the source model, the vertex
+ * format and the mesh count, a record per mesh with its counts, bounds, quantization range and blob offsets,
+ * then the texture strings and the interleaved vertex, position and index blobs, each
+ * 16-byte aligned. A file whose header or offsets don't match is a miss and leaves
+ * meshes untouched.
+ */
+bool readMeshCache(const MappedFile& file, uint64_t key, VertexFormat format, std::vector<CachedMesh>& meshes);
+// writes the packed meshes, returns false if the file couldn't be written
+bool saveMeshCache(const std::string& path, uint64_t key, VertexFormat format, const std::vector<MeshData>& meshes);
+
+#endif
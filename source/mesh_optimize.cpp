@@ -0,0 +1,300 @@
+#include "mesh_optimize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+static const unsigned int NO_TRIANGLE = ~0u;
+static const unsigned int NO_VERTEX = ~0u;
+
+// how many of the last vertices a FIFO cache holds, tracked by the insertion time of each vertex
+class FifoCache {
+public:
+    FifoCache(std::size_t vertexCount, int size)
+        : inserted(vertexCount, 0), time(size + 1), size(size)
+    {
+    }
+
+    // returns true on a miss, which inserts the vertex
+    bool miss(unsigned int vertex)
+    {
+        if (time - inserted[vertex] <= (unsigned int)size) {
+            return false;
+        }
+        inserted[vertex] = time++;
+        return true;
+    }
+
+    // forgets all vertices
+    void flush() { time += size; }
+
+private:
+    std::vector<unsigned int> inserted;
+    unsigned int time;
+    int size;
+};
+
+void VertexCacheStatistics::add(const VertexCacheStatistics& other)
+{
+    triangles += other.triangles;
+    vertices += other.vertices;
+    transforms += other.transforms;
+}
+
+VertexCacheStatistics analyzeVertexCache(const std::vector<unsigned int>& indices, std::size_t vertexCount)
+{
+    VertexCacheStatistics statistics;
+    statistics.triangles = indices.size() / 3;
+    statistics.vertices = vertexCount;
+    statistics.transforms = 0;
+    FifoCache cache(vertexCount, ANALYZE_CACHE_SIZE);
+    for (std::size_t i = 0; i < statistics.triangles * 3; ++i)
+        statistics.transforms += cache.miss(indices[i]) ? 1 : 0;
+    return statistics;
+}
+
+// Forsyth's vertex score: recently used vertices and vertices with few triangles left score high
+static float vertexScore(int cachePosition, unsigned int remaining)
+{
+    static const int MAX_VALENCE = 32;
+    static float cacheScores[OPTIMIZE_CACHE_SIZE];
+    static float valenceScores[MAX_VALENCE + 1];
+    static bool tables = false;
+    if (!tables) {
+        for (int i = 0; i < OPTIMIZE_CACHE_SIZE; ++i)
+        {
+            // the last triangle's vertices get a fixed score, so it isn't simply repeated
+            cacheScores[i] = i < 3 ? 0.75f : std::pow(1.0f - (float)(i - 3) / (OPTIMIZE_CACHE_SIZE - 3), 1.5f);
+        }
+        for (int i = 1; i <= MAX_VALENCE; ++i)
+            valenceScores[i] = 2.0f / std::sqrt((float)i);
+        tables = true;
+    }
+
+    if (remaining == 0) {
+        return -1.0f;
+    }
+    float score = cachePosition >= 0 ? cacheScores[cachePosition] : 0.0f;
+    return score + (remaining <= (unsigned int)MAX_VALENCE ? valenceScores[remaining] : 2.0f / std::sqrt((float)remaining));
+}
+
+void optimizeVertexCache(std::vector<unsigned int>& indices, std::size_t vertexCount)
+{
+    std::size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // the triangles of every vertex, the first remaining[v] of them are not emitted yet
+    std::vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (std::size_t i = 0; i < triangleCount * 3; ++i)
+        offsets[indices[i] + 1]++;
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector<unsigned int> adjacency(triangleCount * 3);
+    std::vector<unsigned int> remaining(vertexCount, 0);
+    for (std::size_t i = 0; i < triangleCount * 3; ++i)
+    {
+        unsigned int vertex = indices[i];
+        adjacency[offsets[vertex] + remaining[vertex]++] = (unsigned int)(i / 3);
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> scores(vertexCount);
+    for (std::size_t v = 0; v < vertexCount; ++v)
+        scores[v] = vertexScore(-1, remaining[v]);
+    std::vector<float> triangleScores(triangleCount);
+    std::vector<unsigned char> emitted(triangleCount, 0);
+    unsigned int best = 0;
+    for (std::size_t t = 0; t < triangleCount; ++t)
+    {
+        const unsigned int* triangle = &indices[t * 3];
+        triangleScores[t] = scores[triangle[0]] + scores[triangle[1]] + scores[triangle[2]];
+        if (triangleScores[t] > triangleScores[best])
+            best = (unsigned int)t;
+    }
+
+    std::vector<unsigned int> optimized;
+    optimized.reserve(triangleCount * 3);
+    std::vector<unsigned int> cache, nextCache;
+    cache.reserve(OPTIMIZE_CACHE_SIZE + 3);
+    nextCache.reserve(OPTIMIZE_CACHE_SIZE + 3);
+    std::size_t cursor = 0;
+    while (best != NO_TRIANGLE)
+    {
+        emitted[best] = 1;
+        const unsigned int* triangle = &indices[best * 3];
+        // the triangle's vertices move to the front of the cache
+        nextCache.clear();
+        for (int k = 0; k < 3; ++k)
+        {
+            unsigned int vertex = triangle[k];
+            optimized.push_back(vertex);
+            // a degenerate triangle is listed once per corner
+            unsigned int* triangles = &adjacency[offsets[vertex]];
+            unsigned int* last = triangles + remaining[vertex] - 1;
+            std::iter_swap(std::find(triangles, last, best), last);
+            remaining[vertex]--;
+            if (std::find(nextCache.begin(), nextCache.end(), vertex) == nextCache.end())
+                nextCache.push_back(vertex);
+        }
+        for (unsigned int vertex : cache)
+        {
+            if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2])
+                nextCache.push_back(vertex);
+        }
+
+        for (std::size_t i = 0; i < nextCache.size(); ++i)
+        {
+            unsigned int vertex = nextCache[i];
+            cachePosition[vertex] = i < (std::size_t)OPTIMIZE_CACHE_SIZE ? (int)i : -1;
+            scores[vertex] = vertexScore(cachePosition[vertex], remaining[vertex]);
+        }
+
+        // rescore the triangles around the cache, evicted vertices included, and continue with the best of them
+        best = NO_TRIANGLE;
+        float bestScore = -1.0f;
+        for (unsigned int vertex : nextCache)
+        {
+            for (unsigned int i = 0; i < remaining[vertex]; ++i)
+            {
+                unsigned int t = adjacency[offsets[vertex] + i];
+                const unsigned int* candidate = &indices[t * 3];
+                triangleScores[t] = scores[candidate[0]] + scores[candidate[1]] + scores[candidate[2]];
+                if (triangleScores[t] > bestScore) {
+                    bestScore = triangleScores[t];
+                    best = t;
+                }
+            }
+        }
+        if (nextCache.size() > (std::size_t)OPTIMIZE_CACHE_SIZE)
+            nextCache.resize(OPTIMIZE_CACHE_SIZE);
+        cache.swap(nextCache);
+
+        // nothing left around the cache, restart at the next triangle in the original order
+        if (best == NO_TRIANGLE) {
+            while (cursor < triangleCount && emitted[cursor])
+                ++cursor;
+            best = cursor < triangleCount ? (unsigned int)cursor : NO_TRIANGLE;
+        }
+    }
+
+    std::copy(optimized.begin(), optimized.end(), indices.begin());
+}
+
+void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices)
+{
+    std::size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // cut where a cold cache doesn't cost much more than the uncut order
+    std::vector<std::size_t> clusterStarts;
+    FifoCache uncut(vertices.size(), ANALYZE_CACHE_SIZE);
+    FifoCache cluster(vertices.size(), ANALYZE_CACHE_SIZE);
+    std::size_t uncutMisses = 0, clusterMisses = 0;
+    clusterStarts.push_back(0);
+    for (std::size_t t = 0; t < triangleCount; ++t)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            unsigned int vertex = indices[t * 3 + k];
+            uncutMisses += uncut.miss(vertex) ? 1 : 0;
+            clusterMisses += cluster.miss(vertex) ? 1 : 0;
+        }
+        if (t + 1 < triangleCount && clusterMisses <= OVERDRAW_THRESHOLD * uncutMisses) {
+            clusterStarts.push_back(t + 1);
+            cluster.flush();
+            uncutMisses = clusterMisses = 0;
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+    std::size_t clusterCount = clusterStarts.size() - 1;
+
+    // area weighted centroids and normals of the clusters and of the whole mesh
+    std::vector<glm::vec3> centroids(clusterCount), normals(clusterCount);
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (std::size_t c = 0; c < clusterCount; ++c)
+    {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (std::size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t)
+        {
+            const glm::vec3& a = vertices[indices[t * 3]].Position;
+            const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& d = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 cross = glm::cross(b - a, d - a);
+            float triangleArea = glm::length(cross);
+            centroid += (a + b + d) * (triangleArea / 3.0f);
+            normal += cross;
+            area += triangleArea;
+        }
+        meshCentroid += centroid;
+        meshArea += area;
+        centroids[c] = area > 0.0f ? centroid / area : centroid;
+        normals[c] = normal;
+    }
+    meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : meshCentroid;
+
+    std::vector<float> keys(clusterCount);
+    for (std::size_t c = 0; c < clusterCount; ++c)
+    {
+        float length = glm::length(normals[c]);
+        keys[c] = length > 0.0f ? glm::dot(centroids[c] - meshCentroid, normals[c]) / length : 0.0f;
+    }
+    std::vector<std::size_t> order(clusterCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&keys](std::size_t a, std::size_t b) { return keys[a] > keys[b]; });
+
+    std::vector<unsigned int> sorted;
+    sorted.reserve(triangleCount * 3);
+    for (std::size_t c : order)
+        sorted.insert(sorted.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+    std::copy(sorted.begin(), sorted.end(), indices.begin());
+}
+
+void optimizeMesh(const MeshData& mesh, std::vector<MeshData>& chunks, VertexCacheStatistics& before, VertexCacheStatistics& after)
+{
+    std::vector<unsigned int> indices(mesh.indices.begin(), mesh.indices.begin() + mesh.indices.size() / 3 * 3);
+    before.add(analyzeVertexCache(indices, mesh.vertices.size()));
+    optimizeVertexCache(indices, mesh.vertices.size());
+    optimizeOverdraw(indices, mesh.vertices);
+
+    // split in draw order; chunkOf tells which chunk numbered a vertex last
+    std::size_t triangleCount = indices.size() / 3;
+    std::vector<unsigned int> chunkOf(mesh.vertices.size(), NO_VERTEX);
+    std::vector<unsigned int> local(mesh.vertices.size());
+    std::size_t t = 0;
+    for (unsigned int chunkIndex = 0; t < triangleCount; ++chunkIndex)
+    {
+        MeshData chunk;
+        chunk.textures = mesh.textures;
+        chunk.quantization = mesh.quantization;
+        for (; t < triangleCount; ++t)
+        {
+            const unsigned int* triangle = &indices[t * 3];
+            unsigned int added = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                bool repeated = (k > 0 && triangle[k] == triangle[0]) || (k > 1 && triangle[k] == triangle[1]);
+                added += chunkOf[triangle[k]] != chunkIndex && !repeated ? 1 : 0;
+            }
+            if (chunk.vertices.size() + added > MAX_CHUNK_VERTICES)
+                break;
+            for (int k = 0; k < 3; ++k)
+            {
+                unsigned int vertex = triangle[k];
+                if (chunkOf[vertex] != chunkIndex) {
+                    chunkOf[vertex] = chunkIndex;
+                    local[vertex] = (unsigned int)chunk.vertices.size();
+                    chunk.vertices.push_back(mesh.vertices[vertex]);
+                }
+                chunk.indices.push_back(local[vertex]);
+            }
+        }
+        chunk.bounds = computeBounds(chunk.vertices);
+        after.add(analyzeVertexCache(chunk.indices, chunk.vertices.size()));
+        chunks.push_back(std::move(chunk));
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+
+#include "mesh_cache.h"
+
+#include <cstddef>
+#include <vector>
+
+// chunks are drawn with 16-bit indices
+const unsigned int MAX_CHUNK_VERTICES = 65536;
+// LRU cache the triangle order is optimized for, and FIFO cache the statistics simulate
+const int OPTIMIZE_CACHE_SIZE = 32;
+const int ANALYZE_CACHE_SIZE = 16;
+// ACMR a triangle cluster may lose against the cache optimized order before it is cut
+const float OVERDRAW_THRESHOLD = 1.05f;
+
+/* Post-transform vertex cache efficiency: ACMR is the number of vertex shader runs per
+ * triangle (0.5 at best for a regular grid, 3 without any reuse), ATVR per vertex (1 at best).
+ */
+struct VertexCacheStatistics {
+    std::size_t triangles;
+    std::size_t vertices;
+    std::size_t transforms;
+
+    float acmr() const { return triangles ? (float)transforms / triangles : 0.0f; }
+    float atvr() const { return vertices ? (float)transforms / vertices : 0.0f; }
+    void add(const VertexCacheStatistics& other);
+};
+
+VertexCacheStatistics analyzeVertexCache(const std::vector<unsigned int>& indices, std::size_t vertexCount);
+// reorders the triangles for the post-transform cache, Forsyth's linear-speed optimizer
+void optimizeVertexCache(std::vector<unsigned int>& indices, std::size_t vertexCount);
+/* Cuts the cache optimized order into clusters wherever a cold cache costs at most
+ * OVERDRAW_THRESHOLD times the misses of the uncut order, then draws the clusters that
+ * face away from the mesh center first, as they tend to occlude the rest.
+ */
+void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices);
+
+/* Runs both on an imported mesh and appends it as chunks of at most MAX_CHUNK_VERTICES
+ * vertices, each with its own bounds for culling and the mesh's textures and quantization
+ * range. A chunk numbers its vertices in order of first use, so the vertex fetches follow
+ * the triangle order. The statistics of the mesh before and of its chunks after are added
+ * to before and after.
+ */
+void optimizeMesh(const MeshData& mesh, std::vector<MeshData>& chunks, VertexCacheStatistics& before, VertexCacheStatistics& after);
+
+#endif
@@ -15,14 +15,19 @@
 #include "stb/stb_image.h"
 
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimize.h"
 #include "shader_s.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <iomanip>
 #include <map>
 #include <vector>
+#include <limits>
+#include <algorithm>
 #include <unordered_map>
 using namespace std;
 
@@ -35,13 +40,16 @@ public:
     
     /*  Model Data */
     vector<Mesh> meshes;
+    // bounds of all meshes
+    Bounds bounds;
     string directory;
     bool gammaCorrection;
     /*  Functions   */
-    // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // constructor, expects a filepath to a 3D model. With a cache directory the imported meshes
+    // are kept there as <file>.meshcache (<file>.compact.meshcache) and later loads skip ASSIMP.
+    Model(string const &path, bool gamma = false, string const &cacheDirectory = "", VertexFormat format = VertexFormat::Full) : gammaCorrection(gamma)
     {
-        loadModel(path);
+        loadModel(path, cacheDirectory, format);
     }
 
     // draws the model, and thus all its meshes
@@ -51,29 +59,97 @@ public:
             meshes[i].draw(shader);
     }
 
+    // draws the positions of all its meshes, for depth-only passes
+    void drawDepth(Shader& shader)
+    {
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].drawDepth(shader);
+    }
+
 private:
     /*  Functions   */
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const &path)
+    void loadModel(string const &path, string const &cacheDirectory, VertexFormat format)
     {
-        // read file via ASSIMP
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-        // check for errors
-        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
-        {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
-        }
         // retrieve the directory path of the filepath
         directory = path.substr(0, path.find_last_of('/'));
 
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        // the cache is keyed on the contents of the model file
+        string cachePath = cacheDirectory.empty() ? "" : cacheDirectory + '/' + path.substr(path.find_last_of('/') + 1) +
+            (format == VertexFormat::Compact ? ".compact.meshcache" : ".meshcache");
+        uint64_t cacheKey = cachePath.empty() ? 0 : hashFile(path);
+        MappedFile cache;
+        vector<CachedMesh> cachedMeshes;
+        if (cacheKey && cache.open(cachePath) && readMeshCache(cache, cacheKey, format, cachedMeshes))
+        {
+            // the blobs go from the mapping straight into the buffers
+            for (const CachedMesh& mesh : cachedMeshes)
+            {
+                vector<Texture> textures;
+                for (const Texture& texture : mesh.textures)
+                    textures.push_back(loadMaterialTexture(texture.path, texture.type));
+                meshes.push_back(Mesh(mesh.streams, mesh.indices, mesh.indexCount, mesh.indexType, textures, mesh.bounds, mesh.quantization));
+            }
+            cache.close();
+        }
+        else
+        {
+            cache.close();
+            // read file via ASSIMP
+            Assimp::Importer importer;
+            const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+            // check for errors
+            if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+            {
+                cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+                return;
+            }
+
+            // process ASSIMP's root node recursively
+            vector<MeshData> imported;
+            processNode(scene->mRootNode, scene, imported);
+
+            // reorder for the vertex cache and overdraw, and split into chunks with 16-bit indices
+            vector<MeshData> optimized;
+            VertexCacheStatistics before = {}, after = {};
+            for (const MeshData& mesh : imported)
+                optimizeMesh(mesh, optimized, before, after);
+            imported.clear();
+            ostringstream report;
+            report << std::fixed << std::setprecision(3) << "Optimized " << path << ": " << before.triangles << " triangles in " << optimized.size() << " meshes, ACMR "
+                << before.acmr() << " -> " << after.acmr() << ", ATVR " << before.atvr() << " -> " << after.atvr();
+            cout << report.str() << endl;
+
+            for (MeshData& mesh : optimized)
+            {
+                // tangents are only kept for normal mapping
+                bool normalMapped = std::any_of(mesh.textures.begin(), mesh.textures.end(), [](const Texture& texture) { return texture.type == "texture_normal"; });
+                packVertices(mesh.vertices, format, normalMapped, mesh.quantization, mesh.packed);
+                packIndices(mesh.indices, mesh.vertices.size(), mesh.packedIndices);
+                meshes.push_back(Mesh(vertexStreams(mesh.packed), mesh.packedIndices.indices.data(), mesh.indices.size(), mesh.packedIndices.type, mesh.textures, mesh.bounds, mesh.quantization));
+            }
+
+            if (cacheKey && !saveMeshCache(cachePath, cacheKey, format, optimized)) {
+                cout << "Failed to write mesh cache " << cachePath << endl;
+            }
+        }
+
+        // combine the bounds of the meshes: box around the boxes, sphere around the spheres
+        bounds.min = glm::vec3(std::numeric_limits<float>::max());
+        bounds.max = glm::vec3(-std::numeric_limits<float>::max());
+        for (const Mesh& mesh : meshes)
+        {
+            bounds.min = glm::min(bounds.min, mesh.bounds.min);
+            bounds.max = glm::max(bounds.max, mesh.bounds.max);
+        }
+        bounds.center = meshes.empty() ? glm::vec3(0.0f) : 0.5f * (bounds.min + bounds.max);
+        bounds.radius = 0.0f;
+        for (const Mesh& mesh : meshes)
+            bounds.radius = std::max(bounds.radius, glm::length(mesh.bounds.center - bounds.center) + mesh.bounds.radius);
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    void processNode(aiNode *node, const aiScene *scene, vector<MeshData> &imported)
     {
         // process each mesh located at the current node
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -81,21 +157,22 @@ private:
             // the node object only contains indices to index the actual objects in the scene. 
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            imported.push_back(processMesh(mesh, scene));
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, imported);
         }
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    MeshData processMesh(aiMesh *mesh, const aiScene *scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        MeshData data;
+        vector<Vertex>& vertices = data.vertices;
+        vector<unsigned int>& indices = data.indices;
+        vector<Texture>& textures = data.textures;
         // Walk through each of the mesh's vertices
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
@@ -152,6 +229,9 @@ private:
     
             vertices.push_back(vertex);        
         }
+        data.bounds = computeBounds(vertices);
+        data.quantization.min = data.bounds.min;
+        data.quantization.max = data.bounds.max;
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
         for (unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
@@ -183,8 +263,8 @@ private:
         std::vector<Texture> reflectionMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_reflection");
         textures.insert(textures.end(), reflectionMaps.begin(), reflectionMaps.end());
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // loadModel optimizes and packs the extracted data, then uploads and caches it
+        return data;
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -196,20 +276,24 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            if (textures_loaded.find(str.C_Str()) != textures_loaded.end()) {
-                textures.push_back(textures_loaded[str.C_Str()]);
-            }
-            else {
-                Texture texture;
-                texture.id = textureFromFile(str.C_Str(), this->directory, type == aiTextureType_HEIGHT);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded[str.C_Str()] = texture;
-            }
+            textures.push_back(loadMaterialTexture(str.C_Str(), typeName));
         }
         return textures;
     }
+
+    // loads a texture of the model's directory unless it was loaded already
+    Texture loadMaterialTexture(const string &path, const string &typeName)
+    {
+        if (textures_loaded.find(path) != textures_loaded.end()) {
+            return textures_loaded[path];
+        }
+        Texture texture;
+        texture.id = textureFromFile(path.c_str(), this->directory, typeName == "texture_normal");
+        texture.type = typeName;
+        texture.path = path;
+        textures_loaded[path] = texture;
+        return texture;
+    }
 };
 
 unsigned int textureFromFile(const char *path, const string &directory, bool gamma)
@@ -0,0 +1,323 @@
+#include "sat_backend.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <new>
+
+// ComputeScanSATBackend
+// ---------------------
+ComputeScanSATBackend::ComputeScanSATBackend(Shader& computeSAT, Shader& scanBlocks, Shader& scanBlockSums, Shader& addBlockSums, bool multiBlock)
+    : computeSAT(computeSAT), scanBlocks(scanBlocks), scanBlockSums(scanBlockSums), addBlockSums(addBlockSums),
+      multiBlock(multiBlock), blockSums(0), blockSumsWidth(0), blockSumsHeight(0)
+{
+}
+
+const char* ComputeScanSATBackend::name() const
+{
+    return multiBlock ? "Multi-block compute scan" : "Compute scan";
+}
+
+const char* ComputeScanSATBackend::id() const
+{
+    return multiBlock ? "multiblock" : "compute";
+}
+
+void ComputeScanSATBackend::generate(FrameBuffer& moments, FrameBuffer& sat, int width, int height)
+{
+    if (!multiBlock && width <= (int)SAT_BLOCK_SIZE && height <= (int)SAT_BLOCK_SIZE) {
+        // compute shader SAT generation as described in OpenGL SuperBible 7th Edition (CH 10)
+        computeSAT.use();
+        moments.bindImage(0, 0, GL_RG32F);
+        sat.bindImage(1, 0, GL_RG32F);
+        glDispatchCompute(height, 1, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        sat.bindImage(0, 0, GL_RG32F);
+        sat.bindImage(1, 1, GL_RG32F);
+        glDispatchCompute(width, 1, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        return;
+    }
+
+    // per-row block totals, one texel per SAT_BLOCK_SIZE texels of the longer side
+    int rows = std::max(width, height);
+    int blocks = (rows + SAT_BLOCK_SIZE - 1) / SAT_BLOCK_SIZE;
+    if (blockSums == 0 || blockSumsWidth != blocks || blockSumsHeight != rows) {
+        release();
+        glGenTextures(1, &blockSums);
+        glBindTexture(GL_TEXTURE_2D, blockSums);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32F, blocks, rows);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        blockSumsWidth = blocks;
+        blockSumsHeight = rows;
+    }
+
+    // hierarchical scan: block scan, block-sum scan and uniform add for each direction,
+    // so the dispatch count stays the same for any shadow map size
+    glBindImageTexture(2, blockSums, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RG32F);
+    moments.bindImage(0, 0, GL_RG32F);
+    sat.bindImage(1, 0, GL_RG32F);
+    multiBlockSATPass(scanBlocks, scanBlockSums, addBlockSums, width, height);
+    sat.bindImage(0, 0, GL_RG32F);
+    sat.bindImage(1, 1, GL_RG32F);
+    multiBlockSATPass(scanBlocks, scanBlockSums, addBlockSums, height, width);
+}
+
+void ComputeScanSATBackend::release()
+{
+    if (blockSums != 0) {
+        glDeleteTextures(1, &blockSums);
+        blockSums = 0;
+    }
+}
+
+// CoalescedSATBackend
+// -------------------
+CoalescedSATBackend::CoalescedSATBackend(Shader& scanTransposed)
+    : scanTransposed(scanTransposed)
+{
+}
+
+void CoalescedSATBackend::generate(FrameBuffer& moments, FrameBuffer& sat, int width, int height)
+{
+    // one band of SAT_TRANSPOSE_TILE rows per workgroup, any row length
+    scanTransposed.use();
+    moments.bindImage(0, 0, GL_RG32F);
+    sat.bindImage(1, 0, GL_RG32F);
+    glDispatchCompute((height + SAT_TRANSPOSE_TILE - 1) / SAT_TRANSPOSE_TILE, 1, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    sat.bindImage(0, 0, GL_RG32F);
+    sat.bindImage(1, 1, GL_RG32F);
+    glDispatchCompute((width + SAT_TRANSPOSE_TILE - 1) / SAT_TRANSPOSE_TILE, 1, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+// RecursiveDoublingSATBackend
+// ---------------------------
+RecursiveDoublingSATBackend::RecursiveDoublingSATBackend(Shader& horizontal, Shader& vertical, void (*renderQuad)())
+    : horizontal(horizontal), vertical(vertical), renderQuad(renderQuad), targetWidth(0), targetHeight(0)
+{
+}
+
+void RecursiveDoublingSATBackend::generate(FrameBuffer& moments, FrameBuffer& sat, int width, int height)
+{
+    if (targetWidth != width || targetHeight != height) {
+        for (int i = 0; i < 2; ++i)
+        {
+            pingPong[i].reset(new FrameBuffer(width, height));
+            pingPong[i]->attachTexture(GL_RG32F);
+        }
+        targetWidth = width;
+        targetHeight = height;
+    }
+
+    // pass k adds the texel 2^k to the left (above), so ceil(log2(size)) passes cover a row (column)
+    int horizontalPasses = 0, verticalPasses = 0;
+    while ((1 << horizontalPasses) < width)
+        ++horizontalPasses;
+    while ((1 << verticalPasses) < height)
+        ++verticalPasses;
+
+    glViewport(0, 0, width, height);
+    glActiveTexture(GL_TEXTURE0);
+    moments.bindInput(0);
+    int target = 0;
+    for (int pass = 0; pass < horizontalPasses + verticalPasses; ++pass)
+    {
+        Shader& shader = pass < horizontalPasses ? horizontal : vertical;
+        pingPong[target]->bindOutput();
+        shader.use();
+        shader.setUniformInt("iteration", pass < horizontalPasses ? pass : pass - horizontalPasses);
+        renderQuad();
+        glActiveTexture(GL_TEXTURE0);
+        pingPong[target]->bindInput(0);
+        target = 1 - target;
+    }
+
+    // the last target is still bound for drawing, copy it into the SAT attachment
+    glActiveTexture(GL_TEXTURE0);
+    if (horizontalPasses + verticalPasses == 0) {
+        moments.bindOutput();
+    }
+    sat.bindInput(1);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+    FrameBuffer::unbind();
+}
+
+// CpuSATBackend
+// -------------
+CpuSATBackend::CpuSATBackend(CpuSAT& cpuSAT)
+    : cpuSAT(cpuSAT)
+{
+}
+
+void CpuSATBackend::generate(FrameBuffer& momentsBuffer, FrameBuffer& sat, int width, int height)
+{
+    // read the moments back and build the SAT with the CPU engine
+    readbackTexture(momentsBuffer, 0, width, height, moments);
+    texels.resize(moments.size());
+    scratch.resize(moments.size());
+    cpuSAT.generate(moments.data(), scratch.data(), texels.data(), width, height);
+    uploadTexture(sat, 1, width, height, texels);
+}
+
+// one direction of the multi-block SAT scan: scans the rows of image unit 0 and writes the
+// result transposed into image unit 1, with the block totals in image unit 2
+// -----------------------------------------------------------------------------------------
+void multiBlockSATPass(Shader& scanBlocks, Shader& scanBlockSums, Shader& addBlockSums, int rowLength, int rowCount)
+{
+    int blockCount = (rowLength + SAT_BLOCK_SIZE - 1) / SAT_BLOCK_SIZE;
+
+    scanBlocks.use();
+    glDispatchCompute(blockCount, rowCount, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    if (blockCount == 1) {
+        // the whole row fit in one block, there are no offsets to add
+        return;
+    }
+
+    scanBlockSums.use();
+    scanBlockSums.setUniformInt("blockCount", blockCount);
+    scanBlockSums.setUniformInt("rowCount", rowCount);
+    glDispatchCompute((rowCount + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    addBlockSums.use();
+    glDispatchCompute(blockCount - 1, rowCount, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+// utility functions for moving RG32F frame buffer attachments between the GPU and the CPU
+// ---------------------------------------------------------------------------------------
+void readbackTexture(FrameBuffer& frameBuffer, int attachment, int width, int height, std::vector<float>& texels)
+{
+    texels.resize((size_t)width * height * 2);
+    glActiveTexture(GL_TEXTURE0);
+    frameBuffer.bindInput(attachment);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_FLOAT, texels.data());
+}
+
+void uploadTexture(FrameBuffer& frameBuffer, int attachment, int width, int height, const std::vector<float>& texels)
+{
+    glActiveTexture(GL_TEXTURE0);
+    frameBuffer.bindInput(attachment);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RG, GL_FLOAT, texels.data());
+}
+
+int findSATBackend(const std::vector<SATBackend*>& backends, const char* name)
+{
+    for (size_t i = 0; i < backends.size(); ++i)
+    {
+        if (std::strcmp(backends[i]->id(), name) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+// largest difference of a SAT to the double precision SAT of moments
+// ------------------------------------------------------------------
+static double maxReferenceError(const std::vector<float>& moments, const std::vector<float>& sat, int size)
+{
+    // SAT(x, y) = SAT(x, y - 1) + prefix of row y up to x
+    std::vector<double> previousRow((size_t)size * 2, 0.0);
+    double maxError = 0.0;
+    for (int y = 0; y < size; ++y)
+    {
+        double rowSum[2] = { 0.0, 0.0 };
+        for (int x = 0; x < size; ++x)
+        {
+            for (int c = 0; c < 2; ++c)
+            {
+                size_t i = ((size_t)y * size + x) * 2 + c;
+                rowSum[c] += moments[i];
+                previousRow[x * 2 + c] += rowSum[c];
+                maxError = std::max(maxError, std::abs(previousRow[x * 2 + c] - double(sat[i])));
+            }
+        }
+    }
+    return maxError;
+}
+
+void benchmarkSATBackends(const std::vector<SATBackend*>& backends, std::ostream& out)
+{
+    out << "SAT backend benchmark: " << glGetString(GL_RENDERER) << std::endl;
+    out << std::setprecision(3);
+
+    for (int size = 512; size <= 4096; size *= 2)
+    {
+        size_t texels = (size_t)size * size;
+        std::vector<float> moments, sat, firstSAT;
+        try {
+            moments.resize(texels * 2);
+        }
+        catch (const std::bad_alloc&) {
+            out << std::setw(5) << size << "^2  skipped (not enough memory)" << std::endl;
+            continue;
+        }
+
+        // centered moments of a blocky depth pattern, like varianceShadowMap.glsl writes
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+            {
+                float depth = float(((x >> 3) ^ (y >> 3)) & 255) / 255.0f;
+                float* texel = &moments[((size_t)y * size + x) * 2];
+                texel[0] = depth - 0.5f;
+                texel[1] = depth * depth - 0.5f;
+            }
+        }
+
+        FrameBuffer momentsBuffer(size, size);
+        momentsBuffer.attachTexture(GL_RG32F);
+        FrameBuffer satBuffer(size, size);
+        satBuffer.attachTexture(GL_RG32F);
+        satBuffer.attachTexture(GL_RG32F);
+        uploadTexture(momentsBuffer, 0, size, size, moments);
+
+        for (size_t b = 0; b < backends.size(); ++b)
+        {
+            // warm up: allocates the backend's resources for this size and compiles lazily built state
+            backends[b]->generate(momentsBuffer, satBuffer, size, size);
+            glFinish();
+
+            int iterations = 0;
+            double seconds = 0.0;
+            auto start = std::chrono::high_resolution_clock::now();
+            while (iterations < 3 || seconds < 0.25)
+            {
+                backends[b]->generate(momentsBuffer, satBuffer, size, size);
+                glFinish();
+                ++iterations;
+                seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            }
+            double ms = 1000.0 * seconds / iterations;
+            double msamples = double(texels) * iterations / seconds / 1.0e6;
+
+            readbackTexture(satBuffer, 1, size, size, sat);
+            double referenceError = maxReferenceError(moments, sat, size);
+            double firstDifference = 0.0;
+            if (b == 0) {
+                firstSAT.swap(sat);
+            }
+            else {
+                for (size_t i = 0; i < firstSAT.size(); ++i)
+                    firstDifference = std::max(firstDifference, (double)std::abs(firstSAT[i] - sat[i]));
+            }
+
+            out << std::setw(5) << size << "^2  " << std::setw(30) << std::left << backends[b]->name() << std::right
+                << std::fixed << std::setprecision(2) << std::setw(10) << ms << " ms  " << std::setw(10) << msamples << " Msamples/s"
+                << std::scientific << std::setprecision(2) << "  max error " << referenceError;
+            if (b > 0) {
+                out << ", vs " << backends[0]->id() << " " << firstDifference;
+            }
+            out << std::endl;
+        }
+        FrameBuffer::unbind();
+    }
+    for (SATBackend* backend : backends)
+        backend->release();
+}
@@ -0,0 +1,123 @@
+#ifndef SAT_BACKEND_H
+#define SAT_BACKEND_H
+
+#include "shader_s.h"
+#include "framebuffer.h"
+#include "cpu_sat.h"
+
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// rows per workgroup (and tile edge) of the coalesced SAT scan, computeSAT.ScanTransposed
+const unsigned int SAT_TRANSPOSE_TILE = 32;
+
+/* One way of building the RG32F summed-area table of the shadow moments.
+ * All backends read attachment 0 of the moments frame buffer and leave the SAT in
+ * attachment 1 of the SAT frame buffer, which is what the lighting pass samples;
+ * attachment 0 of the SAT frame buffer is scratch. Size-dependent resources are
+ * created on the first generate() of a size, so one backend can serve the shadow
+ * map and the benchmark.
+ */
+class SATBackend {
+public:
+    virtual ~SATBackend() {}
+
+    // name shown in ImGui and the benchmark
+    virtual const char* name() const = 0;
+    // name for --sat-backend
+    virtual const char* id() const = 0;
+
+    virtual void generate(FrameBuffer& moments, FrameBuffer& sat, int width, int height) = 0;
+
+    // true if the result is bit-identical to CpuSAT with ScanOrder::ComputeShader
+    virtual bool matchesComputeShaderOrder() const { return false; }
+    // deletes the GL objects the backend created, call it while the context is still current
+    virtual void release() {}
+};
+
+// computeSAT.ComputeSAT, one workgroup per row; rows longer than SAT_BLOCK_SIZE (or all rows
+// with multiBlock) use the block scan, block-sum scan and uniform add of multiBlockSATPass()
+class ComputeScanSATBackend : public SATBackend {
+public:
+    ComputeScanSATBackend(Shader& computeSAT, Shader& scanBlocks, Shader& scanBlockSums, Shader& addBlockSums, bool multiBlock);
+
+    const char* name() const override;
+    const char* id() const override;
+    void generate(FrameBuffer& moments, FrameBuffer& sat, int width, int height) override;
+    bool matchesComputeShaderOrder() const override { return true; }
+    void release() override;
+
+private:
+    Shader& computeSAT;
+    Shader& scanBlocks;
+    Shader& scanBlockSums;
+    Shader& addBlockSums;
+    bool multiBlock;
+    unsigned int blockSums;
+    int blockSumsWidth, blockSumsHeight;
+};
+
+// computeSAT.ScanTransposed, scan and transpose in shared memory with coalesced stores
+class CoalescedSATBackend : public SATBackend {
+public:
+    explicit CoalescedSATBackend(Shader& scanTransposed);
+
+    const char* name() const override { return "Coalesced compute scan"; }
+    const char* id() const override { return "coalesced"; }
+    void generate(FrameBuffer& moments, FrameBuffer& sat, int width, int height) override;
+
+private:
+    Shader& scanTransposed;
+};
+
+// Hensley's recursive doubling (SAT.glsl): log2(width) horizontal and log2(height) vertical
+// fragment passes ping-ponging between two render targets, then a copy into the SAT;
+// renderQuad draws the fullscreen quad of a pass
+class RecursiveDoublingSATBackend : public SATBackend {
+public:
+    RecursiveDoublingSATBackend(Shader& horizontal, Shader& vertical, void (*renderQuad)());
+
+    const char* name() const override { return "Recursive doubling (Hensley)"; }
+    const char* id() const override { return "doubling"; }
+    void generate(FrameBuffer& moments, FrameBuffer& sat, int width, int height) override;
+
+private:
+    Shader& horizontal;
+    Shader& vertical;
+    void (*renderQuad)();
+    std::unique_ptr<FrameBuffer> pingPong[2];
+    int targetWidth, targetHeight;
+};
+
+// reads the moments back, builds the SAT with CpuSAT and uploads it again
+class CpuSATBackend : public SATBackend {
+public:
+    explicit CpuSATBackend(CpuSAT& cpuSAT);
+
+    const char* name() const override { return "CPU (SIMD, threaded)"; }
+    const char* id() const override { return "cpu"; }
+    void generate(FrameBuffer& moments, FrameBuffer& sat, int width, int height) override;
+
+private:
+    CpuSAT& cpuSAT;
+    std::vector<float> moments, scratch, texels;
+};
+
+// one direction of the multi-block SAT scan: scans the rows of image unit 0 and writes the
+// result transposed into image unit 1, with the block totals in image unit 2
+void multiBlockSATPass(Shader& scanBlocks, Shader& scanBlockSums, Shader& addBlockSums, int rowLength, int rowCount);
+
+// utility functions for moving RG32F frame buffer attachments between the GPU and the CPU
+void readbackTexture(FrameBuffer& frameBuffer, int attachment, int width, int height, std::vector<float>& texels);
+void uploadTexture(FrameBuffer& frameBuffer, int attachment, int width, int height, const std::vector<float>& texels);
+
+// index of the backend whose id() is name, or -1
+int findSATBackend(const std::vector<SATBackend*>& backends, const char* name);
+
+/* Times every backend on 512^2 - 4096^2 maps and checks the results against a double
+ * precision reference and against the first backend. Needs a current GL 4.3 context.
+ */
+void benchmarkSATBackends(const std::vector<SATBackend*>& backends, std::ostream& out);
+
+#endif
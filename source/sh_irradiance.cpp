@@ -0,0 +1,186 @@
+#include "sh_irradiance.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+#define SH_IRRADIANCE_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SH_IRRADIANCE_SSE
+#include <emmintrin.h>
+#endif
+
+static const double PI = 3.14159265358979323846;
+// rows one task projects
+static const int ROWS_PER_TASK = 16;
+// column functions a row is reduced against: 1, cos(phi), sin(phi), cos^2, sin^2, cos * sin
+static const int TERMS = 6;
+
+// sums[c * TERMS + t] = sum over the row of channel c * term t (term 0 is 1 and isn't stored)
+static void reduceRow(const float* red, const float* green, const float* blue, const float* columnTerms, int width, double sums[3 * TERMS])
+{
+    const float* channels[3] = { red, green, blue };
+    float partial[3 * TERMS] = {};
+    int x = 0;
+#if defined(SH_IRRADIANCE_AVX)
+    __m256 acc[3 * TERMS];
+    for (int i = 0; i < 3 * TERMS; ++i)
+        acc[i] = _mm256_setzero_ps();
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256 terms[TERMS - 1];
+        for (int t = 1; t < TERMS; ++t)
+            terms[t - 1] = _mm256_loadu_ps(columnTerms + (size_t)(t - 1) * width + x);
+        for (int c = 0; c < 3; ++c)
+        {
+            __m256 v = _mm256_loadu_ps(channels[c] + x);
+            acc[c * TERMS] = _mm256_add_ps(acc[c * TERMS], v);
+            for (int t = 1; t < TERMS; ++t)
+                acc[c * TERMS + t] = _mm256_add_ps(acc[c * TERMS + t], _mm256_mul_ps(v, terms[t - 1]));
+        }
+    }
+    for (int i = 0; i < 3 * TERMS; ++i)
+    {
+        float lanes[8];
+        _mm256_storeu_ps(lanes, acc[i]);
+        for (int l = 0; l < 8; ++l)
+            partial[i] += lanes[l];
+    }
+#elif defined(SH_IRRADIANCE_SSE)
+    __m128 acc[3 * TERMS];
+    for (int i = 0; i < 3 * TERMS; ++i)
+        acc[i] = _mm_setzero_ps();
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128 terms[TERMS - 1];
+        for (int t = 1; t < TERMS; ++t)
+            terms[t - 1] = _mm_loadu_ps(columnTerms + (size_t)(t - 1) * width + x);
+        for (int c = 0; c < 3; ++c)
+        {
+            __m128 v = _mm_loadu_ps(channels[c] + x);
+            acc[c * TERMS] = _mm_add_ps(acc[c * TERMS], v);
+            for (int t = 1; t < TERMS; ++t)
+                acc[c * TERMS + t] = _mm_add_ps(acc[c * TERMS + t], _mm_mul_ps(v, terms[t - 1]));
+        }
+    }
+    for (int i = 0; i < 3 * TERMS; ++i)
+    {
+        float lanes[4];
+        _mm_storeu_ps(lanes, acc[i]);
+        for (int l = 0; l < 4; ++l)
+            partial[i] += lanes[l];
+    }
+#endif
+    for (; x < width; ++x)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            float v = channels[c][x];
+            partial[c * TERMS] += v;
+            for (int t = 1; t < TERMS; ++t)
+                partial[c * TERMS + t] += v * columnTerms[(size_t)(t - 1) * width + x];
+        }
+    }
+    for (int i = 0; i < 3 * TERMS; ++i)
+        sums[i] = partial[i];
+}
+
+SHIrradiance::SHIrradiance(unsigned int threadCount)
+    : pool(threadCount), columnWidth(0)
+{
+}
+
+void SHIrradiance::project(const float* texels, int width, int height, int components, glm::vec3 coefficients[SH_COEFFICIENTS])
+{
+    // the column terms only depend on the width, the HDR skyboxes all share one
+    if (columnWidth != width) {
+        columnTerms.resize((size_t)(TERMS - 1) * width);
+        for (int x = 0; x < width; ++x)
+        {
+            double phi = ((x + 0.5) / width - 0.5) * 2.0 * PI;
+            double c = std::cos(phi), s = std::sin(phi);
+            columnTerms[x] = float(c);
+            columnTerms[(size_t)width + x] = float(s);
+            columnTerms[(size_t)2 * width + x] = float(c * c);
+            columnTerms[(size_t)3 * width + x] = float(s * s);
+            columnTerms[(size_t)4 * width + x] = float(c * s);
+        }
+        columnWidth = width;
+    }
+
+    // radiance coefficients per task, summed in task order so the result doesn't depend on scheduling
+    int tasks = (height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+    std::vector<double> partials((size_t)tasks * SH_COEFFICIENTS * 3, 0.0);
+    const float* terms = columnTerms.data();
+    pool.parallelFor(tasks, 1, [=, &partials](int first, int last) {
+        thread_local std::vector<float> row;
+        row.resize((size_t)3 * width);
+        float* red = row.data();
+        float* green = red + width;
+        float* blue = green + width;
+
+        for (int task = first; task < last; ++task)
+        {
+            double* L = partials.data() + (size_t)task * SH_COEFFICIENTS * 3;
+            int yEnd = std::min(height, (task + 1) * ROWS_PER_TASK);
+            for (int y = task * ROWS_PER_TASK; y < yEnd; ++y)
+            {
+                const float* in = texels + (size_t)y * width * components;
+                for (int x = 0; x < width; ++x)
+                {
+                    red[x] = in[x * components];
+                    green[x] = in[x * components + 1];
+                    blue[x] = in[x * components + 2];
+                }
+                double sums[3 * TERMS];
+                reduceRow(red, green, blue, terms, width, sums);
+
+                // direction (cos(theta) cos(phi), sin(theta), cos(theta) sin(phi)) with theta the
+                // elevation, texel solid angle (2 PI / width) (PI / height) cos(theta)
+                double theta = ((y + 0.5) / height - 0.5) * PI;
+                double ct = std::cos(theta), st = std::sin(theta);
+                double w = (2.0 * PI / width) * (PI / height) * ct;
+                for (int c = 0; c < 3; ++c)
+                {
+                    const double* S = sums + c * TERMS;
+                    // basis without its constants: 1, y, z, x, xy, yz, 3z^2 - 1, xz, x^2 - y^2
+                    L[0 * 3 + c] += w * S[0];
+                    L[1 * 3 + c] += w * st * S[0];
+                    L[2 * 3 + c] += w * ct * S[2];
+                    L[3 * 3 + c] += w * ct * S[1];
+                    L[4 * 3 + c] += w * ct * st * S[1];
+                    L[5 * 3 + c] += w * st * ct * S[2];
+                    L[6 * 3 + c] += w * (3.0 * ct * ct * S[4] - S[0]);
+                    L[7 * 3 + c] += w * ct * ct * S[5];
+                    L[8 * 3 + c] += w * (ct * ct * S[3] - st * st * S[0]);
+                }
+            }
+        }
+    });
+
+    // squared basis constants (one for the projection, one for the evaluation) times the
+    // cosine lobe convolution A_l / PI = 1, 2/3, 1/4
+    static const double K[SH_COEFFICIENTS] = { 0.282095, 0.488603, 0.488603, 0.488603, 1.092548, 1.092548, 0.315392, 1.092548, 0.546274 };
+    static const double A[SH_COEFFICIENTS] = { 1.0, 2.0 / 3.0, 2.0 / 3.0, 2.0 / 3.0, 0.25, 0.25, 0.25, 0.25, 0.25 };
+    for (int i = 0; i < SH_COEFFICIENTS; ++i)
+    {
+        double sum[3] = { 0.0, 0.0, 0.0 };
+        for (int task = 0; task < tasks; ++task)
+            for (int c = 0; c < 3; ++c)
+                sum[c] += partials[((size_t)task * SH_COEFFICIENTS + i) * 3 + c];
+        double scale = K[i] * K[i] * A[i];
+        coefficients[i] = glm::vec3(float(sum[0] * scale), float(sum[1] * scale), float(sum[2] * scale));
+    }
+}
+
+const char* SHIrradiance::simdPath()
+{
+#if defined(SH_IRRADIANCE_AVX)
+    return "AVX";
+#elif defined(SH_IRRADIANCE_SSE)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,41 @@
+#ifndef SH_IRRADIANCE_H
+#define SH_IRRADIANCE_H
+
+#include "thread_pool.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// coefficients of the 3-band (l <= 2) spherical harmonics irradiance
+const int SH_COEFFICIENTS = 9;
+
+/* Diffuse irradiance of an HDR environment as 9 spherical harmonics coefficients
+ * (Ramamoorthi and Hanrahan, "An Efficient Representation for Irradiance Environment
+ * Maps"). The equirectangular image is projected onto the SH basis directly, so no
+ * cubemap convolution is needed: rows are spread over a pool of worker threads and
+ * every row is reduced against precomputed per-column terms with AVX/SSE.
+ */
+class SHIrradiance {
+public:
+    // threadCount == 0 uses one thread per hardware thread
+    explicit SHIrradiance(unsigned int threadCount = 0);
+
+    /* Project a width x height equirectangular image with components floats per texel, laid
+     * out like it is uploaded to GL (row 0 at v = 0, see equirectToCubemap.glsl).
+     * coefficients receive irradiance / PI with the basis constants folded in, so
+     * irradianceSH() in deferredSASVSM.glsl evaluates it with one polynomial.
+     */
+    void project(const float* texels, int width, int height, int components, glm::vec3 coefficients[SH_COEFFICIENTS]);
+
+    // Name of the vector instruction set the row reductions were compiled for
+    static const char* simdPath();
+
+private:
+    ThreadPool pool;
+    // per-column cos(phi), sin(phi), cos^2, sin^2 and cos * sin of the image last projected
+    std::vector<float> columnTerms;
+    int columnWidth;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "shadow_atlas.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <iostream>
+
+// image units of computeSAT.ScanArray
+const unsigned int SCAN_INPUT_UNIT = 3;
+const unsigned int SCAN_OUTPUT_UNIT = 4;
+
+// texture array of size x size x layers texels, sampled with filter and a zero border like satBuffer
+static unsigned int createLayers(GLenum format, int size, int layers, GLint filter)
+{
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, format, size, size, layers);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    float borderColor[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+    return texture;
+}
+
+ShadowAtlas::ShadowAtlas(int size, int layerCount)
+    : atlasSize(size), allocated(layerCount, false)
+{
+    moments = createLayers(GL_RG32F, size, layerCount, GL_NEAREST);
+    scratch = createLayers(GL_RG32F, size, layerCount, GL_NEAREST);
+    sat = createLayers(GL_RG32F, size, layerCount, GL_LINEAR);
+    depth = createLayers(GL_DEPTH_COMPONENT32F, size, layerCount, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // whole arrays attached, so gl_Layer picks the layer a primitive goes to
+    glGenFramebuffers(1, &frameBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, moments, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ERROR::SHADOW_ATLAS:: Layered framebuffer is not complete!" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(1, &lightBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, layerCount * sizeof(ShadowedLightGPU), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void ShadowAtlas::release()
+{
+    unsigned int textures[] = { moments, scratch, sat, depth };
+    glDeleteTextures(4, textures);
+    glDeleteFramebuffers(1, &frameBuffer);
+    glDeleteBuffers(1, &lightBuffer);
+}
+
+int ShadowAtlas::allocate()
+{
+    for (int layer = 0; layer < (int)allocated.size(); ++layer)
+    {
+        if (!allocated[layer]) {
+            allocated[layer] = true;
+            return layer;
+        }
+    }
+    return -1;
+}
+
+void ShadowAtlas::free(int layer)
+{
+    if (layer >= 0 && layer < (int)allocated.size()) {
+        allocated[layer] = false;
+    }
+}
+
+int ShadowAtlas::usedLayers() const
+{
+    int layers = 0;
+    for (int layer = 0; layer < (int)allocated.size(); ++layer)
+    {
+        if (allocated[layer]) {
+            layers = layer + 1;
+        }
+    }
+    return layers;
+}
+
+void ShadowAtlas::uploadLights(const std::vector<ShadowedLightGPU>& lights)
+{
+    size_t count = std::min(lights.size(), allocated.size());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(ShadowedLightGPU), lights.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void ShadowAtlas::bindLights(unsigned int binding) const
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, lightBuffer);
+}
+
+void ShadowAtlas::beginMoments()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
+    glViewport(0, 0, atlasSize, atlasSize);
+    // centered moments of depth 1, like a light pass that hit nothing
+    const float farMoments[] = { 0.5f, 0.5f, 0.0f, 0.0f };
+    const float farDepth = 1.0f;
+    glClearBufferfv(GL_COLOR, 0, farMoments);
+    glClearBufferfv(GL_DEPTH, 0, &farDepth);
+}
+
+void ShadowAtlas::buildSATs(Shader& scanArray, int layers)
+{
+    if (layers <= 0) {
+        return;
+    }
+    // same two passes as ComputeSAT: scan the rows and store them transposed, twice
+    scanArray.use();
+    glBindImageTexture(SCAN_INPUT_UNIT, moments, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RG32F);
+    glBindImageTexture(SCAN_OUTPUT_UNIT, scratch, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RG32F);
+    glDispatchCompute(atlasSize, 1, layers);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    glBindImageTexture(SCAN_INPUT_UNIT, scratch, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RG32F);
+    glBindImageTexture(SCAN_OUTPUT_UNIT, sat, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RG32F);
+    glDispatchCompute(atlasSize, 1, layers);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
@@ -0,0 +1,60 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include "shader_s.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// one shadowed light as the shaders read it, ShadowedLight in varianceShadowMap.glsl and
+// deferredSASVSM.glsl (std430)
+struct ShadowedLightGPU {
+    glm::mat4 lightSpaceMatrix;
+    glm::vec4 position;     // w = 0 for a directional light, 1 for a spot light
+    glm::vec4 direction;    // direction the light shines in, w = cosine of the spot cone's half angle
+    glm::vec4 color;        // color * intensity, w = layer of the light in the atlas
+};
+
+/* Moments and summed-area tables of many shadowed lights, one layer of two RG32F texture
+ * arrays per light. All layers are rendered in one layered pass (varianceShadowMap.GeometryLayered
+ * sends every triangle to the layer of each light) and all SATs are built by the two dispatches
+ * of computeSAT.ScanArray with one workgroup Z slice per layer, so the number of passes and
+ * dispatches doesn't depend on the number of lights. Layers are handed out by allocate()/free().
+ * Needs a current OpenGL 4.3 context for construction and all calls.
+ */
+class ShadowAtlas {
+public:
+    ShadowAtlas(int size, int layerCount);
+    // deletes the textures, frame buffer and light buffer, call it while the context is still current
+    void release();
+
+    int size() const { return atlasSize; }
+    // a free layer, or -1 if all layers are taken
+    int allocate();
+    void free(int layer);
+    // one past the highest allocated layer, the layers buildSATs() has to scan
+    int usedLayers() const;
+
+    // light table read by the layered pass and the lighting pass, at most layerCount lights
+    void uploadLights(const std::vector<ShadowedLightGPU>& lights);
+    void bindLights(unsigned int binding) const;
+
+    // binds the layered frame buffer and sets the viewport; all layers are cleared to
+    // the moments of the far plane
+    void beginMoments();
+    // SATs of the first layers layers of the moments, the result is in satTexture()
+    void buildSATs(Shader& scanArray, int layers);
+
+    unsigned int momentsTexture() const { return moments; }
+    unsigned int satTexture() const { return sat; }
+
+private:
+    int atlasSize;
+    std::vector<bool> allocated;
+    unsigned int moments, scratch, sat, depth;
+    unsigned int frameBuffer;
+    unsigned int lightBuffer;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include "shadow_cache.h"
+
+ShadowCache::ShadowCache()
+    : key(0), valid(false), hitCount(0), missCount(0)
+{
+}
+
+bool ShadowCache::lookup(uint64_t newKey)
+{
+    if (valid && key == newKey) {
+        ++hitCount;
+        return true;
+    }
+    key = newKey;
+    valid = true;
+    ++missCount;
+    return false;
+}
+
+void ShadowCache::invalidate()
+{
+    valid = false;
+}
+
+void ShadowCache::resetCounters()
+{
+    hitCount = 0;
+    missCount = 0;
+}
+
+unsigned long long ShadowCache::hits() const
+{
+    return hitCount;
+}
+
+unsigned long long ShadowCache::misses() const
+{
+    return missCount;
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
@@ -0,0 +1,42 @@
+#ifndef SHADOW_CACHE_H
+#define SHADOW_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* Remembers what the current shadow map and SAT were built from.
+ * The caller hashes everything the shadow depends on (light matrix, caster
+ * transforms, SAT settings) into one key each frame; lookup() tells whether
+ * the textures from the last miss are still valid and keeps hit/miss counts.
+ */
+class ShadowCache {
+public:
+    ShadowCache();
+
+    // true if key matches the cached shadow, otherwise key becomes the new cached key
+    // and the caller has to regenerate the shadow
+    bool lookup(uint64_t key);
+    // forces a miss on the next lookup, e.g. after the shadow textures were overwritten
+    void invalidate();
+    void resetCounters();
+
+    unsigned long long hits() const;
+    unsigned long long misses() const;
+
+private:
+    uint64_t key;
+    bool valid;
+    unsigned long long hitCount;
+    unsigned long long missCount;
+};
+
+// 64-bit FNV-1a hash of size bytes; pass the previous result as seed to hash several values
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+template<typename T>
+uint64_t hashValue(const T& value, uint64_t seed = 14695981039346656037ull)
+{
+    return hashBytes(&value, sizeof(T), seed);
+}
+
+#endif
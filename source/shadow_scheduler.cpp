@@ -0,0 +1,70 @@
+#include "shadow_scheduler.h"
+
+#include <algorithm>
+
+// a light has moved once it is this far from where its map was rendered
+const float MOVEMENT_THRESHOLD = 1e-3f;
+// priority of a stale light per frame it has waited, small against any visible light
+const float WAIT_PRIORITY = 1e-6f;
+
+void ShadowScheduler::resize(int lightCount)
+{
+    renderedPositions.resize(lightCount);
+    valid.assign(lightCount, false);
+    staleFrames.assign(lightCount, 0);
+    priorities.resize(lightCount);
+    stale = lightCount;
+}
+
+void ShadowScheduler::invalidateAll()
+{
+    std::fill(valid.begin(), valid.end(), false);
+}
+
+const std::vector<int>& ShadowScheduler::schedule(const std::vector<glm::vec3>& positions, const std::vector<float>& coverage, int budget)
+{
+    candidates.clear();
+    for (int i = 0; i < (int)valid.size(); ++i)
+    {
+        float movement = valid[i] ? glm::length(positions[i] - renderedPositions[i]) : 0.0f;
+        if (valid[i] && movement < MOVEMENT_THRESHOLD) {
+            staleFrames[i] = 0;
+            continue;
+        }
+        // a map that was never rendered counts like one whose light moved a lot
+        float motion = valid[i] ? movement : 1.0f;
+        priorities[i] = coverage[i] * (1.0f + motion) + WAIT_PRIORITY * float(++staleFrames[i]);
+        candidates.push_back(i);
+    }
+
+    int count = std::min(std::max(budget, 0), (int)candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+        [this](int a, int b) { return priorities[a] > priorities[b]; });
+    selected.assign(candidates.begin(), candidates.begin() + count);
+    for (int light : selected)
+    {
+        renderedPositions[light] = positions[light];
+        valid[light] = true;
+        staleFrames[light] = 0;
+    }
+    stale = (int)candidates.size() - count;
+    return selected;
+}
+
+int ShadowScheduler::staleCount() const
+{
+    return stale;
+}
+
+float sphereScreenCoverage(const glm::vec3& center, float radius, const glm::mat4& view, const glm::mat4& projection)
+{
+    float depth = -(view * glm::vec4(center, 1.0f)).z;
+    if (depth <= radius) {
+        // the camera is inside or right at the sphere
+        return depth + radius > 0.0f ? 1.0f : 0.0f;
+    }
+    // projected radius in normalized device coordinates, the screen is 2 x 2
+    float radiusX = radius * projection[0][0] / depth;
+    float radiusY = radius * projection[1][1] / depth;
+    return std::min(1.0f, 3.14159265f * radiusX * radiusY / 4.0f);
+}
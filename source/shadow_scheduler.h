@@ -0,0 +1,41 @@
+#ifndef SHADOW_SCHEDULER_H
+#define SHADOW_SCHEDULER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+/* Decides which point light shadow maps are rendered again in a frame. A map is stale when
+ * it was never rendered, its light moved or the scene was invalidated; at most budget stale
+ * maps are refreshed per frame, the others keep their cached SATs. Stale lights are ranked
+ * by the part of the screen they cover, weighted up by how far they moved, so visible and
+ * fast lights go first; the frames a map has been stale break ties, so lights off screen
+ * are refreshed once nothing visible is waiting.
+ */
+class ShadowScheduler {
+public:
+    void resize(int lightCount);
+    // marks every map stale, e.g. after a shadow caster moved
+    void invalidateAll();
+
+    // positions and screen coverage (0 - 1, 0 when off screen) of all lights; returns the
+    // lights to refresh this frame, most important first, and records them as rendered
+    const std::vector<int>& schedule(const std::vector<glm::vec3>& positions, const std::vector<float>& coverage, int budget);
+
+    // maps that are still stale after the last schedule()
+    int staleCount() const;
+
+private:
+    std::vector<glm::vec3> renderedPositions;
+    std::vector<bool> valid;
+    std::vector<unsigned int> staleFrames;
+    std::vector<float> priorities;
+    std::vector<int> candidates;
+    std::vector<int> selected;
+    int stale = 0;
+};
+
+// fraction of the screen a sphere covers, estimated from its projected radius
+float sphereScreenCoverage(const glm::vec3& center, float radius, const glm::mat4& view, const glm::mat4& projection);
+
+#endif
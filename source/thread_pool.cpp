@@ -0,0 +1,126 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+// shared between the caller of parallelFor and the helper tasks it queues; a helper
+// can start after all chunks are taken, so the state has to outlive the call
+struct ParallelForState {
+    std::atomic<int> nextChunk{ 0 };
+    std::atomic<int> chunksDone{ 0 };
+    int chunkCount = 0;
+    int count = 0;
+    int grain = 1;
+    const std::function<void(int, int)>* func = nullptr;
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    // process chunks until none are left, returns once this thread can't find more work
+    void run()
+    {
+        int chunk;
+        while ((chunk = nextChunk.fetch_add(1)) < chunkCount)
+        {
+            int begin = chunk * grain;
+            int end = std::min(begin + grain, count);
+            (*func)(begin, end);
+            if (chunksDone.fetch_add(1) + 1 == chunkCount)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.notify_all();
+            }
+        }
+    }
+};
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+    : stopping(false)
+{
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // the calling thread works too, so one less worker is needed
+    for (unsigned int i = 1; i < threadCount; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+unsigned int ThreadPool::size() const
+{
+    return (unsigned int)workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(int count, int grain, const std::function<void(int, int)>& func)
+{
+    if (count <= 0) {
+        return;
+    }
+    grain = std::max(grain, 1);
+
+    std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+    state->count = count;
+    state->grain = grain;
+    state->chunkCount = (count + grain - 1) / grain;
+    state->func = &func;
+
+    // don't wake more helpers than there are chunks for them to take
+    unsigned int helpers = std::min((unsigned int)workers.size(), (unsigned int)state->chunkCount - 1);
+    if (helpers > 0) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (unsigned int i = 0; i < helpers; ++i) {
+                tasks.emplace_back([state]() { state->run(); });
+            }
+        }
+        wakeup.notify_all();
+    }
+
+    state->run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state]() { return state->chunksDone.load() == state->chunkCount; });
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    if (workers.empty()) {
+        task();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.emplace_back(std::move(task));
+    }
+    wakeup.notify_one();
+}
+
+void ThreadPool::workerLoop()
+{
+    for (;;)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
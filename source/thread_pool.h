@@ -0,0 +1,43 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A small fixed-size pool of worker threads.
+ * parallelFor() splits an index range into chunks that the workers and the
+ * calling thread pull from until the range is exhausted, so the caller never
+ * sits idle while the pool is busy.
+ */
+class ThreadPool {
+public:
+    // threadCount == 0 uses one worker per hardware thread
+    explicit ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads that take part in parallelFor (workers + caller)
+    unsigned int size() const;
+    // Calls func(begin, end) for consecutive chunks of at most grain items
+    // covering [0, count) and blocks until every chunk has been processed.
+    void parallelFor(int count, int grain, const std::function<void(int, int)>& func);
+    // Queue a task to run on one of the workers without waiting for it
+    void submit(std::function<void()> task);
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping;
+
+    void workerLoop();
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include "tiled_lighting.h"
+
+#include <glad/glad.h>
+
+// SSBO bindings of the light buffers in tiledLighting.glsl
+const unsigned int MATRIX_BINDING = 5;
+const unsigned int COLOR_SIZE_BINDING = 6;
+
+TiledPointLighting::TiledPointLighting(int width, int height)
+    : width(width), height(height)
+{
+    glGenTextures(1, &target);
+    glBindTexture(GL_TEXTURE_2D, target);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void TiledPointLighting::release()
+{
+    glDeleteTextures(1, &target);
+    target = 0;
+}
+
+void TiledPointLighting::shade(Shader& tiledShader, unsigned int matrixBuffer, unsigned int colorSizeBuffer, int lightCount)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATRIX_BINDING, matrixBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COLOR_SIZE_BINDING, colorSizeBuffer);
+    glBindImageTexture(0, target, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+    tiledShader.use();
+    tiledShader.setUniformInt("lightCount", lightCount);
+    glDispatchCompute((width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE, (height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATRIX_BINDING, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COLOR_SIZE_BINDING, 0);
+}
@@ -0,0 +1,33 @@
+#ifndef TILED_LIGHTING_H
+#define TILED_LIGHTING_H
+
+#include "shader_s.h"
+
+// screen tile edge (workgroup size) and light list capacity of a tile in tiledLighting.Compute
+const unsigned int LIGHT_TILE_SIZE = 16;
+const int MAX_LIGHTS_PER_TILE = 1024;
+
+/* Tiled deferred point lighting (tiledLighting.Compute). One dispatch bins the lights into
+ * screen tiles by the tiles' depth bounds and shades every pixel with the lights of its
+ * tile into an RGBA16F target, which the main lighting pass adds before tonemapping. The
+ * lights come from the instance buffers of the light volumes, bound as storage buffers.
+ * Needs a current OpenGL 4.3 context for construction and all calls.
+ */
+class TiledPointLighting {
+public:
+    TiledPointLighting(int width, int height);
+    // deletes the target, call it while the context is still current
+    void release();
+
+    // the G-buffer has to be bound to units 0 - 3 and the lighting uniforms set;
+    // matrixBuffer holds a mat4 and colorSizeBuffer a vec4 per light
+    void shade(Shader& tiledShader, unsigned int matrixBuffer, unsigned int colorSizeBuffer, int lightCount);
+
+    unsigned int texture() const { return target; }
+
+private:
+    unsigned int target;
+    int width, height;
+};
+
+#endif
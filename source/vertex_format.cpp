@@ -0,0 +1,205 @@
+#include "vertex_format.h"
+
+#include <glad/glad.h>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+struct CompactVertex {
+    uint16_t position[4];   // w pads the position to 8 bytes
+    int16_t normal[2];
+    uint16_t texCoords[2];
+};
+
+struct CompactTangentFrame {
+    int16_t tangent[2];
+    int16_t bitangent[2];
+};
+
+static_assert(sizeof(CompactVertex) == 16, "compact vertices are 16 bytes");
+static_assert(sizeof(CompactTangentFrame) == 8, "compact tangent frames are 8 bytes");
+
+Bounds computeBounds(const std::vector<Vertex>& vertices)
+{
+    Bounds bounds;
+    bounds.min = glm::vec3(std::numeric_limits<float>::max());
+    bounds.max = glm::vec3(-std::numeric_limits<float>::max());
+    for (const Vertex& vertex : vertices)
+    {
+        bounds.min = glm::min(bounds.min, vertex.Position);
+        bounds.max = glm::max(bounds.max, vertex.Position);
+    }
+    bounds.center = vertices.empty() ? glm::vec3(0.0f) : 0.5f * (bounds.min + bounds.max);
+    bounds.radius = 0.0f;
+    for (const Vertex& vertex : vertices)
+        bounds.radius = std::max(bounds.radius, glm::length(vertex.Position - bounds.center));
+    return bounds;
+}
+
+unsigned int vertexStride(VertexFormat format, bool tangents)
+{
+    if (format == VertexFormat::Full) {
+        return sizeof(Vertex);
+    }
+    return sizeof(CompactVertex) + (tangents ? sizeof(CompactTangentFrame) : 0);
+}
+
+unsigned int positionStride(VertexFormat format)
+{
+    return format == VertexFormat::Full ? sizeof(glm::vec3) : sizeof(uint16_t) * 4;
+}
+
+// octahedral encoding with the same folding as the G-buffer normals
+static void packOctahedral(glm::vec3 n, int16_t out[2])
+{
+    float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    glm::vec2 e(0.0f);
+    if (sum > 0.0f) {
+        n /= sum;
+        e = n.z >= 0.0f ? glm::vec2(n.x, n.y) :
+            glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    out[0] = (int16_t)glm::packSnorm1x16(e.x);
+    out[1] = (int16_t)glm::packSnorm1x16(e.y);
+}
+
+void positionDequantization(VertexFormat format, const QuantizationRange& range, glm::vec3& scale, glm::vec3& bias)
+{
+    if (format == VertexFormat::Full) {
+        scale = glm::vec3(1.0f);
+        bias = glm::vec3(0.0f);
+        return;
+    }
+    scale = range.max - range.min;
+    bias = range.min;
+}
+
+void packVertices(const std::vector<Vertex>& vertices, VertexFormat format, bool tangents, const QuantizationRange& range, PackedVertices& packed)
+{
+    packed.format = format;
+    packed.tangents = format == VertexFormat::Full || tangents;
+    packed.vertices.resize(vertices.size() * vertexStride(format, packed.tangents));
+    packed.positions.resize(vertices.size() * positionStride(format));
+    if (vertices.empty()) {
+        return;
+    }
+
+    if (format == VertexFormat::Full) {
+        std::memcpy(packed.vertices.data(), vertices.data(), packed.vertices.size());
+        for (std::size_t i = 0; i < vertices.size(); ++i)
+            std::memcpy(&packed.positions[i * sizeof(glm::vec3)], &vertices[i].Position, sizeof(glm::vec3));
+        return;
+    }
+
+    // flat axes keep a zero scale, their positions all quantize to the bias
+    glm::vec3 extent = range.max - range.min;
+    glm::vec3 inverseExtent(extent.x > 0.0f ? 1.0f / extent.x : 0.0f, extent.y > 0.0f ? 1.0f / extent.y : 0.0f, extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+    unsigned int stride = vertexStride(format, packed.tangents);
+    for (std::size_t i = 0; i < vertices.size(); ++i)
+    {
+        const Vertex& vertex = vertices[i];
+        CompactVertex compact;
+        glm::vec3 unit = (vertex.Position - range.min) * inverseExtent;
+        for (int c = 0; c < 3; ++c)
+            compact.position[c] = glm::packUnorm1x16(unit[c]);
+        compact.position[3] = 0;
+        packOctahedral(vertex.Normal, compact.normal);
+        compact.texCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+        compact.texCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+
+        unsigned char* out = &packed.vertices[i * stride];
+        std::memcpy(out, &compact, sizeof(compact));
+        if (packed.tangents) {
+            CompactTangentFrame frame;
+            packOctahedral(vertex.Tangent, frame.tangent);
+            packOctahedral(vertex.Bitangent, frame.bitangent);
+            std::memcpy(out + sizeof(compact), &frame, sizeof(frame));
+        }
+        std::memcpy(&packed.positions[i * sizeof(compact.position)], compact.position, sizeof(compact.position));
+    }
+}
+
+VertexStreams vertexStreams(const PackedVertices& packed)
+{
+    VertexStreams streams;
+    streams.format = packed.format;
+    streams.tangents = packed.tangents;
+    streams.vertices = packed.vertices.data();
+    streams.positions = packed.positions.data();
+    streams.vertexCount = packed.positions.size() / positionStride(packed.format);
+    return streams;
+}
+
+void packIndices(const std::vector<unsigned int>& indices, std::size_t vertexCount, PackedIndices& packed)
+{
+    if (vertexCount <= 65536) {
+        packed.type = GL_UNSIGNED_SHORT;
+        packed.indices.resize(indices.size() * sizeof(uint16_t));
+        for (std::size_t i = 0; i < indices.size(); ++i)
+        {
+            uint16_t index = (uint16_t)indices[i];
+            std::memcpy(&packed.indices[i * sizeof(uint16_t)], &index, sizeof(index));
+        }
+        return;
+    }
+    packed.type = GL_UNSIGNED_INT;
+    packed.indices.resize(indices.size() * sizeof(unsigned int));
+    if (!indices.empty()) {
+        std::memcpy(packed.indices.data(), indices.data(), packed.indices.size());
+    }
+}
+
+unsigned int indexSize(unsigned int type)
+{
+    if (type == GL_UNSIGNED_SHORT) {
+        return sizeof(uint16_t);
+    }
+    return type == GL_UNSIGNED_INT ? sizeof(unsigned int) : 0;
+}
+
+void setVertexAttributes(VertexFormat format, bool tangents)
+{
+    GLsizei stride = vertexStride(format, tangents);
+    if (format == VertexFormat::Full) {
+        // A great thing about structs is that their memory layout is sequential for all its items.
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, TexCoords));
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Tangent));
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Bitangent));
+        return;
+    }
+
+    // normalized integers, the shaders only apply the dequantization and octahedral decoding
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(CompactVertex, position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(CompactVertex, normal));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(CompactVertex, texCoords));
+    if (tangents) {
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, stride, (void*)(sizeof(CompactVertex) + offsetof(CompactTangentFrame, tangent)));
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 2, GL_SHORT, GL_TRUE, stride, (void*)(sizeof(CompactVertex) + offsetof(CompactTangentFrame, bitangent)));
+    }
+}
+
+void setPositionAttribute(VertexFormat format)
+{
+    glEnableVertexAttribArray(0);
+    if (format == VertexFormat::Full) {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, positionStride(format), (void*)0);
+    }
+    else {
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, positionStride(format), (void*)0);
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Vertex {
+    // position
+    glm::vec3 Position;
+    // normal
+    glm::vec3 Normal;
+    // texCoords
+    glm::vec2 TexCoords;
+    // tangent
+    glm::vec3 Tangent;
+    // bitangent
+    glm::vec3 Bitangent;
+};
+
+// model space bounding volumes, used for culling
+struct Bounds {
+    glm::vec3 min;
+    glm::vec3 max;
+    // bounding sphere
+    glm::vec3 center;
+    float radius;
+};
+
+// box around the positions, sphere around the box center; tighter than the box's half diagonal for round meshes
+Bounds computeBounds(const std::vector<Vertex>& vertices);
+
+/* Box the Compact positions are quantized over. It is the box of the imported mesh, not
+ * the bounds of a chunk, so the chunks of a mesh quantize shared positions on their seams
+ * to the same values.
+ */
+struct QuantizationRange {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+/* GPU vertex layouts. Full uploads Vertex as it is, 56 bytes. Compact quantizes positions
+ * to unorm16 over a QuantizationRange (the vertex shaders apply positionScale and positionBias),
+ * stores normals as octahedral snorm16 pairs and UVs as half floats, 16 bytes; meshes with
+ * a normal map add their tangent and bitangent as octahedral pairs, 24 bytes.
+ * Both layouts also get a position-only stream for the depth-only passes.
+ */
+enum class VertexFormat : uint32_t {
+    Full,
+    Compact
+};
+
+// vertex data in the layout of a format
+struct PackedVertices {
+    VertexFormat format;
+    bool tangents;
+    std::vector<unsigned char> vertices;    // interleaved, vertexStride() bytes each
+    std::vector<unsigned char> positions;   // positionStride() bytes each
+};
+
+// the streams of a mesh as they are uploaded, either packed or in a mapped mesh cache
+struct VertexStreams {
+    VertexFormat format;
+    bool tangents;
+    const void* vertices;
+    const void* positions;
+    std::size_t vertexCount;
+};
+
+// indices in the smallest type that addresses the vertices
+struct PackedIndices {
+    unsigned int type;      // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    std::vector<unsigned char> indices;
+};
+
+unsigned int vertexStride(VertexFormat format, bool tangents);
+unsigned int positionStride(VertexFormat format);
+// the positions of a Compact layout are quantized over range
+void packVertices(const std::vector<Vertex>& vertices, VertexFormat format, bool tangents, const QuantizationRange& range, PackedVertices& packed);
+VertexStreams vertexStreams(const PackedVertices& packed);
+void packIndices(const std::vector<unsigned int>& indices, std::size_t vertexCount, PackedIndices& packed);
+// bytes per index, 0 for anything but GL_UNSIGNED_SHORT and GL_UNSIGNED_INT
+unsigned int indexSize(unsigned int type);
+// the stored positions map to model space as position * scale + bias
+void positionDequantization(VertexFormat format, const QuantizationRange& range, glm::vec3& scale, glm::vec3& bias);
+// attribute pointers into the bound array buffer: 0 position, 1 normal, 2 UV, 3 tangent, 4 bitangent
+void setVertexAttributes(VertexFormat format, bool tangents);
+void setPositionAttribute(VertexFormat format);
+
+#endif